@@ -0,0 +1,209 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../rbtree.h"
+
+#define TIMERS		(1 << 18)
+#define SPAN		(TIMERS * 4)	/* deadlines are ticks in [0, SPAN) */
+#define STEPS		1000
+#define UPDATES		2000000
+#define JITTER		3
+#define CANCELS		200
+#define WINDOW		(SPAN / 1000)	/* ticks cancelled at once */
+
+/* A timer's key is deadline * TIMERS + id, so no two are equal.
+rbtree_update_key() must get the new key in other storage than the
+current one, the tree still sorts 'n' by it during the call. */
+typedef struct item_t {
+	rbnode_t entry;
+	long long key[2];
+	int cur;
+	int id;
+} item_t;
+
+static item_t items_a[TIMERS], items_b[TIMERS];
+
+static int keycmp(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void expired(rbnode_t *n, void *state)
+{
+	(*(size_t *)state)++;
+}
+
+static double seconds(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* The same random deadlines in both trees. */
+static void schedule(rbtree_t *a, rbtree_t *b)
+{
+	int i;
+
+	rbtree_init(a, keycmp);
+	rbtree_init(b, keycmp);
+	srand(1);
+	for (i = 0; i < TIMERS; i++) {
+		items_a[i].id = items_b[i].id = i;
+		items_a[i].cur = items_b[i].cur = 0;
+		items_a[i].key[0] = items_b[i].key[0] =
+			(long long)(rand() % SPAN) * TIMERS + i;
+		items_a[i].entry.key = &items_a[i].key[0];
+		items_b[i].entry.key = &items_b[i].key[0];
+		rbtree_insert(a, &items_a[i].entry);
+		rbtree_insert(b, &items_b[i].entry);
+	}
+}
+
+/* Advance the clock over the whole span and expire what is due. */
+static void expire(rbtree_t *a, rbtree_t *b)
+{
+	struct timespec start;
+	rbnode_t *n;
+	long long limit;
+	size_t na = 0, nb = 0;
+	double ta, tb;
+	int step;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (step = 1; step <= STEPS; step++) {
+		limit = (long long)SPAN / STEPS * step * TIMERS - 1;
+		rbtree_pop_until(a, &limit, expired, &na);
+	}
+	ta = seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (step = 1; step <= STEPS; step++) {
+		limit = (long long)SPAN / STEPS * step * TIMERS - 1;
+		while ((n = rbtree_first(b)) != NULL && keycmp(n->key, &limit) <= 0) {
+			rbtree_remove(b, n);
+			nb++;
+		}
+	}
+	tb = seconds(&start);
+
+	printf("expire:     rbtree_pop_until %lu timers in %.6f sec, "
+		"first+remove %lu in %.6f sec\n",
+		(unsigned long)na, ta, (unsigned long)nb, tb);
+}
+
+/* Push random timers a little later, most of them stay between their
+neighbors. */
+static void reschedule(rbtree_t *a, rbtree_t *b)
+{
+	struct timespec start;
+	item_t *t;
+	long long *key;
+	double ta, tb;
+	int i, fail = 0;
+
+	srand(2);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < UPDATES; i++) {
+		t = &items_a[rand() % TIMERS];
+		key = &t->key[!t->cur];
+		*key = t->key[t->cur] + (long long)(1 + rand() % JITTER) * TIMERS;
+		if (rbtree_update_key(a, &t->entry, key) == 0)
+			t->cur = !t->cur;
+		else
+			fail++;
+	}
+	ta = seconds(&start);
+
+	srand(2);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < UPDATES; i++) {
+		t = &items_b[rand() % TIMERS];
+		rbtree_remove(b, &t->entry);
+		t->key[t->cur] += (long long)(1 + rand() % JITTER) * TIMERS;
+		if (rbtree_insert(b, &t->entry) != 0)
+			fail++;
+	}
+	tb = seconds(&start);
+
+	printf("reschedule: rbtree_update_key %d timers in %.6f sec, "
+		"remove+insert in %.6f sec%s\n",
+		UPDATES, ta, tb, fail ? ", FAILED" : "");
+}
+
+/* Cancel all timers due in random windows, the way a closed connection
+drops its whole batch. */
+static void cancel(rbtree_t *a, rbtree_t *b)
+{
+	struct timespec start;
+	rbnode_t *n, *next;
+	long long lo[CANCELS], hi[CANCELS];
+	size_t na = 0, nb = 0;
+	double ta, tb;
+	int i;
+
+	srand(3);
+	for (i = 0; i < CANCELS; i++) {
+		lo[i] = (long long)(rand() % (SPAN - WINDOW)) * TIMERS;
+		hi[i] = lo[i] + (long long)WINDOW * TIMERS - 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < CANCELS; i++)
+		na += rbtree_remove_range(a, &lo[i], &hi[i], NULL, NULL);
+	ta = seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < CANCELS; i++) {
+		n = rbtree_lower_bound(b, &lo[i]);
+		while (n != NULL && keycmp(n->key, &hi[i]) <= 0) {
+			next = rbtree_next(b, n);
+			rbtree_remove(b, n);
+			n = next;
+			nb++;
+		}
+	}
+	tb = seconds(&start);
+
+	printf("cancel:     rbtree_remove_range %lu timers in %.6f sec, "
+		"lower_bound+remove %lu in %.6f sec\n",
+		(unsigned long)na, ta, (unsigned long)nb, tb);
+}
+
+int main(int argc, char **argv)
+{
+	rbtree_t a, b;
+
+	schedule(&a, &b);
+	reschedule(&a, &b);
+	cancel(&a, &b);
+	expire(&a, &b);
+
+	return 0;
+}
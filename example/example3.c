@@ -0,0 +1,100 @@
+/*
+* MIT License
+* 
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../rbtree_str.h"
+
+typedef struct page_t {
+	rbstrnode_t entry;
+	int hits;
+} page_t;
+
+/* free rbtree. */
+#define free_rbtree(rb) rbtree_foreach_postorder((rb), free_node, NULL)
+
+static int print_node(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	page_t *page = rbtree_container_of(n, page_t, entry.base);
+	printf("%-32s %5s %4d\n",
+		rbstrnode_key(&page->entry)->data,
+		rbnode_is_red(n) ? "red" : "black",
+		page->hits);
+	return 0;
+}
+
+static int free_node(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	page_t *page = rbtree_container_of(n, page_t, entry.base);
+	free(page);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *urls[] = {
+		"https://example.com/",
+		"https://example.com/about",
+		"https://example.com/blog/2017/rbtree",
+		"https://example.com/blog/2017/hash",
+		"https://example.org/",
+		"http://example.com/",
+	};
+	rbtree_t tree = RBTREE_STR_INIT();
+	rbstrarena_t arena = RBSTRARENA_INIT();
+	rbstrnode_t *n;
+	page_t *page;
+	int i;
+
+	/* insert */
+	for (i = 0; i < sizeof(urls) / sizeof(urls[0]); i++) {
+		page = malloc(sizeof(page_t));
+		page->entry.base.key = (void *)rbstrarena_intern(&arena, urls[i], strlen(urls[i]));
+		page->hits = i;
+		rbtree_str_insert(&tree, &page->entry);
+	}
+
+	/* lookup */
+	n = rbtree_str_lookup(&tree, "https://example.com/blog/2017/hash",
+		strlen("https://example.com/blog/2017/hash"));
+	if (n)
+		printf("Find %s.\n", rbstrnode_key(n)->data);
+	else
+		printf("Not exist.\n");
+
+	/* delete */
+	rbtree_remove(&tree, &n->base);
+	free(rbtree_container_of(n, page_t, entry));
+
+	/* print */
+	printf("key                              color hits\n");
+	rbtree_foreach_inorder(&tree, print_node, NULL);
+
+	free_rbtree(&tree);
+	rbstrarena_free(&arena);
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../rbtree_mt.h"
+#include "../rbtree_fc.h"
+
+#define KEYS		(1 << 16)
+#define THREADS		4
+#define OPS			200000
+
+#define MODE_MUTEX	0
+#define MODE_MT		1
+#define MODE_FC		2
+
+typedef struct item_t {
+	rbmtnode_t entry;
+	int key;
+	int in;		/* only touched by the thread owning the key */
+} item_t;
+
+static item_t items[KEYS];
+
+static rbtree_mt_t mt;
+
+static rbtree_fc_t fc;
+
+static rbtree_t tree;
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int found(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	return 0;
+}
+
+/* Thread 'id' works on the keys k with k % THREADS == id,
+half lookups, half inserts or removes. */
+static void *worker(void *arg)
+{
+	int id = (int)(long)arg, mode = id / THREADS, i, k;
+	unsigned int seed = (unsigned int)id + 1;
+	rbfcslot_t slot;
+	item_t *it;
+
+	id %= THREADS;
+	if (mode == MODE_FC)
+		rbtree_fc_register(&fc, &slot);
+
+	for (i = 0; i < OPS; i++) {
+		k = (rand_r(&seed) % (KEYS / THREADS)) * THREADS + id;
+		it = items + k;
+		if (mode == MODE_FC) {
+			if (rand_r(&seed) & 1)
+				rbtree_fc_lookup(&fc, &slot, &it->key);
+			else if (it->in)
+				it->in = rbtree_fc_remove(&fc, &slot, &it->key) == NULL;
+			else
+				it->in = rbtree_fc_insert(&fc, &slot, &it->entry.base) == 0;
+		}
+		else if (mode == MODE_MT) {
+			if (rand_r(&seed) & 1)
+				rbtree_mt_lookup(&mt, &it->key, found, NULL);
+			else if (it->in)
+				it->in = rbtree_mt_remove(&mt, &it->key) == NULL;
+			else
+				it->in = rbtree_mt_insert(&mt, &it->entry) == 0;
+		}
+		else {
+			pthread_mutex_lock(&tree_lock);
+			if (rand_r(&seed) & 1)
+				rbtree_lookup(&tree, &it->key);
+			else if (it->in) {
+				rbtree_remove(&tree, &it->entry.base);
+				it->in = 0;
+			}
+			else
+				it->in = rbtree_insert(&tree, &it->entry.base) == 0;
+			pthread_mutex_unlock(&tree_lock);
+		}
+	}
+
+	if (mode == MODE_FC)
+		rbtree_fc_unregister(&fc, &slot);
+	return NULL;
+}
+
+static double run(int mode)
+{
+	pthread_t threads[THREADS];
+	struct timespec start, end;
+	int i;
+
+	for (i = 0; i < KEYS; i++) {
+		items[i].key = i;
+		items[i].entry.base.key = &items[i].key;
+		items[i].in = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)(long)(i + mode * THREADS));
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (double)THREADS * OPS /
+		((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	double ops;
+	int i;
+
+	rbtree_init(&tree, keycmp);
+	rbtree_mt_init(&mt, keycmp);
+	rbtree_fc_init(&fc, keycmp, 0);
+	for (i = 0; i < KEYS; i++)
+		rbmtnode_init(&items[i].entry);
+
+	printf("%d threads, %d ops each\n", THREADS, OPS);
+	ops = run(MODE_MUTEX);
+	printf("single mutex:   %.0f ops/sec, %zu nodes\n", ops, rbtree_size(&tree));
+	ops = run(MODE_MT);
+	printf("lock coupling:  %.0f ops/sec, %zu nodes\n", ops, rbtree_size(&mt.tree));
+	ops = run(MODE_FC);
+	printf("flat combining: %.0f ops/sec, %zu nodes, %.1f requests per batch\n",
+		ops, rbtree_size(&fc.tree), (double)fc.combined / fc.batches);
+
+	for (i = 0; i < KEYS; i++)
+		rbmtnode_destroy(&items[i].entry);
+	rbtree_mt_destroy(&mt);
+	rbtree_fc_destroy(&fc);
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../rbtree_merkle.h"
+
+#define KEYS		(1 << 20)
+#define CHANGES		16
+
+typedef struct item_t {
+	rbmerklenode_t entry;
+	int key;
+} item_t;
+
+static item_t *items_a, *items_b;
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t keyhash(const void *key)
+{
+	return (uint64_t)*(const int *)key;
+}
+
+static int only_in_a(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	(*(int *)state)++;
+	return 0;
+}
+
+static int only_in_b(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	(*(int *)state)++;
+	return 0;
+}
+
+/* Walk both trees in order, the way to compare them without hashes. */
+static int full_scan(rbmerkle_t *a, rbmerkle_t *b)
+{
+	rbnode_t *x = rbtree_first(&a->tree), *y = rbtree_first(&b->tree);
+	int cmp, diffs = 0;
+
+	while (!rbnode_is_nil(x) || !rbnode_is_nil(y)) {
+		if (rbnode_is_nil(y))
+			cmp = -1;
+		else if (rbnode_is_nil(x))
+			cmp = 1;
+		else
+			cmp = keycmp(x->key, y->key);
+
+		if (cmp != 0)
+			diffs++;
+		if (cmp <= 0)
+			x = rbtree_next(&a->tree, x);
+		if (cmp >= 0)
+			y = rbtree_next(&b->tree, y);
+	}
+	return diffs;
+}
+
+static double seconds(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	rbmerkle_t a, b;
+	struct timespec start;
+	double t;
+	int i, k, diffs;
+
+	items_a = malloc(KEYS * sizeof(item_t));
+	items_b = malloc(KEYS * sizeof(item_t));
+	if (items_a == NULL || items_b == NULL)
+		return 1;
+
+	rbmerkle_init(&a, keycmp, keyhash, 0);
+	rbmerkle_init(&b, keycmp, keyhash, 0);
+
+	/* same keys, inserted in different orders, so the shapes differ */
+	for (i = 0; i < KEYS; i++) {
+		items_a[i].key = items_b[i].key = i * 2;
+		items_a[i].entry.base.key = &items_a[i].key;
+		items_b[i].entry.base.key = &items_b[i].key;
+		rbtree_insert(&a.tree, &items_a[i].entry.base);
+	}
+	for (i = KEYS - 1; i >= 0; i--)
+		rbtree_insert(&b.tree, &items_b[i].entry.base);
+
+	printf("%d keys, root hashes %s\n", KEYS,
+		rbmerkle_hash(&a) == rbmerkle_hash(&b) ? "equal" : "differ");
+
+	/* some keys only in 'a', some only in 'b' */
+	srand(1);
+	for (i = 0; i < CHANGES; i++) {
+		k = rand() % KEYS;
+		if (i & 1) {
+			if (rbtree_lookup(&a.tree, &items_a[k].key) != NULL)
+				rbtree_remove(&a.tree, &items_a[k].entry.base);
+		}
+		else {
+			if (rbtree_lookup(&b.tree, &items_b[k].key) != NULL)
+				rbtree_remove(&b.tree, &items_b[k].entry.base);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	diffs = full_scan(&a, &b);
+	t = seconds(&start);
+	printf("full scan:   %d differences in %.6f sec\n", diffs, t);
+
+	diffs = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rbtree_diff(&a, &b, only_in_a, only_in_b, &diffs);
+	t = seconds(&start);
+	printf("merkle diff: %d differences in %.6f sec\n", diffs, t);
+
+	free(items_a);
+	free(items_b);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../rbtree.h"
+
+#define KEYS		(1 << 20)
+#define LOOKUPS		(1 << 22)
+
+typedef struct item_t {
+	rbnode_t entry;
+	int key;
+	char payload[40];
+} item_t;
+
+typedef struct arena_t {
+	item_t *items;
+	size_t used;
+	int malloced;	/* the nodes moved from are malloc()ed one by one */
+} arena_t;
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+static rbnode_t *alloc_item(rbnode_t *n, void *state)
+{
+	arena_t *arena = state;
+	return &arena->items[arena->used++].entry;
+}
+
+static void move_item(rbnode_t *to, rbnode_t *from, void *state)
+{
+	item_t *a = rbtree_container_of(to, item_t, entry);
+	item_t *b = rbtree_container_of(from, item_t, entry);
+
+	a->key = b->key;
+	memcpy(a->payload, b->payload, sizeof(a->payload));
+	to->key = &a->key;
+	if (((arena_t *)state)->malloced)
+		free(b);
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double run_lookups(rbtree_t *tree)
+{
+	double start;
+	unsigned int seed = 1;
+	int i, k, found = 0;
+
+	start = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		k = rand_r(&seed) % KEYS;
+		found += !rbnode_is_nil(rbtree_lookup(tree, &k));
+	}
+	if (found != LOOKUPS)
+		printf("lost %d keys\n", LOOKUPS - found);
+	return LOOKUPS / (now() - start);
+}
+
+int main(int argc, char **argv)
+{
+	rbtree_t tree = RBTREE_INIT(keycmp);
+	rbcompact_t cursor = RBCOMPACT_INIT();
+	arena_t arena = { 0 };
+	void **junk;
+	int *order, i, j, t;
+	item_t *it, *old;
+	double start;
+
+	/* keys inserted in random order, each node allocated between
+	blocks of other sizes which are freed later, like a long-running
+	process does */
+	order = malloc(sizeof(int) * KEYS);
+	junk = malloc(sizeof(void *) * KEYS);
+	for (i = 0; i < KEYS; i++)
+		order[i] = i;
+	for (i = KEYS - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	for (i = 0; i < KEYS; i++) {
+		junk[i] = malloc(16 + rand() % 512);
+		it = malloc(sizeof(item_t));
+		it->key = order[i];
+		it->entry.key = &it->key;
+		rbtree_insert(&tree, &it->entry);
+	}
+	for (i = 0; i < KEYS; i++)
+		free(junk[i]);
+
+	printf("%d keys, %d lookups\n", KEYS, LOOKUPS);
+	printf("scattered:   %.0f lookups/sec\n", run_lookups(&tree));
+
+	arena.items = malloc(sizeof(item_t) * KEYS);
+	arena.malloced = 1;
+	start = now();
+	rbtree_compact(&tree, alloc_item, move_item, &arena);
+	printf("compact:     %.1f ms\n", (now() - start) * 1e3);
+	printf("compacted:   %.0f lookups/sec\n", run_lookups(&tree));
+
+	/* again into a new block, 4096 nodes per step */
+	old = arena.items;
+	arena.items = malloc(sizeof(item_t) * KEYS);
+	arena.used = 0;
+	arena.malloced = 0;
+	start = now();
+	for (i = 0; rbtree_compact_step(&tree, &cursor, 4096,
+			alloc_item, move_item, &arena) > 0; i++)
+		;
+	printf("%d steps:   %.1f ms\n", i, (now() - start) * 1e3);
+	printf("compacted:   %.0f lookups/sec\n", run_lookups(&tree));
+
+	free(old);
+	free(arena.items);
+	free(order);
+	free(junk);
+	return 0;
+}
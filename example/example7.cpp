@@ -0,0 +1,142 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "../rbtree.hpp"
+
+#define KEYS		(1 << 20)
+#define LOOKUPS		(1 << 22)
+#define REQUESTS	(1 << 16)
+#define REQUEST_KEYS	64
+
+static double now()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Insert, look up, iterate and erase the same keys, prints ns per op. */
+template <class Map>
+static void run(const char *name, const std::vector<int> &keys)
+{
+	Map m;
+	double t0, t1, t2, t3, t4;
+	long sum = 0;
+	size_t i;
+
+	t0 = now();
+	for (i = 0; i < keys.size(); i++)
+		m.emplace(keys[i], std::string(24, 'x'));
+	t1 = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		typename Map::iterator it = m.find(keys[(i * 7919) % keys.size()]);
+		sum += it->second.size();
+	}
+	t2 = now();
+	for (typename Map::iterator it = m.begin(); it != m.end(); ++it)
+		sum += it->first;
+	t3 = now();
+	for (i = 0; i < keys.size(); i++)
+		m.erase(keys[i]);
+	t4 = now();
+
+	printf("%-10s insert %6.1f  find %6.1f  iterate %5.1f  erase %6.1f ns  (%ld)\n",
+		name, (t1 - t0) * 1e9 / keys.size(), (t2 - t1) * 1e9 / LOOKUPS,
+		(t3 - t2) * 1e9 / keys.size(), (t4 - t3) * 1e9 / keys.size(), sum);
+}
+
+/* Many short-lived trees, one per request. With rb::pmr::map on a
+monotonic buffer of the stack nothing is allocated from the heap and
+dropping the tree doesn't visit its nodes. */
+template <class Map, class... Args>
+static double run_requests(const std::vector<int> &keys, Args &&... args)
+{
+	double t0 = now();
+	long sum = 0;
+	size_t i, j;
+
+	for (i = 0; i < REQUESTS; i++) {
+		Map m(std::forward<Args>(args)...);
+		for (j = 0; j < REQUEST_KEYS; j++)
+			m.emplace(keys[(i + j * 4099) % keys.size()], (int)j);
+		sum += m.begin()->second;
+	}
+	(void)sum;
+	return (now() - t0) * 1e9 / REQUESTS;
+}
+
+static double run_pmr_requests(const std::vector<int> &keys)
+{
+	double t0 = now();
+	long sum = 0;
+	size_t i, j;
+
+	for (i = 0; i < REQUESTS; i++) {
+		char buf[REQUEST_KEYS * 64];
+		std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf),
+			std::pmr::null_memory_resource());
+		rb::pmr::map<int, int> m(&arena);
+		for (j = 0; j < REQUEST_KEYS; j++)
+			m.emplace(keys[(i + j * 4099) % keys.size()], (int)j);
+		sum += m.begin()->second;
+	}
+	(void)sum;
+	return (now() - t0) * 1e9 / REQUESTS;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<int> keys(KEYS);
+	size_t i, j;
+
+	for (i = 0; i < keys.size(); i++)
+		keys[i] = (int)i;
+	for (i = keys.size() - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		std::swap(keys[i], keys[j]);
+	}
+
+	printf("%d random keys, %d lookups\n", KEYS, LOOKUPS);
+	run<std::map<int, std::string> >("std::map", keys);
+	run<rb::map<int, std::string> >("rb::map", keys);
+
+	printf("\n%d requests, a tree of %d keys each, ns per request\n",
+		REQUESTS, REQUEST_KEYS);
+	printf("std::map                    %8.0f\n",
+		run_requests<std::map<int, int> >(keys));
+	printf("rb::map                     %8.0f\n",
+		run_requests<rb::map<int, int> >(keys));
+	printf("rb::pmr::map, stack arena   %8.0f\n", run_pmr_requests(keys));
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../rbtree.h"
+
+#define KEYS		64
+#define ITEMS		(1 << 16)
+#define POPS		100
+
+typedef struct item_t {
+	rbnode_t entry;
+	int key;
+	int seq;	/* insertion order */
+} item_t;
+
+static item_t items[ITEMS];
+
+static size_t counts[KEYS];
+
+typedef struct equal_t {
+	int key;
+	int seq;		/* last seen */
+	size_t n;
+	int bad;
+} equal_t;
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int check_equal(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	equal_t *e = state;
+	item_t *it = (item_t *)n;
+
+	if (it->key != e->key || it->seq <= e->seq)
+		e->bad++;
+	e->seq = it->seq;
+	e->n++;
+	return 0;
+}
+
+/* In-order must be sorted by key, then by insertion order, and
+rbtree_count() and rbtree_foreach_equal() must agree with it. */
+static int check(rbtree_t *tree)
+{
+	rbnode_t *n;
+	item_t *it, *last = NULL;
+	equal_t e;
+	size_t total = 0;
+	int k, bad = 0;
+
+	for (n = rbtree_first(tree); !rbnode_is_nil(n); n = rbtree_next(tree, n)) {
+		it = (item_t *)n;
+		if (last != NULL && (it->key < last->key ||
+				(it->key == last->key && it->seq <= last->seq)))
+			bad++;
+		last = it;
+		total++;
+	}
+	if (total != tree->count)
+		bad++;
+
+	for (k = 0; k < KEYS; k++) {
+		if (rbtree_count(tree, &k) != counts[k])
+			bad++;
+		e.key = k;
+		e.seq = -1;
+		e.n = 0;
+		e.bad = 0;
+		rbtree_foreach_equal(tree, &k, check_equal, &e);
+		if (e.bad || e.n != counts[k])
+			bad++;
+	}
+	return bad;
+}
+
+static double seconds(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run(const char *name, unsigned int flags)
+{
+	rbtree_t tree;
+	rbnode_t *n;
+	item_t *it;
+	struct timespec start;
+	double t;
+	int i, k, seq, bad = 0;
+
+	rbtree_init_ex(&tree, keycmp, flags);
+	for (k = 0; k < KEYS; k++)
+		counts[k] = 0;
+
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ITEMS; i++) {
+		items[i].key = rand() % KEYS;
+		items[i].seq = i;
+		items[i].entry.key = &items[i].key;
+		if (rbtree_insert(&tree, &items[i].entry) != 0)
+			bad++;
+		counts[items[i].key]++;
+	}
+	t = seconds(&start);
+	bad += check(&tree);
+
+	/* remove every third one, from anywhere in the queues */
+	for (i = 0; i < ITEMS; i += 3) {
+		rbtree_remove(&tree, &items[i].entry);
+		counts[items[i].key]--;
+	}
+	bad += check(&tree);
+
+	/* pop the queues from the front, lookup gives the oldest one */
+	for (i = 0; i < POPS; i++) {
+		k = i % KEYS;
+		seq = -1;
+		while ((n = rbtree_lookup(&tree, &k)) != NULL) {
+			it = (item_t *)n;
+			if (it->seq <= seq)
+				bad++;
+			seq = it->seq;
+			rbtree_remove(&tree, n);
+			counts[k]--;
+			if (counts[k] % 2 == 0)
+				break;
+		}
+	}
+	bad += check(&tree);
+
+	printf("%s: %d items over %d keys inserted in %.6f sec, %s\n",
+		name, ITEMS, KEYS, t, bad ? "FAILED" : "order and counts ok");
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	int bad = 0;
+
+	bad += run("RBTREE_MULTI_CHAIN", RBTREE_MULTI_CHAIN);
+	bad += run("RBTREE_MULTI_NODES", RBTREE_MULTI_NODES);
+
+	return bad ? 1 : 0;
+}
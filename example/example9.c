@@ -0,0 +1,149 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../rbtree.h"
+
+#define KEYS		(1 << 18)
+#define CHURN		2000000
+#define DELETES		(KEYS / 2)
+
+typedef struct item_t {
+	rbnode_t entry;
+	int key;
+	int freed;
+} item_t;
+
+/* 'spare' has a second node for every key, to reinsert a deleted key
+with another node than the tombstone's */
+static item_t items[KEYS], spare[KEYS];
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* rbtree_purge() always calls it, NULL is not allowed */
+static void free_item(rbnode_t *n, void *state)
+{
+	((item_t *)n)->freed = 1;
+	(*(size_t *)state)++;
+}
+
+static double seconds(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void fill(rbtree_t *tree, unsigned int flags)
+{
+	int i;
+
+	rbtree_init_ex(tree, keycmp, flags);
+	for (i = 0; i < KEYS; i++) {
+		items[i].key = spare[i].key = i;
+		items[i].freed = spare[i].freed = 0;
+		items[i].entry.key = &items[i].key;
+		spare[i].entry.key = &spare[i].key;
+		rbtree_insert(tree, &items[i].entry);
+	}
+}
+
+/* delete a random key and insert it again right away */
+static double churn(rbtree_t *tree)
+{
+	struct timespec start;
+	int i, k;
+
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < CHURN; i++) {
+		k = rand() % KEYS;
+		rbtree_remove(tree, &items[k].entry);
+		rbtree_insert(tree, &items[k].entry);
+	}
+	return seconds(&start);
+}
+
+int main(int argc, char **argv)
+{
+	rbtree_t tree;
+	rbnode_t *n;
+	struct timespec start;
+	double t;
+	size_t tombstones, graveyard, freed;
+	int i, k, bad;
+
+	fill(&tree, 0);
+	t = churn(&tree);
+	printf("plain: %d delete/reinsert in %.6f sec\n", CHURN, t);
+
+	/* the same node revives its own tombstone, no rebalancing at all */
+	fill(&tree, RBTREE_LAZY_DELETE);
+	t = churn(&tree);
+	printf("lazy:  %d delete/reinsert in %.6f sec, %lu tombstones left\n",
+		CHURN, t, (unsigned long)tree.tombstones);
+
+	/* delete every other key, then bring back half of them with the
+	spare nodes, which take the place of the tombstones and send them
+	to the graveyard */
+	for (k = 0; k < KEYS; k += 2)
+		rbtree_remove(&tree, &items[k].entry);
+	for (k = 0; k < KEYS; k += 4)
+		rbtree_insert(&tree, &spare[k].entry);
+	tombstones = tree.tombstones;
+	for (graveyard = 0, n = tree.graveyard; !rbnode_is_nil(n); n = n->right)
+		graveyard++;
+	printf("lazy:  %lu live, %lu tombstones, %lu in the graveyard\n",
+		(unsigned long)rbtree_size(&tree), (unsigned long)tombstones,
+		(unsigned long)graveyard);
+
+	freed = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rbtree_purge(&tree, 0, free_item, &freed);
+	t = seconds(&start);
+
+	/* only the deleted nodes are freed, every live key finds its node */
+	bad = freed != tombstones + graveyard || tree.tombstones != 0;
+	for (i = 0; i < KEYS; i++) {
+		n = rbtree_lookup(&tree, &i);
+		if (i % 4 == 0)
+			bad += n != &spare[i].entry || !items[i].freed;
+		else if (i % 2 == 0)
+			bad += n != NULL || !items[i].freed;
+		else
+			bad += n != &items[i].entry || items[i].freed;
+	}
+	printf("purge: %lu nodes freed in %.6f sec, %lu live, %s\n",
+		(unsigned long)freed, t, (unsigned long)rbtree_size(&tree),
+		bad ? "FAILED" : "lookups ok");
+
+	return bad ? 1 : 0;
+}
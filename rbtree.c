@@ -24,9 +24,34 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include "rbtree.h"
 
+#define augment_node(tree, n) \
+	do { \
+		if ((tree)->augment != NULL) \
+			(tree)->augment((tree), (n)); \
+	} while (0)
+
+/* Update the augmented data from 'n' up to the root. */
+static void augment_path(rbtree_t *tree, rbnode_t *n)
+{
+	if (tree->augment == NULL)
+		return;
+	for (; !rbnode_is_nil(n); n = n->parent)
+		tree->augment(tree, n);
+}
+
+static rbnode_t *leftmost_of(rbnode_t *n)
+{
+	if (!rbnode_is_nil(n)) {
+		while (!rbnode_is_nil(n->left))
+			n = n->left;
+	}
+	return n;
+}
+
 static void rbtree_left_rotate(rbtree_t *tree, rbnode_t *x)
 {
 	rbnode_t *y;
@@ -48,6 +73,9 @@ static void rbtree_left_rotate(rbtree_t *tree, rbnode_t *x)
 
 	y->left = x;
 	x->parent = y;
+
+	augment_node(tree, x);
+	augment_node(tree, y);
 }
 
 static void rbtree_right_rotate(rbtree_t *tree, rbnode_t *y)
@@ -71,10 +99,16 @@ static void rbtree_right_rotate(rbtree_t *tree, rbnode_t *y)
 
 	x->right = y;
 	y->parent = x;
+
+	augment_node(tree, y);
+	augment_node(tree, x);
 }
 
-static void rbtree_insert_fixup(rbtree_t *tree, rbnode_t *n)
+/* Returns 1 if the black height of the tree grew. */
+static int rbtree_insert_fixup(rbtree_t *tree, rbnode_t *n)
 {
+	int grew;
+
 	while (!rbnode_is_nil(n) && rbnode_is_red(n->parent)) {
 		rbnode_t *uncle;
 		if (rbnode_is_left(n->parent)) {
@@ -114,32 +148,161 @@ static void rbtree_insert_fixup(rbtree_t *tree, rbnode_t *n)
 			}
 		}
 	}
+	grew = rbnode_is_red(tree->root);
 	tree->root->color = rbnode_black;
+	return grew;
+}
+
+/* Queue 'n' after the nodes which already queued on 'h'. */
+static void chain_append(rbnode_t *h, rbnode_t *n)
+{
+	n->left = n->right = rbnode_nil;
+	n->flags = RBNODE_DUP;
+	n->color = rbnode_black;
+	if (rbnode_is_nil(h->dup)) {
+		n->dup = n;
+	}
+	else {
+		n->dup = h->dup->dup;
+		h->dup->dup = n;
+		h->dup->parent = rbnode_nil;
+	}
+	n->parent = h;
+	h->dup = n;
+}
+
+/* Unlink a queued node from its chain. */
+static void chain_remove(rbnode_t *n)
+{
+	rbnode_t *p;
+
+	p = n;
+	while (p->dup != n)
+		p = p->dup;
+
+	if (p == n) {
+		n->parent->dup = rbnode_nil;
+	}
+	else {
+		p->dup = n->dup;
+		if (!rbnode_is_nil(n->parent)) {
+			/* 'n' was the last one */
+			p->parent = n->parent;
+			n->parent->dup = p;
+		}
+	}
+
+	n->flags &= ~RBNODE_DUP;
+	n->dup = n->parent = rbnode_nil;
+}
+
+/* Put 'm' at the position of 'n' in the tree. */
+static void rbtree_replace(rbtree_t *tree, rbnode_t *n, rbnode_t *m)
+{
+	m->left = n->left;
+	m->right = n->right;
+	m->parent = n->parent;
+	m->color = n->color;
+
+	if (!rbnode_is_nil(n->left))
+		n->left->parent = m;
+
+	if (!rbnode_is_nil(n->right))
+		n->right->parent = m;
+
+	if (rbnode_is_root(n))
+		tree->root = m;
+	else if (rbnode_is_left(n))
+		n->parent->left = m;
+	else
+		n->parent->right = m;
+
+	if (tree->leftmost == n)
+		tree->leftmost = m;
+}
+
+/* Remove tree node 'n' which has queued nodes,
+the first queued node takes its place. */
+static void chain_promote(rbtree_t *tree, rbnode_t *n)
+{
+	rbnode_t *last = n->dup, *first = last->dup;
+
+	if (first == last) {
+		last = rbnode_nil;
+	}
+	else {
+		last->dup = first->dup;
+		last->parent = first;
+	}
+
+	rbtree_replace(tree, n, first);
+
+	first->flags &= ~RBNODE_DUP;
+	first->dup = last;
+
+	n->dup = rbnode_nil;
+
+	augment_path(tree, first);
 }
 
-/* binary tree insert */
+/* Reinsert the key of tombstone 't', 'n' takes its place. */
+static void tombstone_revive(rbtree_t *tree, rbnode_t *t, rbnode_t *n)
+{
+	tree->tombstones--;
+
+	if (t == n) {
+		t->flags &= ~RBNODE_TOMBSTONE;
+		augment_path(tree, t);
+		return;
+	}
+
+	n->flags = 0;
+	n->dup = rbnode_nil;
+	rbtree_replace(tree, t, n);
+
+	t->left = t->parent = rbnode_nil;
+	t->right = tree->graveyard;
+	tree->graveyard = t;
+
+	augment_path(tree, n);
+}
+
+/* binary tree insert.
+Returns 1 if 'n' is queued on an existing node (RBTREE_MULTI_CHAIN)
+or revives a tombstone (RBTREE_LAZY_DELETE). */
 static int btree_insert(rbtree_t *tree, rbnode_t *n)
 {
 	int cmp;
 	rbnode_t *x, *y;
 
-	n->left = n->right = rbnode_nil;
-
 	y = x = tree->root;
 	while (!rbnode_is_nil(x)) {
 		y = x;
 		cmp = tree->keycmp(n->key, x->key);
 		if (cmp < 0)
 			x = x->left;
-		else if (cmp > 0)
+		else if (cmp > 0 || (tree->flags & RBTREE_MULTI_NODES))
 			x = x->right;
+		else if (rbnode_is_tombstone(x)) {
+			tombstone_revive(tree, x, n);
+			return 1;
+		}
+		else if (tree->flags & RBTREE_MULTI_CHAIN) {
+			chain_append(x, n);
+			tree->count++;
+			return 1;
+		}
 		else {
 			errno = EEXIST;
 			return -1;
 		}
 	}
 
+	n->left = n->right = rbnode_nil;
+	n->flags = 0;
+	n->dup = rbnode_nil;
 	n->parent = y;
+	tree->count++;
 	if (rbnode_is_nil(y))
 		tree->root = n;
 	else if (cmp < 0)
@@ -147,32 +310,64 @@ static int btree_insert(rbtree_t *tree, rbnode_t *n)
 	else
 		y->right = n;
 
+	if (rbnode_is_nil(y) || (y == tree->leftmost && cmp < 0))
+		tree->leftmost = n;
+
 	return 0;
 }
 
 int rbtree_insert(rbtree_t *tree, rbnode_t *n)
 {
+	int r;
 
-	if (btree_insert(tree, n) != 0)
-		return -1;
+	if ((r = btree_insert(tree, n)) != 0)
+		return r > 0 ? 0 : -1;
 
 	n->color = rbnode_red;
 
+	augment_path(tree, n);
 	rbtree_insert_fixup(tree, n);
 
 	return 0;
 }
 
+void rbtree_link(rbtree_t *tree, rbnode_t *parent, rbnode_t **link, rbnode_t *n)
+{
+	n->left = n->right = rbnode_nil;
+	n->parent = parent;
+	n->flags = 0;
+	n->dup = rbnode_nil;
+	*link = n;
+	tree->count++;
+	if (rbnode_is_nil(parent) || (parent == tree->leftmost && link == &parent->left))
+		tree->leftmost = n;
+
+	n->color = rbnode_red;
+
+	augment_path(tree, n);
+	rbtree_insert_fixup(tree, n);
+}
+
 rbnode_t *rbtree_lookup(rbtree_t *tree, const void *key)
 {
 	rbnode_t *n = tree->root;
 	int cmp;
+
+	if (tree->flags & RBTREE_MULTI_NODES) {
+		n = rbtree_lower_bound(tree, key);
+		if (!rbnode_is_nil(n) && tree->keycmp(n->key, key) != 0)
+			n = rbnode_nil;
+		return n;
+	}
+
 	while (!rbnode_is_nil(n) && (cmp = tree->keycmp(n->key, key)) != 0) {
 		if (cmp > 0)
 			n = n->left;
 		else
 			n = n->right;
 	}
+	if (!rbnode_is_nil(n) && rbnode_is_tombstone(n))
+		n = rbnode_nil;
 	return n;
 }
 
@@ -206,12 +401,177 @@ static rbnode_t *rbtree_predecessor(rbtree_t *tree, rbnode_t *n)
 	return n;
 }
 
+static rbnode_t *first_node(rbtree_t *tree)
+{
+	return tree->leftmost;
+}
+
+static rbnode_t *last_node(rbtree_t *tree)
+{
+	rbnode_t *n = tree->root;
+	if (!rbnode_is_nil(n)) {
+		while (!rbnode_is_nil(n->right))
+			n = n->right;
+		if (!rbnode_is_nil(n->dup))
+			n = n->dup;
+	}
+	return n;
+}
+
+/* Next node, duplicates included, tombstones not skipped. */
+static rbnode_t *next_node(rbtree_t *tree, rbnode_t *n)
+{
+	if (n->flags & RBNODE_DUP) {
+		if (rbnode_is_nil(n->parent))
+			return n->dup;
+		/* the last queued one, continue from its tree node */
+		n = n->parent;
+	}
+	else if (!rbnode_is_nil(n->dup)) {
+		return n->dup->dup;
+	}
+	return rbtree_successor(tree, n);
+}
+
+/* Previous node, duplicates included, tombstones not skipped. */
+static rbnode_t *prev_node(rbtree_t *tree, rbnode_t *n)
+{
+	rbnode_t *p;
+
+	if (n->flags & RBNODE_DUP) {
+		p = n;
+		while (p->dup != n)
+			p = p->dup;
+		/* 'p' precedes 'n' on the circular chain. If 'p' is the last
+		one (it points at the tree node), 'n' is the first one and
+		comes right after the tree node. */
+		if (!rbnode_is_nil(p->parent))
+			return p->parent;
+		return p;
+	}
+
+	p = rbtree_predecessor(tree, n);
+	if (!rbnode_is_nil(p) && !rbnode_is_nil(p->dup))
+		return p->dup;
+	return p;
+}
+
+rbnode_t *rbtree_first(rbtree_t *tree)
+{
+	rbnode_t *n = first_node(tree);
+	while (!rbnode_is_nil(n) && rbnode_is_tombstone(n))
+		n = next_node(tree, n);
+	return n;
+}
+
+rbnode_t *rbtree_last(rbtree_t *tree)
+{
+	rbnode_t *n = last_node(tree);
+	while (!rbnode_is_nil(n) && rbnode_is_tombstone(n))
+		n = prev_node(tree, n);
+	return n;
+}
+
+rbnode_t *rbtree_next(rbtree_t *tree, rbnode_t *n)
+{
+	do {
+		n = next_node(tree, n);
+	} while (!rbnode_is_nil(n) && rbnode_is_tombstone(n));
+	return n;
+}
+
+rbnode_t *rbtree_prev(rbtree_t *tree, rbnode_t *n)
+{
+	do {
+		n = prev_node(tree, n);
+	} while (!rbnode_is_nil(n) && rbnode_is_tombstone(n));
+	return n;
+}
+
+rbnode_t *rbtree_lower_bound(rbtree_t *tree, const void *key)
+{
+	rbnode_t *n = tree->root, *r = rbnode_nil;
+	while (!rbnode_is_nil(n)) {
+		if (tree->keycmp(n->key, key) >= 0) {
+			r = n;
+			n = n->left;
+		}
+		else
+			n = n->right;
+	}
+	if (!rbnode_is_nil(r) && rbnode_is_tombstone(r))
+		r = rbtree_next(tree, r);
+	return r;
+}
+
+rbnode_t *rbtree_upper_bound(rbtree_t *tree, const void *key)
+{
+	rbnode_t *n = tree->root, *r = rbnode_nil;
+	while (!rbnode_is_nil(n)) {
+		if (tree->keycmp(n->key, key) > 0) {
+			r = n;
+			n = n->left;
+		}
+		else
+			n = n->right;
+	}
+	if (!rbnode_is_nil(r) && rbnode_is_tombstone(r))
+		r = rbtree_next(tree, r);
+	return r;
+}
+
+size_t rbtree_count(rbtree_t *tree, const void *key)
+{
+	rbnode_t *n, *m;
+	size_t count = 0;
+
+	if (tree->flags & RBTREE_MULTI_NODES) {
+		for (n = rbtree_lower_bound(tree, key);
+			!rbnode_is_nil(n) && tree->keycmp(n->key, key) == 0;
+			n = rbtree_successor(tree, n))
+			count++;
+		return count;
+	}
+
+	n = rbtree_lookup(tree, key);
+	if (rbnode_is_nil(n))
+		return 0;
+
+	count = 1;
+	if (!rbnode_is_nil(n->dup)) {
+		m = n->dup;
+		do {
+			count++;
+			m = m->dup;
+		} while (m != n->dup);
+	}
+
+	return count;
+}
+
+int rbtree_foreach_equal(rbtree_t *tree, const void *key,
+	rbtree_iterate_func_t iteration, void *state)
+{
+	rbnode_t *n, *next;
+	int r;
+
+	for (n = rbtree_lookup(tree, key);
+		!rbnode_is_nil(n) && tree->keycmp(n->key, key) == 0;
+		n = next) {
+		next = rbtree_next(tree, n);
+		if ((r = (*iteration)(tree, n, state)) != 0)
+			return r;
+	}
+
+	return 0;
+}
+
 static void rbtree_remove_fixup(rbtree_t *tree, rbnode_t *x, rbnode_t *p)
 {
 	rbnode_t *b;
 
 	while (!rbnode_is_nil(p) && rbnode_is_black(x)) {
-		if (rbnode_is_nil(x) || rbnode_is_left(x)) {
+		if (x == p->left) {
 			b = p->right;
 			if (rbnode_is_red(b)) {
 				rbnode_set_black(b);
@@ -232,8 +592,7 @@ static void rbtree_remove_fixup(rbtree_t *tree, rbnode_t *x, rbnode_t *p)
 					rbtree_right_rotate(tree, b);
 					b = p->right;
 				}
-				else
-					rbnode_set_black(b->right);
+				rbnode_set_black(b->right);
 				b->color = p->color;
 				rbnode_set_black(p);
 				rbtree_left_rotate(tree, p);
@@ -262,8 +621,7 @@ static void rbtree_remove_fixup(rbtree_t *tree, rbnode_t *x, rbnode_t *p)
 					rbtree_left_rotate(tree, b);
 					b = p->left;
 				}
-				else
-					rbnode_set_black(b->left);
+				rbnode_set_black(b->left);
 				b->color = p->color;
 				rbnode_set_black(p);
 				rbtree_right_rotate(tree, p);
@@ -276,48 +634,305 @@ static void rbtree_remove_fixup(rbtree_t *tree, rbnode_t *x, rbnode_t *p)
         rbnode_set_black(x);
 }
 
-void rbtree_remove(rbtree_t *tree, rbnode_t *n)
+/* Unlink tree node 'n' and rebalance.
+The node spliced out is 'n' or its successor, which then takes the
+place of 'n' before the fixup, so the augmented data along the path
+is up to date when the fixup starts rotating. */
+static void rbtree_erase(rbtree_t *tree, rbnode_t *n)
 {
-	rbnode_t *x, *y;
+	rbnode_t *x, *y, *p;
+	int black;
+
+	if (tree->leftmost == n)
+		tree->leftmost = rbtree_successor(tree, n);
 
 	y = rbnode_is_leaf(n) ? n : rbtree_successor(tree, n);
 	x = rbnode_is_nil(y->left) ? y->right : y->left;
+	p = y->parent;
+	black = rbnode_is_black(y);
 
 	if (!rbnode_is_nil(x))
-		x->parent = y->parent;
+		x->parent = p;
 
 	if (rbnode_is_root(y))
 		tree->root = x;
 	else if (rbnode_is_left(y))
-		y->parent->left = x;
+		p->left = x;
 	else
-		y->parent->right = x;
+		p->right = x;
 
 	if (y != n) {
+		if (p == n)
+			p = y;
+		rbtree_replace(tree, n, y);
+	}
 
-        if (rbnode_is_black(y))
-            rbtree_remove_fixup(tree, x, y->parent);
+	augment_path(tree, p);
 
-		y->left = n->left;
-		y->right = n->right;
-		y->parent = n->parent;
-		y->color = n->color;
+	if (black)
+		rbtree_remove_fixup(tree, x, p);
+}
 
-		if (!rbnode_is_nil(n->left))
-			n->left->parent = y;
+/* Unlink 'n', a tree node or a queued one, even in RBTREE_LAZY_DELETE mode. */
+static void remove_node(rbtree_t *tree, rbnode_t *n)
+{
+	tree->count--;
 
-		if (!rbnode_is_nil(n->right))
-			n->right->parent = y;
+	if (n->flags & RBNODE_DUP) {
+		chain_remove(n);
+		return;
+	}
 
-		if (rbnode_is_root(n))
-			tree->root = y;
-		else if (rbnode_is_left(n))
-			n->parent->left = y;
-		else
-			n->parent->right = y;
+	if (!rbnode_is_nil(n->dup)) {
+		chain_promote(tree, n);
+		return;
+	}
+
+	rbtree_erase(tree, n);
+}
+
+void rbtree_remove(rbtree_t *tree, rbnode_t *n)
+{
+	if (tree->flags & RBTREE_LAZY_DELETE) {
+		if (!rbnode_is_tombstone(n)) {
+			n->flags |= RBNODE_TOMBSTONE;
+			tree->tombstones++;
+			augment_path(tree, n);
+		}
+		return;
+	}
+
+	remove_node(tree, n);
+}
+
+/* Top-down rotation of 'root' toward 'dir' (0: left, 1: right),
+recolors as both passes need: the old root becomes red, the new one black.
+The caller links the returned new root into the parent. */
+static rbnode_t *topdown_single(rbtree_t *tree, rbnode_t *root, int dir)
+{
+	rbnode_t *save = rbnode_child(root, !dir);
+	rbnode_t *inner = rbnode_child(save, dir);
+
+	rbnode_child(root, !dir) = inner;
+	if (!rbnode_is_nil(inner))
+		inner->parent = root;
+
+	rbnode_child(save, dir) = root;
+	save->parent = root->parent;
+	root->parent = save;
+
+	rbnode_set_red(root);
+	rbnode_set_black(save);
+
+	augment_node(tree, root);
+	augment_node(tree, save);
+	return save;
+}
+
+static rbnode_t *topdown_double(rbtree_t *tree, rbnode_t *root, int dir)
+{
+	rbnode_child(root, !dir) = topdown_single(tree, rbnode_child(root, !dir), !dir);
+	return topdown_single(tree, root, dir);
+}
+
+static void topdown_link(rbnode_t *parent, int dir, rbnode_t *n)
+{
+	rbnode_child(parent, dir) = n;
+	if (!rbnode_is_nil(n))
+		n->parent = parent;
+}
+
+/* Both passes hang the root under a stack 'head' while running,
+so rotations at the root need no special case. */
+static void topdown_finish(rbtree_t *tree, rbnode_t *head)
+{
+	tree->root = head->right;
+	if (!rbnode_is_nil(tree->root)) {
+		tree->root->parent = rbnode_nil;
+		rbnode_set_black(tree->root);
 	}
-    else if (rbnode_is_black(y))
-        rbtree_remove_fixup(tree, x, y->parent);
+}
+
+int rbtree_insert_topdown(rbtree_t *tree, rbnode_t *n)
+{
+	rbnode_t head = { 0 }, *t, *g, *p, *q;
+	int dir = 0, last = 0, cmp, r = 0, linked = 0;
+
+	if (rbnode_is_nil(tree->root)) {
+		n->left = n->right = n->parent = rbnode_nil;
+		n->flags = 0;
+		n->dup = rbnode_nil;
+		rbnode_set_black(n);
+		tree->root = tree->leftmost = n;
+		tree->count++;
+		augment_node(tree, n);
+		return 0;
+	}
+
+	t = &head;
+	g = p = rbnode_nil;
+	q = head.right = tree->root;
+	q->parent = &head;
+
+	for (;;) {
+		if (rbnode_is_nil(q)) {
+			q = n;
+			n->left = n->right = rbnode_nil;
+			n->flags = 0;
+			n->dup = rbnode_nil;
+			rbnode_set_red(n);
+
+			topdown_link(p, dir, n);
+			augment_node(tree, n);
+			if (p == tree->leftmost && dir == 0)
+				tree->leftmost = n;
+			tree->count++;
+			linked = 1;
+		}
+		else if (rbnode_is_red(q->left) && rbnode_is_red(q->right)) {
+			/* color flip, a 4-node is split on the way down */
+			rbnode_set_red(q);
+			rbnode_set_black(q->left);
+			rbnode_set_black(q->right);
+		}
+
+		if (rbnode_is_red(q) && rbnode_is_red(p)) {
+			int dir2 = t->right == g;
+			if (q == rbnode_child(p, last))
+				topdown_link(t, dir2, topdown_single(tree, g, !last));
+			else
+				topdown_link(t, dir2, topdown_double(tree, g, !last));
+		}
+
+		if (linked)
+			break;
+
+		cmp = tree->keycmp(n->key, q->key);
+		if (cmp == 0) {
+			errno = EEXIST;
+			r = -1;
+			break;
+		}
+
+		last = dir;
+		dir = cmp > 0;
+
+		if (!rbnode_is_nil(g))
+			t = g;
+		g = p;
+		p = q;
+		q = rbnode_child(q, dir);
+	}
+
+	topdown_finish(tree, &head);
+
+	/* rotations below the new node may have used stale data */
+	if (linked)
+		augment_path(tree, n);
+	return r;
+}
+
+rbnode_t *rbtree_remove_topdown(rbtree_t *tree, const void *key)
+{
+	rbnode_t head = { 0 }, *q, *p, *g, *s, *f = rbnode_nil;
+	int dir = 1, last, cmp;
+
+	if (rbnode_is_nil(tree->root))
+		return rbnode_nil;
+
+	q = &head;
+	g = p = rbnode_nil;
+	head.right = tree->root;
+	tree->root->parent = &head;
+
+	/* Find the in-order predecessor of the match (or the match itself),
+	making sure the current node is red before stepping below it. */
+	while (!rbnode_is_nil(rbnode_child(q, dir))) {
+		last = dir;
+		g = p;
+		p = q;
+		q = rbnode_child(q, dir);
+		cmp = tree->keycmp(q->key, key);
+		dir = cmp < 0;
+
+		if (cmp == 0)
+			f = q;
+
+		if (rbnode_is_red(q) || rbnode_is_red(rbnode_child(q, dir)))
+			continue;
+
+		if (rbnode_is_red(rbnode_child(q, !dir))) {
+			s = topdown_single(tree, q, dir);
+			topdown_link(p, last, s);
+			p = s;
+			continue;
+		}
+
+		s = rbnode_child(p, !last);
+		if (rbnode_is_nil(s))
+			continue;
+
+		if (rbnode_is_black(s->left) && rbnode_is_black(s->right)) {
+			rbnode_set_black(p);
+			rbnode_set_red(s);
+			rbnode_set_red(q);
+		}
+		else {
+			int dir2 = g->right == p;
+			if (rbnode_is_red(rbnode_child(s, last)))
+				topdown_link(g, dir2, topdown_double(tree, p, last));
+			else
+				topdown_link(g, dir2, topdown_single(tree, p, last));
+
+			s = rbnode_child(g, dir2);
+			rbnode_set_red(q);
+			rbnode_set_red(s);
+			rbnode_set_black(s->left);
+			rbnode_set_black(s->right);
+		}
+	}
+
+	if (!rbnode_is_nil(f)) {
+		/* 'q' is red (or the root) with at most one child */
+		topdown_link(p, p->right == q, rbnode_is_nil(q->left) ? q->right : q->left);
+		if (q != f)
+			rbtree_replace(tree, f, q);
+		if (p == f)
+			p = q;
+		f->left = f->right = f->parent = rbnode_nil;
+		tree->count--;
+	}
+
+	topdown_finish(tree, &head);
+
+	if (!rbnode_is_nil(f) && p != &head)
+		augment_path(tree, p);
+	if (!rbnode_is_nil(f) && tree->leftmost == f)
+		tree->leftmost = leftmost_of(tree->root);
+	return f;
+}
+
+/* Iterate nodes which queued on 'n'. */
+static int foreach_dup(rbtree_t *tree, rbnode_t *n,
+	rbtree_iterate_func_t iteration, void *state)
+{
+	rbnode_t *last = n->dup, *m, *next;
+	int r;
+
+	if (rbnode_is_nil(last))
+		return 0;
+
+	m = last->dup;
+	for (;;) {
+		next = m->dup;
+		if ((r = (*iteration)(tree, m, state)) != 0)
+			return r;
+		if (m == last)
+			break;
+		m = next;
+	}
+
+	return 0;
 }
 
 static int preorder(rbtree_t *tree, rbnode_t *n,
@@ -325,7 +940,10 @@ static int preorder(rbtree_t *tree, rbnode_t *n,
 {
 	if (!rbnode_is_nil(n)) {
 		int r;
-		if ((r = (*iteration)(tree, n, state)) != 0)
+		rbnode_t *last = n->dup;
+		if (!rbnode_is_tombstone(n) && (r = (*iteration)(tree, n, state)) != 0)
+			return r;
+		if (!rbnode_is_nil(last) && (r = foreach_dup(tree, n, iteration, state)) != 0)
 			return r;
 		if ((r = preorder(tree, n->left, iteration, state)) != 0)
 			return r;
@@ -346,9 +964,12 @@ static int inorder(rbtree_t *tree, rbnode_t *n,
 {
 	if (!rbnode_is_nil(n)) {
 		int r;
+		rbnode_t *last = n->dup;
 		if ((r = inorder(tree, n->left, iteration, state)) != 0)
 			return r;
-		if ((r = (*iteration)(tree, n, state)) != 0)
+		if (!rbnode_is_tombstone(n) && (r = (*iteration)(tree, n, state)) != 0)
+			return r;
+		if (!rbnode_is_nil(last) && (r = foreach_dup(tree, n, iteration, state)) != 0)
 			return r;
 		if ((r = inorder(tree, n->right, iteration, state)) != 0)
 			return r;
@@ -371,7 +992,9 @@ static int postorder(rbtree_t *tree, rbnode_t *n,
 			return r;
 		if ((r = postorder(tree, n->right, iteration, state)) != 0)
 			return r;
-		if ((r = (*iteration)(tree, n, state)) != 0)
+		if ((r = foreach_dup(tree, n, iteration, state)) != 0)
+			return r;
+		if (!rbnode_is_tombstone(n) && (r = (*iteration)(tree, n, state)) != 0)
 			return r;
 	}
 	return 0;
@@ -431,15 +1054,721 @@ static int inner_clear(rbnode_t *root, rbnode_free_func_t free_func, void *state
             return r;
         root->right = rbnode_nil;
     }
+    if (!rbnode_is_nil(root->dup)) {
+        rbnode_t *last = root->dup, *m = last->dup, *next;
+        for (;;) {
+            next = m->dup;
+            free_func(m, state);
+            if (m == last)
+                break;
+            m = next;
+        }
+        root->dup = rbnode_nil;
+    }
     free_func(root, state);
     return 0;
 }
 
 int rbtree_clear(rbtree_t *tree, rbnode_free_func_t free_func, void *state)
 {
+    int r = 0;
+    rbnode_t *n, *next;
+
+    for (n = tree->graveyard; !rbnode_is_nil(n); n = next) {
+        next = n->right;
+        free_func(n, state);
+    }
+    tree->graveyard = rbnode_nil;
+
    	if (!rbnode_is_nil(tree->root)) {
-        return inner_clear(tree->root, free_func, state);
+        r = inner_clear(tree->root, free_func, state);
     }
-    return 0;
+
+    tree->root = rbnode_nil;
+    tree->leftmost = rbnode_nil;
+    tree->count = 0;
+    tree->tombstones = 0;
+
+    return r;
+}
+
+/* Flatten the tree into a list linked by 'right', in order,
+by right rotations (the 'tree to vine' step of Day-Stout-Warren). */
+static rbnode_t *tree_to_vine(rbnode_t *root)
+{
+	rbnode_t head, *tail = &head, *rest = root, *tmp;
+
+	head.right = root;
+	while (!rbnode_is_nil(rest)) {
+		if (rbnode_is_nil(rest->left)) {
+			tail = rest;
+			rest = rest->right;
+		}
+		else {
+			tmp = rest->left;
+			rest->left = tmp->right;
+			tmp->right = rest;
+			rest = tmp;
+			tail->right = tmp;
+		}
+	}
+
+	return head.right;
+}
+
+/* Build a balanced tree from the first 'n' nodes of a sorted list
+linked by 'right'. Levels above 'red_depth' are full and black,
+nodes at 'red_depth' (the partial bottom level) are red. */
+static rbnode_t *build_sorted(rbtree_t *tree, rbnode_t **list, size_t n,
+	int depth, int red_depth)
+{
+	rbnode_t *left, *root;
+
+	if (n == 0)
+		return rbnode_nil;
+
+	left = build_sorted(tree, list, (n - 1) / 2, depth + 1, red_depth);
+
+	root = *list;
+	*list = root->right;
+
+	root->left = left;
+	if (!rbnode_is_nil(left))
+		left->parent = root;
+
+	root->right = build_sorted(tree, list, n - 1 - (n - 1) / 2, depth + 1, red_depth);
+	if (!rbnode_is_nil(root->right))
+		root->right->parent = root;
+
+	root->color = depth == red_depth ? rbnode_red : rbnode_black;
+	augment_node(tree, root);
+
+	return root;
+}
+
+static int floor_log2(size_t n)
+{
+	int r = 0;
+	while (n > 1) {
+		n >>= 1;
+		r++;
+	}
+	return r;
+}
+
+size_t rbtree_purge(rbtree_t *tree, double ratio,
+	rbnode_free_func_t free_func, void *state)
+{
+	rbnode_t *n, *next, *list, **tail;
+	size_t purged = 0, live;
+
+	for (n = tree->graveyard; !rbnode_is_nil(n); n = next) {
+		next = n->right;
+		free_func(n, state);
+		purged++;
+	}
+	tree->graveyard = rbnode_nil;
+
+	if (tree->tombstones == 0 || (double)tree->tombstones <= ratio * tree->count)
+		return purged;
+
+	live = tree->count - tree->tombstones;
+
+	if (tree->tombstones * floor_log2(tree->count) <= live) {
+		/* a few, remove them one by one */
+		for (n = first_node(tree); !rbnode_is_nil(n); n = next) {
+			next = rbtree_successor(tree, n);
+			if (rbnode_is_tombstone(n)) {
+				rbtree_erase(tree, n);
+				free_func(n, state);
+				purged++;
+			}
+		}
+	}
+	else {
+		/* rebuild from the live nodes */
+		tail = &list;
+		for (n = tree_to_vine(tree->root); !rbnode_is_nil(n); n = next) {
+			next = n->right;
+			if (rbnode_is_tombstone(n)) {
+				free_func(n, state);
+				purged++;
+			}
+			else {
+				*tail = n;
+				tail = &n->right;
+			}
+		}
+		*tail = rbnode_nil;
+
+		tree->root = build_sorted(tree, &list, live, 0, floor_log2(live + 1));
+		if (!rbnode_is_nil(tree->root))
+			tree->root->parent = rbnode_nil;
+		tree->leftmost = leftmost_of(tree->root);
+	}
+
+	tree->count = live;
+	tree->tombstones = 0;
+
+	return purged;
+}
+
+size_t rbtree_build(rbtree_t *tree, rbnode_t **nodes, size_t n,
+	rbnode_free_func_t dup_func, void *state)
+{
+	rbnode_t *old, *list, **end = &list, **last = NULL, *x, *t;
+	size_t i = 0, total = 0, added = 0;
+	int cmp;
+
+	old = tree_to_vine(tree->root);
+
+	while (!rbnode_is_nil(old) || i < n) {
+		if (rbnode_is_nil(old))
+			cmp = 1;
+		else if (i == n)
+			cmp = -1;
+		else
+			cmp = tree->keycmp(old->key, nodes[i]->key);
+
+		if (cmp <= 0) {
+			/* existing nodes go first among equal keys */
+			x = old;
+			old = old->right;
+		}
+		else {
+			x = nodes[i++];
+			if (last != NULL && !(tree->flags & RBTREE_MULTI_NODES)
+				&& tree->keycmp((*last)->key, x->key) == 0) {
+				t = *last;
+				if (tree->flags & RBTREE_MULTI_CHAIN) {
+					chain_append(t, x);
+					tree->count++;
+					added++;
+				}
+				else if (rbnode_is_tombstone(t)) {
+					/* revive, the tombstone goes to the graveyard */
+					x->flags = 0;
+					x->dup = rbnode_nil;
+					*last = x;
+					end = &x->right;
+					t->left = t->parent = rbnode_nil;
+					t->right = tree->graveyard;
+					tree->graveyard = t;
+					tree->tombstones--;
+					added++;
+				}
+				else if (dup_func != NULL) {
+					dup_func(x, state);
+				}
+				continue;
+			}
+			x->flags = 0;
+			x->dup = rbnode_nil;
+			tree->count++;
+			added++;
+		}
+
+		*end = x;
+		last = end;
+		end = &x->right;
+		total++;
+	}
+	*end = rbnode_nil;
+
+	tree->root = build_sorted(tree, &list, total, 0, floor_log2(total + 1));
+	if (!rbnode_is_nil(tree->root))
+		tree->root->parent = rbnode_nil;
+	tree->leftmost = leftmost_of(tree->root);
+
+	return added;
+}
+
+/* Black nodes on a path from 'n' down to nil, 'n' included. */
+static int black_height(rbnode_t *n)
+{
+	int h = 0;
+	for (; !rbnode_is_nil(n); n = n->left)
+		h += rbnode_is_black(n);
+	return h;
+}
+
+/* Join the detached subtrees 'l' and 'r' with 'k' in between
+(keys of 'l' < 'k' < keys of 'r'), returns the new root and its black
+height in '*h'. 'hl' and 'hr' are the black heights of 'l' and 'r'.
+'k' goes down the spine of the higher one to the level of the lower one
+and is fixed up as a new red node, so it costs the difference of the
+black heights. 'tree->root' is the working root meanwhile. */
+static rbnode_t *join(rbtree_t *tree, rbnode_t *l, int hl, rbnode_t *k,
+	rbnode_t *r, int hr, int *h)
+{
+	rbnode_t *c, *p = rbnode_nil;
+	int target, dir;
+
+	if (!rbnode_is_nil(l)) {
+		l->parent = rbnode_nil;
+		if (rbnode_is_red(l)) {
+			rbnode_set_black(l);
+			hl++;
+		}
+	}
+	if (!rbnode_is_nil(r)) {
+		r->parent = rbnode_nil;
+		if (rbnode_is_red(r)) {
+			rbnode_set_black(r);
+			hr++;
+		}
+	}
+
+	if (hl == hr) {
+		k->left = l;
+		k->right = r;
+		k->parent = rbnode_nil;
+		if (!rbnode_is_nil(l))
+			l->parent = k;
+		if (!rbnode_is_nil(r))
+			r->parent = k;
+		rbnode_set_black(k);
+		augment_node(tree, k);
+		*h = hl + 1;
+		return k;
+	}
+
+	/* down the right spine of 'l' (dir 1), or the left spine of 'r' */
+	dir = hl > hr;
+	c = tree->root = dir ? l : r;
+	*h = dir ? hl : hr;
+	target = dir ? hr : hl;
+	hl = *h;
+	while (!rbnode_is_black(c) || hl != target) {
+		hl -= rbnode_is_black(c);
+		p = c;
+		c = rbnode_child(c, dir);
+	}
+
+	rbnode_child(k, !dir) = c;
+	rbnode_child(k, dir) = dir ? r : l;
+	if (!rbnode_is_nil(c))
+		c->parent = k;
+	if (!rbnode_is_nil(rbnode_child(k, dir)))
+		rbnode_child(k, dir)->parent = k;
+	rbnode_child(p, dir) = k;
+	k->parent = p;
+	rbnode_set_red(k);
+
+	augment_path(tree, k);
+	*h += rbtree_insert_fixup(tree, k);
+	return tree->root;
+}
+
+/* Split subtree 'n' of black height 'h' into the nodes with keys less
+than 'key' (or not greater, when 'le') and the rest, by joining the
+pieces left and right of the search path bottom-up.
+The black heights are passed along, so it costs O(log n) in total. */
+static void split(rbtree_t *tree, rbnode_t *n, int h, const void *key, int le,
+	rbnode_t **lower, int *hl, rbnode_t **upper, int *hu)
+{
+	rbnode_t *l, *r, *m;
+	int cmp, hm;
+
+	if (rbnode_is_nil(n)) {
+		*lower = *upper = rbnode_nil;
+		*hl = *hu = 0;
+		return;
+	}
+
+	l = n->left;
+	r = n->right;
+	h -= rbnode_is_black(n);
+	cmp = tree->keycmp(n->key, key);
+	if (cmp < 0 || (le && cmp == 0)) {
+		split(tree, r, h, key, le, &m, &hm, upper, hu);
+		*lower = join(tree, l, h, n, m, hm, hl);
+	}
+	else {
+		split(tree, l, h, key, le, lower, hl, &m, &hm);
+		*upper = join(tree, m, hm, n, r, h, hu);
+	}
+}
+
+/* Make 'root' the root of the whole tree. */
+static void set_root(rbtree_t *tree, rbnode_t *root)
+{
+	tree->root = root;
+	if (!rbnode_is_nil(root)) {
+		root->parent = rbnode_nil;
+		rbnode_set_black(root);
+	}
+	tree->leftmost = leftmost_of(root);
+}
+
+/* Hand the nodes of the detached subtree 'n' to 'fn' in order,
+queued nodes included, tombstones go to the graveyard.
+Returns the number of nodes handed to 'fn'. */
+static size_t release_subtree(rbtree_t *tree, rbnode_t *n,
+	rbnode_free_func_t fn, void *state)
+{
+	rbnode_t *next, *last, *m, *mnext;
+	size_t released = 0;
+
+	for (n = tree_to_vine(n); !rbnode_is_nil(n); n = next) {
+		next = n->right;
+		last = n->dup;
+		n->left = n->right = n->parent = n->dup = rbnode_nil;
+		tree->count--;
+
+		if (rbnode_is_tombstone(n)) {
+			tree->tombstones--;
+			n->right = tree->graveyard;
+			tree->graveyard = n;
+		}
+		else {
+			if (fn != NULL)
+				fn(n, state);
+			released++;
+		}
+
+		if (rbnode_is_nil(last))
+			continue;
+		for (m = last->dup;; m = mnext) {
+			mnext = m->dup;
+			m->flags = 0;
+			m->parent = m->dup = rbnode_nil;
+			tree->count--;
+			if (fn != NULL)
+				fn(m, state);
+			released++;
+			if (m == last)
+				break;
+		}
+	}
+
+	return released;
+}
+
+size_t rbtree_pop_until(rbtree_t *tree, const void *key,
+	rbnode_free_func_t fn, void *state)
+{
+	rbnode_t *expired, *rest;
+	int he, hr;
+
+	if (rbnode_is_nil(tree->leftmost) || tree->keycmp(tree->leftmost->key, key) > 0)
+		return 0;
+
+	split(tree, tree->root, black_height(tree->root), key, 1,
+		&expired, &he, &rest, &hr);
+	set_root(tree, rest);
+
+	return release_subtree(tree, expired, fn, state);
+}
+
+size_t rbtree_remove_range(rbtree_t *tree, const void *lo, const void *hi,
+	rbnode_free_func_t fn, void *state)
+{
+	rbnode_t *l, *mid, *r, *k;
+	int hl, hm, hr;
+
+	if (rbnode_is_nil(tree->root) || tree->keycmp(lo, hi) > 0)
+		return 0;
+
+	split(tree, tree->root, black_height(tree->root), lo, 0, &l, &hl, &r, &hr);
+	split(tree, r, hr, hi, 1, &mid, &hm, &r, &hr);
+
+	if (rbnode_is_nil(l) || rbnode_is_nil(r))
+		set_root(tree, rbnode_is_nil(l) ? r : l);
+	else {
+		/* borrow the first node of 'r' to join the outer pieces */
+		set_root(tree, r);
+		k = tree->leftmost;
+		rbtree_erase(tree, k);
+		r = tree->root;
+		set_root(tree, join(tree, l, hl, k, r, black_height(r), &hm));
+	}
+
+	return release_subtree(tree, mid, fn, state);
+}
+
+int rbtree_update_key(rbtree_t *tree, rbnode_t *n, void *key)
+{
+	rbnode_t *prev, *next, *m;
+
+	if (!(n->flags & RBNODE_DUP) && rbnode_is_nil(n->dup)) {
+		prev = rbtree_predecessor(tree, n);
+		next = rbtree_successor(tree, n);
+		if ((rbnode_is_nil(prev) || tree->keycmp(prev->key, key) < 0) &&
+			(rbnode_is_nil(next) || tree->keycmp(key, next->key) < 0)) {
+			/* still in order, no need to move */
+			n->key = key;
+			augment_path(tree, n);
+			return 0;
+		}
+	}
+
+	if (!(tree->flags & (RBTREE_MULTI_CHAIN | RBTREE_MULTI_NODES))) {
+		m = rbtree_lookup(tree, key);
+		if (!rbnode_is_nil(m) && m != n) {
+			errno = EEXIST;
+			return -1;
+		}
+	}
+
+	remove_node(tree, n);
+	n->key = key;
+	return rbtree_insert(tree, n);
+}
+
+/* Move node 'n' to the place 'alloc_fn' gives, if any, and point its
+neighbors at the new place. Returns the node, moved or not. */
+static rbnode_t *relocate(rbtree_t *tree, rbnode_t *n,
+	rbnode_alloc_func_t alloc_fn, rbnode_move_func_t move_fn, void *state)
+{
+	rbnode_t *m = alloc_fn(n, state);
+
+	if (m == NULL || m == n)
+		return n;
+
+	*m = *n;
+	if (rbnode_is_nil(n->parent))
+		tree->root = m;
+	else if (n->parent->left == n)
+		n->parent->left = m;
+	else
+		n->parent->right = m;
+	if (!rbnode_is_nil(n->left))
+		n->left->parent = m;
+	if (!rbnode_is_nil(n->right))
+		n->right->parent = m;
+	if (tree->leftmost == n)
+		tree->leftmost = m;
+
+	move_fn(m, n, state);
+	return m;
+}
+
+/* Relocate tree node 'h' and then the nodes queued on it.
+Adds the number of nodes visited to '*visited', returns the tree node. */
+static rbnode_t *relocate_chain(rbtree_t *tree, rbnode_t *h,
+	rbnode_alloc_func_t alloc_fn, rbnode_move_func_t move_fn, void *state,
+	size_t *visited)
+{
+	rbnode_t *n, *m, *last, *next, *first = rbnode_nil, *prev = rbnode_nil;
+
+	h = relocate(tree, h, alloc_fn, move_fn, state);
+	(*visited)++;
+	if (rbnode_is_nil(h->dup))
+		return h;
+
+	last = h->dup;
+	for (n = last->dup;; n = next) {
+		next = n->dup;
+		m = alloc_fn(n, state);
+		if (m == NULL || m == n)
+			m = n;
+		else {
+			*m = *n;
+			move_fn(m, n, state);
+		}
+		if (rbnode_is_nil(prev))
+			first = m;
+		else
+			prev->dup = m;
+		prev = m;
+		(*visited)++;
+		if (n == last)
+			break;
+	}
+	prev->dup = first;
+	prev->parent = h;
+	h->dup = prev;
+
+	return h;
+}
+
+int rbtree_compact(rbtree_t *tree, rbnode_alloc_func_t alloc_fn,
+	rbnode_move_func_t move_fn, void *state)
+{
+	rbnode_t **queue, *n;
+	size_t head = 0, tail = 0, visited = 0;
+
+	if (rbnode_is_nil(tree->root))
+		return 0;
+
+	queue = malloc(sizeof(rbnode_t *) * tree->count);
+	if (queue == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	queue[tail++] = tree->root;
+	while (head < tail) {
+		n = relocate_chain(tree, queue[head++], alloc_fn, move_fn, state, &visited);
+		if (!rbnode_is_nil(n->left))
+			queue[tail++] = n->left;
+		if (!rbnode_is_nil(n->right))
+			queue[tail++] = n->right;
+	}
+
+	free(queue);
+	return 0;
+}
+
+/* Find the node at depth 'd' below 'n' with the smallest path not less
+than the low 'd' bits of '*path' (from the top, 1 goes right),
+and set them to the path of the node found. */
+static rbnode_t *level_seek(rbnode_t *n, int d, uint64_t *path)
+{
+	uint64_t bit;
+	rbnode_t *m;
+
+	if (rbnode_is_nil(n) || d == 0)
+		return n;
+
+	bit = (uint64_t)1 << (d - 1);
+	if (!(*path & bit)) {
+		m = level_seek(n->left, d - 1, path);
+		if (!rbnode_is_nil(m))
+			return m;
+		*path = (*path & ~(bit - 1)) | bit;
+	}
+	return level_seek(n->right, d - 1, path);
+}
+
+size_t rbtree_compact_step(rbtree_t *tree, rbcompact_t *cursor, size_t max,
+	rbnode_alloc_func_t alloc_fn, rbnode_move_func_t move_fn, void *state)
+{
+	rbnode_t *n;
+	uint64_t path;
+	size_t visited = 0;
+
+	while (visited < max) {
+		path = cursor->path;
+		n = cursor->depth < RBCOMPACT_DEPTH_MAX ?
+			level_seek(tree->root, cursor->depth, &path) : rbnode_nil;
+
+		if (rbnode_is_nil(n)) {
+			if (cursor->path != 0) {
+				/* rest of this level is empty */
+				cursor->depth++;
+				cursor->path = 0;
+				continue;
+			}
+			/* below the deepest leaf, the pass is over */
+			if (visited == 0)
+				cursor->depth = 0;
+			break;
+		}
+
+		relocate_chain(tree, n, alloc_fn, move_fn, state, &visited);
+
+		if (++path >> cursor->depth) {
+			cursor->depth++;
+			path = 0;
+		}
+		cursor->path = path;
+	}
+
+	return visited;
 }
 
+#define same_block(a, b, size) \
+	(((size_t)(a) / (size)) == ((size_t)(b) / (size)))
+
+int rbtree_profile(rbtree_t *tree, rbtree_profile_t *report)
+{
+	rbnode_t *n, *prev = rbnode_nil;
+	int depth = 0, blacks = 0;
+	size_t path_sum = 0;
+
+	memset(report, 0, sizeof(rbtree_profile_t));
+
+	if (rbnode_is_nil(tree->root))
+		return 0;
+
+	report->black_height = -2; /* not seen any nil yet */
+
+	n = tree->root;
+	blacks = rbnode_is_black(n) ? 1 : 0;
+
+	while (!rbnode_is_nil(n)) {
+
+		/* walk down to the leftmost node of the subtree */
+		while (!rbnode_is_nil(n->left)) {
+			n = n->left;
+			depth++;
+			if (rbnode_is_black(n))
+				blacks++;
+		}
+
+		for (;;) {
+			/* visit 'n' */
+			report->count++;
+			path_sum += depth + 1;
+			if (depth < RBTREE_PROFILE_DEPTH_MAX)
+				report->depth_histogram[depth]++;
+			if (report->height < depth + 1)
+				report->height = depth + 1;
+
+			if (rbnode_is_nil(n->left) || rbnode_is_nil(n->right)) {
+				if (report->black_height == -2)
+					report->black_height = blacks;
+				else if (report->black_height != blacks)
+					report->black_height = -1;
+			}
+
+			if (!rbnode_is_root(n)) {
+				report->links++;
+				if (same_block(n, n->parent, RBTREE_CACHE_LINE_SIZE))
+					report->links_same_line++;
+				if (same_block(n, n->parent, RBTREE_PAGE_SIZE))
+					report->links_same_page++;
+			}
+
+			if (!rbnode_is_nil(prev)) {
+				report->neighbors++;
+				if (same_block(n, prev, RBTREE_CACHE_LINE_SIZE))
+					report->neighbors_same_line++;
+				if (same_block(n, prev, RBTREE_PAGE_SIZE))
+					report->neighbors_same_page++;
+			}
+
+			prev = n;
+
+			if (!rbnode_is_nil(n->right)) {
+				n = n->right;
+				depth++;
+				if (rbnode_is_black(n))
+					blacks++;
+				break;
+			}
+
+			/* climb until coming up from a left child */
+			while (!rbnode_is_root(n) && rbnode_is_right(n)) {
+				if (rbnode_is_black(n))
+					blacks--;
+				n = n->parent;
+				depth--;
+			}
+			if (rbnode_is_black(n))
+				blacks--;
+			n = n->parent;
+			depth--;
+
+			if (rbnode_is_nil(n))
+				break;
+		}
+	}
+
+	report->avg_path_length = (double)path_sum / report->count;
+
+	if (report->links + report->neighbors > 0) {
+		report->line_locality = (double)(report->links_same_line + report->neighbors_same_line) /
+			(report->links + report->neighbors);
+		report->page_locality = (double)(report->links_same_page + report->neighbors_same_page) /
+			(report->links + report->neighbors);
+	}
+	else {
+		report->line_locality = 1.0;
+		report->page_locality = 1.0;
+	}
+
+	return 0;
+}
@@ -25,6 +25,9 @@
 #ifndef RBTREE_H_
 #define RBTREE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,31 +40,103 @@ typedef enum rbnode_color_t {
 	rbnode_red
 } rbnode_color_t;
 
+/* rbnode_t.flags */
+#define RBNODE_DUP			0x01	/* chained duplicate, not a tree node */
+#define RBNODE_TOMBSTONE	0x02	/* removed in RBTREE_LAZY_DELETE mode */
+
 struct rbnode_t {
 	void *key;
 	rbnode_color_t color;
+	unsigned int flags;
 	rbnode_t *left;
 	rbnode_t *right;
 	rbnode_t *parent;
+	rbnode_t *dup;	/* RBTREE_MULTI_CHAIN only, see below */
 };
 
 typedef int (*rbtree_keycmp_func_t)(const void *a, const void *b);
 typedef int (*rbtree_iterate_func_t)(rbtree_t *tree, rbnode_t *n, void *state);
 typedef void (*rbnode_free_func_t)(rbnode_t *node, void *state);
 
+/* Returns the new place of 'node' for rbtree_compact(), usually the
+'rbnode_t' inside a container taken from a fresh contiguous block.
+Returns NULL (or 'node') to leave it where it is. */
+typedef rbnode_t *(*rbnode_alloc_func_t)(rbnode_t *node, void *state);
+
+/* Called after the fields of 'from' are copied to 'to' and the links are
+fixed, to move the rest of the container (and 'key' if it points into
+it) and release the old one. 'to' and 'from' must not be used as tree
+nodes meanwhile. */
+typedef void (*rbnode_move_func_t)(rbnode_t *to, rbnode_t *from, void *state);
+
+/* Recompute the augmented data of 'n' (kept by the user in the struct
+embedding it) from 'n' itself and its children, which are up to date.
+Called bottom-up whenever a subtree changes: on insert and remove, on
+the two nodes of every rotation, and through the rebuilds of
+rbtree_purge() and rbtree_build(). Tombstones stay in the tree and are
+passed too. Chained duplicates (RBTREE_MULTI_CHAIN) are not tree nodes
+and never passed. Not maintained by rbtree_mt. */
+typedef void (*rbtree_augment_func_t)(rbtree_t *tree, rbnode_t *n);
+
+/* rbtree_t.flags, selects how equal keys are handled.
+Without any of them, inserting an existing key fails with EEXIST.
+
+RBTREE_MULTI_CHAIN: the first node of a key is in the tree, the later
+ones are queued in FIFO order on a circular list hanging off it, so the
+depth of the tree only depends on the number of distinct keys.
+The tree node's 'dup' points to the last queued node, the last one's
+'dup' points to the first one. Queued nodes have RBNODE_DUP set, only
+the last one has 'parent' (to the tree node), 'left' and 'right' are nil.
+Removing the tree node promotes the first queued node in O(1),
+removing a queued node walks its list.
+
+RBTREE_MULTI_NODES: equal keys are ordinary tree nodes, a new node goes
+after all the existing equal ones, so in-order is insertion order. */
+#define RBTREE_MULTI_CHAIN	0x01
+#define RBTREE_MULTI_NODES	0x02
+
+/* RBTREE_LAZY_DELETE: rbtree_remove() only marks the node as a tombstone,
+without rebalancing. Lookups and iterations skip tombstones, inserting
+the key again revives it. The node still belongs to the tree until
+rbtree_purge() or rbtree_clear() hands it to the free function.
+Can't be combined with RBTREE_MULTI_*. */
+#define RBTREE_LAZY_DELETE	0x04
+
 struct rbtree_t {
 	rbnode_t *root;
 	rbtree_keycmp_func_t keycmp;
+	unsigned int flags;
+	size_t count;			/* nodes in the tree, tombstones included */
+	size_t tombstones;		/* tombstones in the tree */
+	rbnode_t *graveyard;	/* tombstones replaced by reinserted nodes, linked by 'right' */
+	rbtree_augment_func_t augment;	/* NULL if not augmented */
+	rbnode_t *leftmost;		/* first tree node, tombstones included */
 };
 
-#define RBTREE_INIT(_keycmp) { .root = NULL, .keycmp = (_keycmp) }
+#define RBTREE_INIT(_keycmp) RBTREE_INIT_EX((_keycmp), 0)
 
-#define rbtree_init(tree, _keycmp) \
+#define RBTREE_INIT_EX(_keycmp, _flags) { \
+	.root = NULL, .keycmp = (_keycmp), .flags = (_flags), \
+	.count = 0, .tombstones = 0, .graveyard = NULL, .augment = NULL, \
+	.leftmost = NULL }
+
+#define rbtree_init(tree, _keycmp) rbtree_init_ex((tree), (_keycmp), 0)
+
+#define rbtree_init_ex(tree, _keycmp, _flags) \
 	do { \
 		(tree)->root = NULL; \
 		(tree)->keycmp = (_keycmp); \
+		(tree)->flags = (_flags); \
+		(tree)->count = 0; \
+		(tree)->tombstones = 0; \
+		(tree)->graveyard = NULL; \
+		(tree)->augment = NULL; \
+		(tree)->leftmost = NULL; \
 	} while (0)
 
+/* Number of live nodes. */
+#define rbtree_size(tree)	((tree)->count - (tree)->tombstones)
+
 #define rbnode_nil			(NULL)
 #define rbnode_is_nil(n)	((n) == rbnode_nil)
 #define rbnode_is_root(n)	(rbnode_is_nil((n)->parent))
@@ -72,23 +147,151 @@ struct rbtree_t {
 #define rbnode_is_leaf(n)	(rbnode_is_nil((n)->left) || rbnode_is_nil((n)->right))
 #define rbnode_set_black(n) ((n)->color = rbnode_black)
 #define rbnode_set_red(n)	((n)->color = rbnode_red)
+#define rbnode_is_tombstone(n) (((n)->flags & RBNODE_TOMBSTONE) != 0)
+#define rbnode_child(n, dir) (*((dir) ? &(n)->right : &(n)->left))
+
 
 /* Insert node.
 If successful, returns 0, otherwise returns -1,
 and errno set to EEXIST when failure.*/
 int rbtree_insert(rbtree_t *tree, rbnode_t *n);
 
+/* Link 'n' under 'parent' at 'link' and rebalance.
+'link' is &parent->left or &parent->right, or &tree->root when the tree is empty.
+For callers which find the insert position by their own descent. */
+void rbtree_link(rbtree_t *tree, rbnode_t *parent, rbnode_t **link, rbnode_t *n);
+
+
 /* Lookup node by key.
-If found, returns node that found, otherwise returns NULL. */
+If found, returns node that found, otherwise returns NULL.
+With duplicate keys, returns the first inserted one. */
 rbnode_t *rbtree_lookup(rbtree_t *tree, const void *key);
 
 /* Delete a node from the tree.
 Make sure that the 'n' is a element in the tree node link. */
 void rbtree_remove(rbtree_t *tree, rbnode_t *n);
 
-/* Clear all nodes.*/
+/* Same as rbtree_insert, but rebalances on the way down in one pass
+(Guibas-Sedgewick), never walks back up.
+For trees without RBTREE_MULTI_* and RBTREE_LAZY_DELETE. */
+int rbtree_insert_topdown(rbtree_t *tree, rbnode_t *n);
+
+/* Remove the node with 'key' in one top-down pass, pushing a red node
+down the search path so the removed node is never black.
+Returns the removed node, or NULL if not found.
+For trees without RBTREE_MULTI_* and RBTREE_LAZY_DELETE. */
+rbnode_t *rbtree_remove_topdown(rbtree_t *tree, const void *key);
+
+/* In-order navigation, duplicates included.
+Returns NULL when there is no such node.
+rbtree_first() is O(1) (the first tree node is cached) unless it has to
+skip tombstones. rbtree_prev() of a chained duplicate walks its chain. */
+rbnode_t *rbtree_first(rbtree_t *tree);
+rbnode_t *rbtree_last(rbtree_t *tree);
+rbnode_t *rbtree_next(rbtree_t *tree, rbnode_t *n);
+rbnode_t *rbtree_prev(rbtree_t *tree, rbnode_t *n);
+
+/* Returns the first node whose key is not less than 'key',
+or NULL if not exists. */
+rbnode_t *rbtree_lower_bound(rbtree_t *tree, const void *key);
+
+/* Returns the first node whose key is greater than 'key',
+or NULL if not exists. */
+rbnode_t *rbtree_upper_bound(rbtree_t *tree, const void *key);
+
+/* Returns number of nodes which key equal to 'key'. */
+size_t rbtree_count(rbtree_t *tree, const void *key);
+
+/* Iterate nodes which key equal to 'key', in insertion order.
+If successful, returns 0, otherwise returns error code,
+which is return by iteration function. */
+int rbtree_foreach_equal(rbtree_t *tree, const void *key,
+	rbtree_iterate_func_t iteration, void *state);
+
+
+/* Clear all nodes, tombstones included, and reset the tree to empty. */
 int rbtree_clear(rbtree_t *tree, rbnode_free_func_t free_func, void *state);
 
+/* Purge tombstones (RBTREE_LAZY_DELETE), when more than 'ratio'
+(0.0 ~ 1.0) of the nodes are tombstones. Use 0 to purge any.
+Rebuilds the whole tree in O(n) when there are too many tombstones
+to remove them one by one. Every purged node is handed to 'free_func',
+which must not be NULL (unlike 'dup_func' of rbtree_build()).
+Returns the number of purged nodes. */
+size_t rbtree_purge(rbtree_t *tree, double ratio,
+	rbnode_free_func_t free_func, void *state);
+
+/* Bulk insert 'n' nodes sorted by key, merging them with the nodes
+already in the tree and rebuilding it in O(count + n).
+Equal keys are handled as rbtree_insert() does, a node which would
+fail with EEXIST is handed to 'dup_func' (if not NULL) instead.
+Returns the number of nodes added. */
+size_t rbtree_build(rbtree_t *tree, rbnode_t **nodes, size_t n,
+	rbnode_free_func_t dup_func, void *state);
+
+/* Detach all nodes with keys not greater than 'key' (the expired timers
+when keys are deadlines) by splitting the tree once, no per-node
+rebalancing, then hand them to 'fn' in order. Expired tombstones go to
+the graveyard. Returns at once when the first node hasn't expired,
+otherwise costs O(log n) plus the expired nodes.
+Returns the number of nodes handed to 'fn'. */
+size_t rbtree_pop_until(rbtree_t *tree, const void *key,
+	rbnode_free_func_t fn, void *state);
+
+/* Remove all nodes with keys from 'lo' to 'hi' (both included).
+The range is cut out by splitting the tree twice and joining the outer
+parts, so rebalancing costs O(log n) in total instead of a fixup per
+node, then the removed nodes are handed to 'fn' (if not NULL) in order.
+Tombstones in the range go to the graveyard.
+Returns the number of nodes handed to 'fn'. */
+size_t rbtree_remove_range(rbtree_t *tree, const void *lo, const void *hi,
+	rbnode_free_func_t fn, void *state);
+
+/* Change the key of node 'n' (reschedule a timer).
+If it still sorts between its neighbors, only 'n->key' is set,
+otherwise 'n' is removed and inserted again.
+If successful, returns 0, otherwise returns -1 and errno set to EEXIST
+when another node has 'key' in a tree without duplicates ('n' is left
+unchanged). */
+int rbtree_update_key(rbtree_t *tree, rbnode_t *n, void *key);
+
+/* Relocate all nodes in breadth-first order, so the top levels which
+every lookup goes through get packed into a few pages when 'alloc_fn'
+hands out consecutive places. Queued duplicates follow their tree node,
+the graveyard is left alone.
+Returns 0, or -1 with errno set to ENOMEM (nothing moved). */
+int rbtree_compact(rbtree_t *tree, rbnode_alloc_func_t alloc_fn,
+	rbnode_move_func_t move_fn, void *state);
+
+/* Position of an incremental compaction, the next level and
+the path (bits from the top, 1 goes right) of the next node in it. */
+typedef struct rbcompact_t {
+	int depth;
+	uint64_t path;
+} rbcompact_t;
+
+/* rbtree_compact_step() stops at this depth,
+only reached by trees of billions of nodes. */
+#define RBCOMPACT_DEPTH_MAX	64
+
+#define RBCOMPACT_INIT() { .depth = 0, .path = 0 }
+
+#define rbcompact_init(cursor) \
+	do { \
+		(cursor)->depth = 0; \
+		(cursor)->path = 0; \
+	} while (0)
+
+/* Incremental rbtree_compact(), relocates about 'max' (> 0) nodes in
+breadth-first order from 'cursor' and returns the number of nodes
+visited, so it can run between other operations. Each node costs a
+walk from the root. Nodes moved up by later rebalancing may be missed
+in this pass. Returns 0 once the pass is over, and the next call starts
+a new pass from the root. */
+size_t rbtree_compact_step(rbtree_t *tree, rbcompact_t *cursor, size_t max,
+	rbnode_alloc_func_t alloc_fn, rbnode_move_func_t move_fn, void *state);
+
+
 /* Iterate nodes.
 If successful, returns 0, otherwise returns error code,
 which is return by iteration function. */
@@ -106,6 +309,38 @@ int rbtree_foreach_postorder(rbtree_t *tree,
 int rbtree_foreach_print(rbtree_t *tree,
 	rbtree_iterate_func_t iteration, void *state);
 
+#define RBTREE_PROFILE_DEPTH_MAX	128
+#define RBTREE_CACHE_LINE_SIZE		64
+#define RBTREE_PAGE_SIZE			4096
+
+typedef struct rbtree_profile_t {
+	size_t count;			/* number of tree nodes, chained duplicates excluded */
+
+	int height;				/* nodes on the longest path from root to leaf */
+	int black_height;		/* black nodes on any path from root to nil,
+							   -1 when the paths disagree (broken tree) */
+	size_t depth_histogram[RBTREE_PROFILE_DEPTH_MAX]; /* nodes per depth, root is 0 */
+	double avg_path_length;	/* average nodes visited by a successful lookup */
+
+	size_t links;			/* parent/child pairs, always count - 1 */
+	size_t links_same_line;	/* parent/child pairs within one cache line */
+	size_t links_same_page;	/* parent/child pairs within one page */
+
+	size_t neighbors;		/* in-order neighbor pairs, always count - 1 */
+	size_t neighbors_same_line;
+	size_t neighbors_same_page;
+
+	/* share of parent/child and in-order neighbor pairs which don't
+	cross a cache line (or page) boundary, 0.0 ~ 1.0 */
+	double line_locality;
+	double page_locality;
+} rbtree_profile_t;
+
+/* Measure shape and memory locality of the tree in one in-order pass.
+Always returns 0. */
+int rbtree_profile(rbtree_t *tree, rbtree_profile_t *report);
+
+
 #define rbtree_offsetof(s,m) ((size_t)&(((s*)0)->m))
 
 #define rbtree_container_of(field, struct_type, field_name) \
@@ -0,0 +1,805 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifndef RBTREE_HPP_
+#define RBTREE_HPP_
+
+/* Header-only C++ ordered containers over rbtree.h.
+
+The comparator is a template parameter and the descents (find, bounds,
+insert position) are done here, so it is inlined into them; rbtree.c
+only links and rebalances (rbtree_link(), rbtree_remove()).
+Each value lives in its node, which is never copied or reallocated
+while it is in a tree: emplace() constructs it in place, and extract()
+and insert(node_type &&) move whole nodes between trees.
+
+Nodes come from 'Allocator' (rebound to the node type), stateful and
+polymorphic allocators are supported, following the propagation traits
+of std::allocator_traits. With std::pmr (C++17), rb::pmr::map and
+rb::pmr::set take a std::pmr::memory_resource, and a tree of trivially
+destructible values on a std::pmr::monotonic_buffer_resource is
+destroyed without visiting its nodes, see bulk_release(). */
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define RBTREE_HPP_PMR 1
+#endif
+#endif
+
+#include "rbtree.h"
+
+namespace rb {
+
+/* Whether the memory of allocator 'a' is released as a whole, so
+deallocating nodes one by one is useless. Overload it (found by ADL)
+for other arena allocators. */
+template <class Alloc>
+inline bool bulk_release(const Alloc &)
+{
+	return false;
+}
+
+#ifdef RBTREE_HPP_PMR
+template <class T>
+inline bool bulk_release(const std::pmr::polymorphic_allocator<T> &a)
+{
+	return dynamic_cast<std::pmr::monotonic_buffer_resource *>(a.resource()) != nullptr;
+}
+#endif
+
+namespace detail {
+
+/* The value is constructed by the allocator, not by the node. */
+template <class Value>
+struct node : rbnode_t {
+	union {
+		Value value;
+	};
+
+	node() {}
+	~node() {}
+};
+
+template <class Alloc, class Value>
+using node_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<node<Value> >;
+
+template <class NodeAlloc, class... Args>
+typename std::allocator_traits<NodeAlloc>::value_type *
+	create_node(NodeAlloc &a, Args &&... args)
+{
+	typedef std::allocator_traits<NodeAlloc> traits;
+	typename traits::value_type *n = &*traits::allocate(a, 1);
+
+	::new ((void *)n) typename traits::value_type();
+	try {
+		traits::construct(a, &n->value, std::forward<Args>(args)...);
+	}
+	catch (...) {
+		traits::deallocate(a, n, 1);
+		throw;
+	}
+	return n;
+}
+
+template <class NodeAlloc>
+void destroy_node(NodeAlloc &a, typename std::allocator_traits<NodeAlloc>::value_type *n)
+{
+	typedef std::allocator_traits<NodeAlloc> traits;
+
+	traits::destroy(a, &n->value);
+	n->~node();
+	traits::deallocate(a, n, 1);
+}
+
+inline rbnode_t *next(rbnode_t *n)
+{
+	if (!rbnode_is_nil(n->right)) {
+		n = n->right;
+		while (!rbnode_is_nil(n->left))
+			n = n->left;
+		return n;
+	}
+	while (!rbnode_is_root(n) && rbnode_is_right(n))
+		n = n->parent;
+	return n->parent;
+}
+
+inline rbnode_t *prev(rbnode_t *n)
+{
+	if (!rbnode_is_nil(n->left)) {
+		n = n->left;
+		while (!rbnode_is_nil(n->right))
+			n = n->right;
+		return n;
+	}
+	while (!rbnode_is_root(n) && rbnode_is_left(n))
+		n = n->parent;
+	return n->parent;
+}
+
+inline rbnode_t *last(rbnode_t *n)
+{
+	if (!rbnode_is_nil(n)) {
+		while (!rbnode_is_nil(n->right))
+			n = n->right;
+	}
+	return n;
+}
+
+/* Bidirectional iterator, end() is the nil node. */
+template <class Value, bool Const>
+class iterator {
+	template <class, class, class, class, class, class> friend class tree;
+	template <class, bool> friend class iterator;
+
+	const rbtree_t *t_;
+	rbnode_t *n_;
+
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef Value value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef typename std::conditional<Const, const Value *, Value *>::type pointer;
+	typedef typename std::conditional<Const, const Value &, Value &>::type reference;
+
+	iterator() : t_(nullptr), n_(rbnode_nil) {}
+	iterator(const rbtree_t *t, rbnode_t *n) : t_(t), n_(n) {}
+	/* iterator to const_iterator */
+	template <bool C, class = typename std::enable_if<Const && !C>::type>
+	iterator(const iterator<Value, C> &it) : t_(it.t_), n_(it.n_) {}
+
+	reference operator*() const { return static_cast<node<Value> *>(n_)->value; }
+	pointer operator->() const { return &static_cast<node<Value> *>(n_)->value; }
+
+	iterator &operator++() { n_ = next(n_); return *this; }
+	iterator &operator--()
+	{
+		n_ = rbnode_is_nil(n_) ? last(t_->root) : prev(n_);
+		return *this;
+	}
+	iterator operator++(int) { iterator it = *this; ++*this; return it; }
+	iterator operator--(int) { iterator it = *this; --*this; return it; }
+
+	bool operator==(const iterator &it) const { return n_ == it.n_; }
+	bool operator!=(const iterator &it) const { return n_ != it.n_; }
+};
+
+/* Owns a node extracted from a tree and a copy of its allocator,
+see tree::extract(). */
+template <class Value, class NodeAlloc>
+class node_handle_base {
+	template <class, class, class, class, class, class> friend class tree;
+
+protected:
+	node<Value> *n_;
+	union {
+		NodeAlloc a_;	/* only when 'n_' is set */
+	};
+
+	node_handle_base(node<Value> *n, const NodeAlloc &a) : n_(n)
+	{
+		::new ((void *)&a_) NodeAlloc(a);
+	}
+
+	void reset()
+	{
+		if (n_ != nullptr) {
+			destroy_node(a_, n_);
+			a_.~NodeAlloc();
+			n_ = nullptr;
+		}
+	}
+
+public:
+	typedef typename std::allocator_traits<NodeAlloc>::template rebind_alloc<Value> allocator_type;
+
+	node_handle_base() : n_(nullptr) {}
+	node_handle_base(node_handle_base &&h) : n_(h.n_)
+	{
+		if (n_ != nullptr) {
+			::new ((void *)&a_) NodeAlloc(std::move(h.a_));
+			h.a_.~NodeAlloc();
+			h.n_ = nullptr;
+		}
+	}
+	node_handle_base &operator=(node_handle_base &&h)
+	{
+		if (this != &h) {
+			reset();
+			if (h.n_ != nullptr) {
+				n_ = h.n_;
+				::new ((void *)&a_) NodeAlloc(std::move(h.a_));
+				h.a_.~NodeAlloc();
+				h.n_ = nullptr;
+			}
+		}
+		return *this;
+	}
+	node_handle_base(const node_handle_base &) = delete;
+	node_handle_base &operator=(const node_handle_base &) = delete;
+	~node_handle_base() { reset(); }
+
+	bool empty() const { return n_ == nullptr; }
+	explicit operator bool() const { return n_ != nullptr; }
+	allocator_type get_allocator() const { return allocator_type(a_); }
+};
+
+template <class Key, class T, class NodeAlloc>
+class map_node_handle : public node_handle_base<std::pair<const Key, T>, NodeAlloc> {
+	typedef node_handle_base<std::pair<const Key, T>, NodeAlloc> base;
+	template <class, class, class, class, class, class> friend class tree;
+
+	map_node_handle(node<std::pair<const Key, T> > *n, const NodeAlloc &a) : base(n, a) {}
+
+public:
+	typedef Key key_type;
+	typedef T mapped_type;
+
+	map_node_handle() {}
+
+	/* the key can be changed before inserting the node again */
+	Key &key() const { return const_cast<Key &>(this->n_->value.first); }
+	T &mapped() const { return this->n_->value.second; }
+};
+
+template <class Value, class NodeAlloc>
+class set_node_handle : public node_handle_base<Value, NodeAlloc> {
+	typedef node_handle_base<Value, NodeAlloc> base;
+	template <class, class, class, class, class, class> friend class tree;
+
+	set_node_handle(node<Value> *n, const NodeAlloc &a) : base(n, a) {}
+
+public:
+	typedef Value value_type;
+
+	set_node_handle() {}
+
+	Value &value() const { return this->n_->value; }
+};
+
+struct map_key_of {
+	template <class Pair>
+	const typename Pair::first_type &operator()(const Pair &v) const { return v.first; }
+};
+
+struct set_key_of {
+	template <class Value>
+	const Value &operator()(const Value &v) const { return v; }
+};
+
+/* The common part of map and set. 'KeyOf' gets the key of a value. */
+template <class Key, class Value, class KeyOf, class Compare, class Allocator,
+	class NodeHandle>
+class tree {
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef Compare key_compare;
+	typedef Allocator allocator_type;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef Value &reference;
+	typedef const Value &const_reference;
+	/* set values are keys, so const even through 'iterator' */
+	typedef detail::iterator<Value, std::is_same<Key, Value>::value> iterator;
+	typedef detail::iterator<Value, true> const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef NodeHandle node_type;
+
+	struct insert_return_type {
+		iterator position;
+		bool inserted;
+		node_type node;
+	};
+
+protected:
+	typedef detail::node<Value> node_t;
+	typedef detail::node_alloc<Allocator, Value> node_alloc_t;
+	typedef std::allocator_traits<node_alloc_t> alloc_traits;
+
+	rbtree_t t_;
+	Compare cmp_;
+	node_alloc_t alloc_;
+
+	static node_t *to_node(rbnode_t *n) { return static_cast<node_t *>(n); }
+	static const Key &key_of(rbnode_t *n) { return KeyOf()(to_node(n)->value); }
+
+	static void free_node(rbnode_t *n, void *state)
+	{
+		destroy_node(static_cast<tree *>(state)->alloc_, to_node(n));
+	}
+
+	/* Find where 'key' goes, returns the equal node if any. */
+	template <class K>
+	rbnode_t *find_link(const K &key, rbnode_t **parent, rbnode_t ***link)
+	{
+		rbnode_t *x = t_.root;
+
+		*parent = rbnode_nil;
+		*link = &t_.root;
+		while (!rbnode_is_nil(x)) {
+			*parent = x;
+			if (cmp_(key, key_of(x)))
+				*link = &x->left;
+			else if (cmp_(key_of(x), key))
+				*link = &x->right;
+			else
+				return x;
+			x = **link;
+		}
+		return rbnode_nil;
+	}
+
+	void link(rbnode_t *parent, rbnode_t **link, node_t *n)
+	{
+		n->key = const_cast<Key *>(&KeyOf()(n->value));
+		rbtree_link(&t_, parent, link, n);
+	}
+
+	/* Link 'n' unless its key exists, destroys it then. */
+	std::pair<iterator, bool> insert_node(node_t *n)
+	{
+		rbnode_t *parent, **l, *x;
+
+		x = find_link(KeyOf()(n->value), &parent, &l);
+		if (!rbnode_is_nil(x)) {
+			destroy_node(alloc_, n);
+			return std::make_pair(iterator(&t_, x), false);
+		}
+		link(parent, l, n);
+		return std::make_pair(iterator(&t_, n), true);
+	}
+
+	/* Add the values of 'other' in order, copied or moved ('Move'),
+	each one becomes the right child of the last one. */
+	template <bool Move, class Other>
+	void append(Other &other)
+	{
+		rbnode_t *last = rbnode_nil, *n;
+		node_t *m;
+
+		for (n = other.t_.leftmost; !rbnode_is_nil(n); n = next(n)) {
+			if (Move)
+				m = create_node(alloc_, std::move(to_node(n)->value));
+			else
+				m = create_node(alloc_, to_node(n)->value);
+			link(last, rbnode_is_nil(last) ? &t_.root : &last->right, m);
+			last = m;
+		}
+	}
+
+	void take(tree &other)
+	{
+		t_ = other.t_;
+		rbtree_init(&other.t_, nullptr);
+	}
+
+	void assign_alloc(const tree &other, std::true_type) { alloc_ = other.alloc_; }
+	void assign_alloc(const tree &, std::false_type) {}
+	void move_alloc(tree &other, std::true_type) { alloc_ = std::move(other.alloc_); }
+	void move_alloc(tree &, std::false_type) {}
+	void swap_alloc(tree &other, std::true_type)
+	{
+		using std::swap;
+		swap(alloc_, other.alloc_);
+	}
+	void swap_alloc(tree &, std::false_type) {}
+
+public:
+	explicit tree(const Compare &cmp = Compare(), const Allocator &alloc = Allocator())
+		: cmp_(cmp), alloc_(alloc)
+	{
+		rbtree_init(&t_, nullptr);
+	}
+	explicit tree(const Allocator &alloc) : cmp_(), alloc_(alloc)
+	{
+		rbtree_init(&t_, nullptr);
+	}
+	tree(const tree &other)
+		: cmp_(other.cmp_),
+		alloc_(alloc_traits::select_on_container_copy_construction(other.alloc_))
+	{
+		rbtree_init(&t_, nullptr);
+		append<false>(other);
+	}
+	tree(const tree &other, const Allocator &alloc) : cmp_(other.cmp_), alloc_(alloc)
+	{
+		rbtree_init(&t_, nullptr);
+		append<false>(other);
+	}
+	tree(tree &&other) : cmp_(std::move(other.cmp_)), alloc_(std::move(other.alloc_))
+	{
+		take(other);
+	}
+	/* Nodes are moved only when the allocators are not equal. */
+	tree(tree &&other, const Allocator &alloc) : cmp_(other.cmp_), alloc_(alloc)
+	{
+		rbtree_init(&t_, nullptr);
+		if (alloc_ == other.alloc_)
+			take(other);
+		else {
+			append<true>(other);
+			other.clear();
+		}
+	}
+	~tree() { clear(); }
+
+	tree &operator=(const tree &other)
+	{
+		if (this != &other) {
+			clear();
+			cmp_ = other.cmp_;
+			assign_alloc(other, typename alloc_traits::propagate_on_container_copy_assignment());
+			append<false>(other);
+		}
+		return *this;
+	}
+	tree &operator=(tree &&other)
+	{
+		if (this != &other) {
+			clear();
+			cmp_ = std::move(other.cmp_);
+			if (alloc_traits::propagate_on_container_move_assignment::value ||
+				alloc_ == other.alloc_) {
+				move_alloc(other, typename alloc_traits::propagate_on_container_move_assignment());
+				take(other);
+			}
+			else {
+				append<true>(other);
+				other.clear();
+			}
+		}
+		return *this;
+	}
+
+	/* The allocators are swapped only if they propagate on swap,
+	otherwise they must be equal. */
+	void swap(tree &other)
+	{
+		using std::swap;
+
+		swap(t_, other.t_);
+		swap(cmp_, other.cmp_);
+		if (alloc_traits::propagate_on_container_swap::value)
+			swap_alloc(other, typename alloc_traits::propagate_on_container_swap());
+	}
+
+	allocator_type get_allocator() const { return allocator_type(alloc_); }
+
+	iterator begin() { return iterator(&t_, t_.leftmost); }
+	const_iterator begin() const { return const_iterator(&t_, t_.leftmost); }
+	const_iterator cbegin() const { return begin(); }
+	iterator end() { return iterator(&t_, rbnode_nil); }
+	const_iterator end() const { return const_iterator(&t_, rbnode_nil); }
+	const_iterator cend() const { return end(); }
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+	bool empty() const { return rbtree_size(&t_) == 0; }
+	size_type size() const { return rbtree_size(&t_); }
+	key_compare key_comp() const { return cmp_; }
+
+	/* Nodes of trivially destructible values are not visited at all
+	when their memory is released in bulk. */
+	void clear()
+	{
+		if (std::is_trivially_destructible<Value>::value && bulk_release(alloc_))
+			rbtree_init(&t_, nullptr);
+		else
+			rbtree_clear(&t_, free_node, this);
+	}
+
+	/* Forget all nodes without destroying or deallocating them, for when
+	the values need no destructor either and the memory goes away as a
+	whole, e.g. with its std::pmr::monotonic_buffer_resource. */
+	void discard() { rbtree_init(&t_, nullptr); }
+
+	template <class... Args>
+	std::pair<iterator, bool> emplace(Args &&... args)
+	{
+		return insert_node(create_node(alloc_, std::forward<Args>(args)...));
+	}
+
+	template <class... Args>
+	iterator emplace_hint(const_iterator hint, Args &&... args)
+	{
+		return emplace(std::forward<Args>(args)...).first;
+	}
+
+	std::pair<iterator, bool> insert(const value_type &v) { return emplace(v); }
+	std::pair<iterator, bool> insert(value_type &&v) { return emplace(std::move(v)); }
+
+	iterator erase(const_iterator pos)
+	{
+		rbnode_t *n = pos.n_, *nx = next(n);
+		rbtree_remove(&t_, n);
+		destroy_node(alloc_, to_node(n));
+		return iterator(&t_, nx);
+	}
+	iterator erase(const_iterator first, const_iterator last)
+	{
+		while (first != last)
+			first = erase(first);
+		return iterator(&t_, last.n_);
+	}
+	size_type erase(const Key &key)
+	{
+		iterator it = find(key);
+		if (it == end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+	/* Unlink the node at 'pos' and hand it over, nothing is copied. */
+	node_type extract(const_iterator pos)
+	{
+		rbtree_remove(&t_, pos.n_);
+		return node_type(to_node(pos.n_), alloc_);
+	}
+	node_type extract(const Key &key)
+	{
+		iterator it = find(key);
+		return it == end() ? node_type() : extract(it);
+	}
+
+	/* Link an extracted node, it stays in 'h.node' if the key exists.
+	The node must come from a tree with an equal allocator. */
+	insert_return_type insert(node_type &&h)
+	{
+		insert_return_type r;
+		rbnode_t *parent, **l, *x;
+
+		r.inserted = false;
+		if (h.empty()) {
+			r.position = end();
+			return r;
+		}
+		x = find_link(KeyOf()(h.n_->value), &parent, &l);
+		if (!rbnode_is_nil(x)) {
+			r.position = iterator(&t_, x);
+			r.node = std::move(h);
+			return r;
+		}
+		link(parent, l, h.n_);
+		r.position = iterator(&t_, h.n_);
+		r.inserted = true;
+		h.a_.~node_alloc_t();
+		h.n_ = nullptr;
+		return r;
+	}
+
+	/* Move the nodes of 'other' whose keys are not here yet,
+	the allocators must be equal. */
+	void merge(tree &other)
+	{
+		rbnode_t *n = other.t_.leftmost, *nx, *parent, **l;
+
+		for (; !rbnode_is_nil(n); n = nx) {
+			nx = next(n);
+			if (!rbnode_is_nil(find_link(key_of(n), &parent, &l)))
+				continue;
+			rbtree_remove(&other.t_, n);
+			link(parent, l, to_node(n));
+		}
+	}
+
+	template <class K>
+	iterator find(const K &key)
+	{
+		rbnode_t *x = t_.root;
+		while (!rbnode_is_nil(x)) {
+			if (cmp_(key, key_of(x)))
+				x = x->left;
+			else if (cmp_(key_of(x), key))
+				x = x->right;
+			else
+				break;
+		}
+		return iterator(&t_, x);
+	}
+	template <class K>
+	const_iterator find(const K &key) const { return const_cast<tree *>(this)->find(key); }
+
+	template <class K>
+	size_type count(const K &key) const { return find(key) != end(); }
+	template <class K>
+	bool contains(const K &key) const { return find(key) != end(); }
+
+	/* first node not less than 'key' */
+	template <class K>
+	iterator lower_bound(const K &key)
+	{
+		rbnode_t *x = t_.root, *r = rbnode_nil;
+		while (!rbnode_is_nil(x)) {
+			if (cmp_(key_of(x), key))
+				x = x->right;
+			else {
+				r = x;
+				x = x->left;
+			}
+		}
+		return iterator(&t_, r);
+	}
+	template <class K>
+	const_iterator lower_bound(const K &key) const
+	{
+		return const_cast<tree *>(this)->lower_bound(key);
+	}
+
+	/* first node greater than 'key' */
+	template <class K>
+	iterator upper_bound(const K &key)
+	{
+		rbnode_t *x = t_.root, *r = rbnode_nil;
+		while (!rbnode_is_nil(x)) {
+			if (cmp_(key, key_of(x))) {
+				r = x;
+				x = x->left;
+			}
+			else
+				x = x->right;
+		}
+		return iterator(&t_, r);
+	}
+	template <class K>
+	const_iterator upper_bound(const K &key) const
+	{
+		return const_cast<tree *>(this)->upper_bound(key);
+	}
+
+	template <class K>
+	std::pair<iterator, iterator> equal_range(const K &key)
+	{
+		return std::make_pair(lower_bound(key), upper_bound(key));
+	}
+	template <class K>
+	std::pair<const_iterator, const_iterator> equal_range(const K &key) const
+	{
+		return std::make_pair(lower_bound(key), upper_bound(key));
+	}
+};
+
+} /* namespace detail */
+
+/* Ordered map of unique keys, like std::map. */
+template <class Key, class T, class Compare = std::less<Key>,
+	class Allocator = std::allocator<std::pair<const Key, T> > >
+class map : public detail::tree<Key, std::pair<const Key, T>, detail::map_key_of,
+	Compare, Allocator, detail::map_node_handle<Key, T,
+		detail::node_alloc<Allocator, std::pair<const Key, T> > > > {
+	typedef detail::tree<Key, std::pair<const Key, T>, detail::map_key_of,
+		Compare, Allocator, detail::map_node_handle<Key, T,
+			detail::node_alloc<Allocator, std::pair<const Key, T> > > > base;
+
+	template <class K, class... Args>
+	std::pair<typename base::iterator, bool> try_emplace_key(K &&key, Args &&... args)
+	{
+		rbnode_t *parent, **l, *x;
+		typename base::node_t *n;
+
+		x = this->find_link(key, &parent, &l);
+		if (!rbnode_is_nil(x))
+			return std::make_pair(typename base::iterator(&this->t_, x), false);
+		n = detail::create_node(this->alloc_, std::piecewise_construct,
+			std::forward_as_tuple(std::forward<K>(key)),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+		this->link(parent, l, n);
+		return std::make_pair(typename base::iterator(&this->t_, n), true);
+	}
+
+public:
+	typedef T mapped_type;
+	typedef typename base::iterator iterator;
+
+	using base::base;
+
+	map() {}
+	map(std::initializer_list<typename base::value_type> init,
+		const Compare &cmp = Compare(), const Allocator &alloc = Allocator())
+		: base(cmp, alloc)
+	{
+		for (const auto &v : init)
+			this->emplace(v);
+	}
+
+	/* Constructs the value only if 'key' is not there. */
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(const Key &key, Args &&... args)
+	{
+		return try_emplace_key(key, std::forward<Args>(args)...);
+	}
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(Key &&key, Args &&... args)
+	{
+		return try_emplace_key(std::move(key), std::forward<Args>(args)...);
+	}
+
+	T &operator[](const Key &key) { return try_emplace(key).first->second; }
+	T &operator[](Key &&key) { return try_emplace(std::move(key)).first->second; }
+
+	T &at(const Key &key)
+	{
+		iterator it = this->find(key);
+		if (it == this->end())
+			throw std::out_of_range("rb::map::at");
+		return it->second;
+	}
+	const T &at(const Key &key) const { return const_cast<map *>(this)->at(key); }
+};
+
+/* Ordered set of unique keys, like std::set. Values are always const
+when reached through an iterator. */
+template <class Key, class Compare = std::less<Key>,
+	class Allocator = std::allocator<Key> >
+class set : public detail::tree<Key, Key, detail::set_key_of,
+	Compare, Allocator, detail::set_node_handle<Key, detail::node_alloc<Allocator, Key> > > {
+	typedef detail::tree<Key, Key, detail::set_key_of,
+		Compare, Allocator, detail::set_node_handle<Key, detail::node_alloc<Allocator, Key> > > base;
+
+public:
+	using base::base;
+
+	set() {}
+	set(std::initializer_list<Key> init,
+		const Compare &cmp = Compare(), const Allocator &alloc = Allocator())
+		: base(cmp, alloc)
+	{
+		for (const auto &v : init)
+			this->emplace(v);
+	}
+};
+
+#ifdef RBTREE_HPP_PMR
+namespace pmr {
+
+template <class Key, class T, class Compare = std::less<Key> >
+using map = rb::map<Key, T, Compare,
+	std::pmr::polymorphic_allocator<std::pair<const Key, T> > >;
+
+template <class Key, class Compare = std::less<Key> >
+using set = rb::set<Key, Compare, std::pmr::polymorphic_allocator<Key> >;
+
+} /* namespace pmr */
+#endif
+
+} /* namespace rb */
+
+#endif
@@ -0,0 +1,220 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include "rbtree_fc.h"
+
+#define FC_INSERT	1
+#define FC_REMOVE	2
+#define FC_LOOKUP	3
+
+/* Passes over the slots per combining, later ones pick up
+requests published while the previous pass was running. */
+#define FC_PASSES	3
+
+/* Spins on the own slot before yielding the CPU. */
+#define FC_SPINS	64
+
+#define fc_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define fc_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+int rbtree_fc_init(rbtree_fc_t *fc, rbtree_keycmp_func_t keycmp, unsigned int flags)
+{
+	int r;
+
+	rbtree_init_ex(&fc->tree, keycmp, flags);
+	fc->slots = NULL;
+	fc->slot_count = 0;
+	fc->batch = NULL;
+	fc->batches = 0;
+	fc->combined = 0;
+
+	if ((r = pthread_mutex_init(&fc->lock, NULL)) != 0) {
+		errno = r;
+		return -1;
+	}
+	return 0;
+}
+
+void rbtree_fc_destroy(rbtree_fc_t *fc)
+{
+	free(fc->batch);
+	fc->batch = NULL;
+	pthread_mutex_destroy(&fc->lock);
+}
+
+int rbtree_fc_register(rbtree_fc_t *fc, rbfcslot_t *slot)
+{
+	rbfcslot_t **batch;
+
+	pthread_mutex_lock(&fc->lock);
+
+	batch = realloc(fc->batch, (fc->slot_count + 1) * sizeof(rbfcslot_t *));
+	if (batch == NULL) {
+		pthread_mutex_unlock(&fc->lock);
+		errno = ENOMEM;
+		return -1;
+	}
+	fc->batch = batch;
+
+	slot->op = 0;
+	slot->next = fc->slots;
+	fc->slots = slot;
+	fc->slot_count++;
+
+	pthread_mutex_unlock(&fc->lock);
+	return 0;
+}
+
+void rbtree_fc_unregister(rbtree_fc_t *fc, rbfcslot_t *slot)
+{
+	rbfcslot_t **link;
+
+	pthread_mutex_lock(&fc->lock);
+	for (link = &fc->slots; *link != NULL; link = &(*link)->next) {
+		if (*link == slot) {
+			*link = slot->next;
+			fc->slot_count--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fc->lock);
+}
+
+static const void *slot_key(rbfcslot_t *slot)
+{
+	return slot->op == FC_INSERT ? slot->node->key : slot->key;
+}
+
+/* Insertion sort, a batch has at most one request per thread. */
+static void batch_sort(rbtree_fc_t *fc, rbfcslot_t **batch, size_t n)
+{
+	rbfcslot_t *s;
+	size_t i, j;
+
+	for (i = 1; i < n; i++) {
+		s = batch[i];
+		for (j = i; j > 0 && fc->tree.keycmp(slot_key(batch[j - 1]), slot_key(s)) > 0; j--)
+			batch[j] = batch[j - 1];
+		batch[j] = s;
+	}
+}
+
+static void slot_apply(rbtree_fc_t *fc, rbfcslot_t *slot)
+{
+	rbnode_t *n;
+
+	slot->error = 0;
+	switch (slot->op) {
+	case FC_INSERT:
+		if (rbtree_insert(&fc->tree, slot->node) != 0) {
+			slot->error = errno;
+			slot->node = NULL;
+		}
+		break;
+	case FC_REMOVE:
+		n = rbtree_lookup(&fc->tree, slot->key);
+		if (n != NULL)
+			rbtree_remove(&fc->tree, n);
+		slot->node = n;
+		break;
+	case FC_LOOKUP:
+		slot->node = rbtree_lookup(&fc->tree, slot->key);
+		break;
+	}
+	fc_store(&slot->op, 0);
+}
+
+/* Serve all published requests, called with the lock held. */
+static void fc_combine(rbtree_fc_t *fc)
+{
+	rbfcslot_t *slot;
+	size_t i, n;
+	int pass;
+
+	for (pass = 0; pass < FC_PASSES; pass++) {
+		n = 0;
+		for (slot = fc->slots; slot != NULL; slot = slot->next) {
+			if (fc_load(&slot->op) != 0)
+				fc->batch[n++] = slot;
+		}
+		if (n == 0)
+			break;
+
+		batch_sort(fc, fc->batch, n);
+		for (i = 0; i < n; i++)
+			slot_apply(fc, fc->batch[i]);
+
+		fc->batches++;
+		fc->combined += n;
+	}
+}
+
+/* Publish the request of 'slot' and wait until some combiner,
+maybe this thread, serves it. */
+static void fc_execute(rbtree_fc_t *fc, rbfcslot_t *slot, int op)
+{
+	int spins = 0;
+
+	fc_store(&slot->op, op);
+
+	for (;;) {
+		if (pthread_mutex_trylock(&fc->lock) == 0) {
+			fc_combine(fc);
+			pthread_mutex_unlock(&fc->lock);
+		}
+		if (fc_load(&slot->op) == 0)
+			break;
+		if (++spins >= FC_SPINS) {
+			spins = 0;
+			sched_yield();
+		}
+	}
+
+	if (slot->error != 0)
+		errno = slot->error;
+}
+
+int rbtree_fc_insert(rbtree_fc_t *fc, rbfcslot_t *slot, rbnode_t *n)
+{
+	slot->node = n;
+	fc_execute(fc, slot, FC_INSERT);
+	return slot->error == 0 ? 0 : -1;
+}
+
+rbnode_t *rbtree_fc_remove(rbtree_fc_t *fc, rbfcslot_t *slot, const void *key)
+{
+	slot->key = key;
+	fc_execute(fc, slot, FC_REMOVE);
+	return slot->node;
+}
+
+rbnode_t *rbtree_fc_lookup(rbtree_fc_t *fc, rbfcslot_t *slot, const void *key)
+{
+	slot->key = key;
+	fc_execute(fc, slot, FC_LOOKUP);
+	return slot->node;
+}
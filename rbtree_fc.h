@@ -0,0 +1,90 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef RBTREE_FC_H_
+#define RBTREE_FC_H_
+
+#include <pthread.h>
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Flat combining front end of a rbtree_t.
+Each thread publishes its request in its own slot, whichever thread gets
+the lock (the combiner) collects all published requests, sorts them by key
+and applies them in one go, so the tree is walked by one hot cache and the
+lock changes hands once per batch rather than once per request.
+Every rbtree_t mode works, since the combiner calls the normal functions. */
+
+typedef struct rbfcslot_t rbfcslot_t;
+typedef struct rbtree_fc_t rbtree_fc_t;
+
+/* Per-thread request slot, register it once before use. */
+struct rbfcslot_t {
+	int op;				/* pending request, 0 when served */
+	rbnode_t *node;		/* request argument / result */
+	const void *key;
+	int error;			/* errno of a failed request */
+	rbfcslot_t *next;
+};
+
+struct rbtree_fc_t {
+	rbtree_t tree;
+	pthread_mutex_t lock;
+	rbfcslot_t *slots;		/* registered slots */
+	size_t slot_count;
+	rbfcslot_t **batch;		/* combiner's scratch, one entry per slot */
+	size_t batches;			/* combining passes which served anything */
+	size_t combined;		/* requests served */
+};
+
+/* Returns 0 on success, otherwise -1 and errno is set. */
+int rbtree_fc_init(rbtree_fc_t *fc, rbtree_keycmp_func_t keycmp, unsigned int flags);
+
+/* Destroy the lock, nodes are left to the caller (see rbtree_clear). */
+void rbtree_fc_destroy(rbtree_fc_t *fc);
+
+/* Returns 0 on success, otherwise -1 and errno is set (ENOMEM). */
+int rbtree_fc_register(rbtree_fc_t *fc, rbfcslot_t *slot);
+
+/* The slot must have no pending request. */
+void rbtree_fc_unregister(rbtree_fc_t *fc, rbfcslot_t *slot);
+
+/* Same as rbtree_insert. */
+int rbtree_fc_insert(rbtree_fc_t *fc, rbfcslot_t *slot, rbnode_t *n);
+
+/* Remove the node returned by rbtree_lookup.
+Returns the removed node, or NULL if not found. */
+rbnode_t *rbtree_fc_remove(rbtree_fc_t *fc, rbfcslot_t *slot, const void *key);
+
+/* Same as rbtree_lookup. */
+rbnode_t *rbtree_fc_lookup(rbtree_fc_t *fc, rbfcslot_t *slot, const void *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
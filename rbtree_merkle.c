@@ -0,0 +1,162 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "rbtree_merkle.h"
+
+#define merkle_node(n)	rbtree_container_of((n), rbmerklenode_t, base)
+#define subtree_hash(n)	(rbnode_is_nil(n) ? 0 : merkle_node(n)->hash)
+
+typedef struct diff_t {
+	rbmerkle_t *a, *b;
+	rbtree_iterate_func_t only_in_a, only_in_b;
+	void *state;
+} diff_t;
+
+/* splitmix64, so that sums of similar keys don't collide
+(and no key hashes to 0) */
+static uint64_t mix(uint64_t h)
+{
+	h += 0x9e3779b97f4a7c15ULL;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint64_t key_hash(rbmerkle_t *m, rbnode_t *n)
+{
+	return rbnode_is_tombstone(n) ? 0 : mix(m->keyhash(n->key));
+}
+
+static void merkle_augment(rbtree_t *tree, rbnode_t *n)
+{
+	rbmerkle_t *m = rbtree_container_of(tree, rbmerkle_t, tree);
+	merkle_node(n)->hash = key_hash(m, n) + subtree_hash(n->left) + subtree_hash(n->right);
+}
+
+void rbmerkle_init(rbmerkle_t *m, rbtree_keycmp_func_t keycmp,
+	rbmerkle_hash_func_t keyhash, unsigned int flags)
+{
+	rbtree_init_ex(&m->tree, keycmp, flags & RBTREE_LAZY_DELETE);
+	m->tree.augment = merkle_augment;
+	m->keyhash = keyhash;
+}
+
+/* Hash of the keys less than 'key' (or not greater, when 'le'). */
+static uint64_t prefix_hash(rbmerkle_t *m, const void *key, int le)
+{
+	rbnode_t *n = m->tree.root;
+	uint64_t h = 0;
+	int cmp;
+
+	while (!rbnode_is_nil(n)) {
+		cmp = m->tree.keycmp(n->key, key);
+		if (cmp < 0 || (le && cmp == 0)) {
+			h += subtree_hash(n->left) + key_hash(m, n);
+			n = n->right;
+		}
+		else
+			n = n->left;
+	}
+	return h;
+}
+
+/* Hash of the keys between the keys of nodes 'lo' and 'hi' (both
+excluded), a nil node is unbounded. Not the keys themselves, a NULL
+key is valid (an integer 0). */
+static uint64_t range_hash(rbmerkle_t *m, rbnode_t *lo, rbnode_t *hi)
+{
+	uint64_t h = rbnode_is_nil(hi) ? rbmerkle_hash(m) : prefix_hash(m, hi->key, 0);
+	if (!rbnode_is_nil(lo))
+		h -= prefix_hash(m, lo->key, 1);
+	return h;
+}
+
+/* All keys of 'b' between 'lo' and 'hi' are missing in 'a'. */
+static int report_range(diff_t *d, rbnode_t *lo, rbnode_t *hi)
+{
+	rbtree_t *tree = &d->b->tree;
+	rbnode_t *n;
+	int r;
+
+	if (d->only_in_b == NULL)
+		return 0;
+
+	n = rbnode_is_nil(lo) ? rbtree_first(tree) : rbtree_upper_bound(tree, lo->key);
+	for (; !rbnode_is_nil(n); n = rbtree_next(tree, n)) {
+		if (!rbnode_is_nil(hi) && tree->keycmp(n->key, hi->key) >= 0)
+			break;
+		if ((r = d->only_in_b(tree, n, d->state)) != 0)
+			return r;
+	}
+	return 0;
+}
+
+/* 'n' is the subtree of 'a' holding its keys between the nodes
+'lo' and 'hi' of 'a'. */
+static int diff_range(diff_t *d, rbnode_t *n, rbnode_t *lo, rbnode_t *hi)
+{
+	rbnode_t *m;
+	int r;
+
+	if (subtree_hash(n) == range_hash(d->b, lo, hi))
+		return 0;
+
+	if (rbnode_is_nil(n))
+		return report_range(d, lo, hi);
+
+	if ((r = diff_range(d, n->left, lo, n)) != 0)
+		return r;
+
+	m = rbtree_lookup(&d->b->tree, n->key);
+	if (!rbnode_is_tombstone(n) && rbnode_is_nil(m)) {
+		if (d->only_in_a != NULL && (r = d->only_in_a(&d->a->tree, n, d->state)) != 0)
+			return r;
+	}
+	else if (rbnode_is_tombstone(n) && !rbnode_is_nil(m)) {
+		if (d->only_in_b != NULL && (r = d->only_in_b(&d->b->tree, m, d->state)) != 0)
+			return r;
+	}
+
+	return diff_range(d, n->right, n, hi);
+}
+
+int rbtree_diff(rbmerkle_t *a, rbmerkle_t *b,
+	rbtree_iterate_func_t only_in_a, rbtree_iterate_func_t only_in_b, void *state)
+{
+	diff_t d;
+
+	d.a = a;
+	d.b = b;
+	d.only_in_a = only_in_a;
+	d.only_in_b = only_in_b;
+	d.state = state;
+
+	return diff_range(&d, a->tree.root, rbnode_nil, rbnode_nil);
+}
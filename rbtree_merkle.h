@@ -0,0 +1,82 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifndef RBTREE_MERKLE_H_
+#define RBTREE_MERKLE_H_
+
+#include <stdint.h>
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tree with a hash of the key set of every subtree, to compare replicas.
+
+The hash of a set is the sum (mod 2^64) of the mixed hashes of its keys,
+so it doesn't depend on the shape of the tree, two trees holding the
+same keys have the same root hash whatever order they were built in.
+Tombstones count as absent. For trees without RBTREE_MULTI_*. */
+
+typedef struct rbmerkle_t rbmerkle_t;
+typedef struct rbmerklenode_t rbmerklenode_t;
+
+typedef uint64_t (*rbmerkle_hash_func_t)(const void *key);
+
+struct rbmerklenode_t {
+	rbnode_t base;
+	uint64_t hash;		/* of the live keys in the subtree */
+};
+
+/* Nodes are inserted and removed with the rbtree_* calls on 'tree'. */
+struct rbmerkle_t {
+	rbtree_t tree;
+	rbmerkle_hash_func_t keyhash;
+};
+
+/* 'flags' is 0 or RBTREE_LAZY_DELETE. 'keyhash' needn't mix well,
+the identity is fine for integer keys. */
+void rbmerkle_init(rbmerkle_t *m, rbtree_keycmp_func_t keycmp,
+	rbmerkle_hash_func_t keyhash, unsigned int flags);
+
+/* Hash of all live keys, 0 when empty. */
+#define rbmerkle_hash(m) \
+	(rbnode_is_nil((m)->tree.root) ? 0 : \
+	rbtree_container_of((m)->tree.root, rbmerklenode_t, base)->hash)
+
+/* Report the keys only in 'a' to 'only_in_a' and the keys only in 'b'
+to 'only_in_b' (either may be NULL), in key order.
+Walks 'a' and skips every subtree whose hash equals the hash of the
+same key range of 'b', so d differences cost O(d log^2 n) instead of O(n).
+The trees must not change during the walk.
+Returns 0, or the first non-zero value returned by a callback. */
+int rbtree_diff(rbmerkle_t *a, rbmerkle_t *b,
+	rbtree_iterate_func_t only_in_a, rbtree_iterate_func_t only_in_b, void *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,384 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "rbtree_mt.h"
+
+/* Most locks held at once. Insert keeps t, g, p and q between steps
+and adds q's children, 6. Remove keeps p, q, q's next child, the match
+and its parent between steps, and adds q's other child, s and s's
+children (q's next child is the new q), 10. 12 leaves a margin. */
+#define HELD_MAX	12
+
+#define mtnode(n)	rbtree_container_of((n), rbmtnode_t, base)
+
+typedef struct held_t {
+	rbmtnode_t *nodes[HELD_MAX];
+	int count;
+} held_t;
+
+static int held_has(held_t *h, rbnode_t *n)
+{
+	int i;
+	for (i = 0; i < h->count; i++) {
+		if (&h->nodes[i]->base == n)
+			return 1;
+	}
+	return 0;
+}
+
+static void held_lock(held_t *h, rbnode_t *n)
+{
+	if (rbnode_is_nil(n) || held_has(h, n))
+		return;
+	assert(h->count < HELD_MAX);
+	pthread_mutex_lock(&mtnode(n)->lock);
+	h->nodes[h->count++] = mtnode(n);
+}
+
+/* Unlock every held node except those in 'keep'. */
+static void held_release(held_t *h, rbnode_t **keep, int nkeep)
+{
+	int i, j, k = 0;
+
+	for (i = 0; i < h->count; i++) {
+		for (j = 0; j < nkeep; j++) {
+			if (keep[j] == &h->nodes[i]->base)
+				break;
+		}
+		if (j < nkeep)
+			h->nodes[k++] = h->nodes[i];
+		else
+			pthread_mutex_unlock(&h->nodes[i]->lock);
+	}
+	h->count = k;
+}
+
+/* Same as the rotations of the top-down passes in rbtree.c.
+A node's 'parent' is only written by a thread holding its old
+and new parent, and only read by single-threaded code. */
+static rbnode_t *mt_single(rbnode_t *root, int dir)
+{
+	rbnode_t *save = rbnode_child(root, !dir);
+	rbnode_t *inner = rbnode_child(save, dir);
+
+	rbnode_child(root, !dir) = inner;
+	if (!rbnode_is_nil(inner))
+		inner->parent = root;
+
+	rbnode_child(save, dir) = root;
+	save->parent = root->parent;
+	root->parent = save;
+
+	rbnode_set_red(root);
+	rbnode_set_black(save);
+	return save;
+}
+
+static rbnode_t *mt_double(rbnode_t *root, int dir)
+{
+	rbnode_child(root, !dir) = mt_single(rbnode_child(root, !dir), !dir);
+	return mt_single(root, dir);
+}
+
+static void mt_link(rbtree_mt_t *mt, rbnode_t *parent, int dir, rbnode_t *n)
+{
+	rbnode_child(parent, dir) = n;
+	if (parent == &mt->head.base) {
+		mt->tree.root = n;
+		parent = rbnode_nil;
+	}
+	if (!rbnode_is_nil(n))
+		n->parent = parent;
+}
+
+/* The passes may leave a red root, it's recolored
+as soon as the thread holds both the head and the root. */
+static void mt_blacken_root(rbtree_mt_t *mt, held_t *h)
+{
+	rbnode_t *root;
+
+	if (!held_has(h, &mt->head.base))
+		return;
+
+	root = mt->tree.root;
+	if (!rbnode_is_nil(root) && held_has(h, root))
+		rbnode_set_black(root);
+
+}
+
+int rbtree_mt_init(rbtree_mt_t *mt, rbtree_keycmp_func_t keycmp)
+{
+	int r;
+
+	rbtree_init(&mt->tree, keycmp);
+	memset(&mt->head.base, 0, sizeof(rbnode_t));
+	rbnode_set_black(&mt->head.base);
+
+	if ((r = pthread_mutex_init(&mt->head.lock, NULL)) != 0) {
+		errno = r;
+		return -1;
+	}
+	return 0;
+}
+
+void rbtree_mt_destroy(rbtree_mt_t *mt)
+{
+	pthread_mutex_destroy(&mt->head.lock);
+}
+
+int rbmtnode_init(rbmtnode_t *n)
+{
+	int r;
+
+	if ((r = pthread_mutex_init(&n->lock, NULL)) != 0) {
+		errno = r;
+		return -1;
+	}
+	return 0;
+}
+
+void rbmtnode_destroy(rbmtnode_t *n)
+{
+	pthread_mutex_destroy(&n->lock);
+}
+
+int rbtree_mt_insert(rbtree_mt_t *mt, rbmtnode_t *node)
+{
+	rbnode_t *head = &mt->head.base, *n = &node->base;
+	rbnode_t *t, *g, *p, *q, *keep[4];
+	held_t held;
+	int dir = 1, last = 1, cmp, r = 0, linked = 0;
+
+	held.count = 0;
+	held_lock(&held, head);
+
+	t = g = rbnode_nil;
+	p = head;
+	q = mt->tree.root;
+	held_lock(&held, q);
+
+	for (;;) {
+		if (rbnode_is_nil(q)) {
+			/* 'n' is unreachable for others until 'p' is unlocked */
+			q = n;
+			n->left = n->right = rbnode_nil;
+			n->flags = 0;
+			n->dup = rbnode_nil;
+			rbnode_set_red(n);
+			mt_link(mt, p, dir, n);
+			__atomic_add_fetch(&mt->tree.count, 1, __ATOMIC_RELAXED);
+			/* 'leftmost' only changes under the lock of the node it points to */
+			if (p == head || (dir == 0 &&
+				p == __atomic_load_n(&mt->tree.leftmost, __ATOMIC_RELAXED)))
+				__atomic_store_n(&mt->tree.leftmost, n, __ATOMIC_RELAXED);
+			linked = 1;
+			if (p == head)
+				rbnode_set_black(n);
+		}
+		else {
+			held_lock(&held, q->left);
+			held_lock(&held, q->right);
+			if (rbnode_is_red(q->left) && rbnode_is_red(q->right)) {
+				rbnode_set_red(q);
+				rbnode_set_black(q->left);
+				rbnode_set_black(q->right);
+			}
+		}
+
+		if (rbnode_is_red(q) && rbnode_is_red(p)) {
+			int dir2 = t->right == g;
+			if (q == rbnode_child(p, last))
+				mt_link(mt, t, dir2, mt_single(g, !last));
+			else
+				mt_link(mt, t, dir2, mt_double(g, !last));
+		}
+
+		mt_blacken_root(mt, &held);
+
+		if (linked)
+			break;
+
+		cmp = mt->tree.keycmp(n->key, q->key);
+		if (cmp == 0) {
+			errno = EEXIST;
+			r = -1;
+			break;
+		}
+
+		last = dir;
+		dir = cmp > 0;
+
+		if (!rbnode_is_nil(g))
+			t = g;
+		g = p;
+		p = q;
+		q = rbnode_child(q, dir);
+
+		keep[0] = t;
+		keep[1] = g;
+		keep[2] = p;
+		keep[3] = q;
+		held_release(&held, keep, 4);
+	}
+
+	held_release(&held, NULL, 0);
+	return r;
+}
+
+rbmtnode_t *rbtree_mt_remove(rbtree_mt_t *mt, const void *key)
+{
+	rbnode_t *head = &mt->head.base, *q, *p, *g, *s, *c, *keep[5];
+	rbnode_t *f = rbnode_nil, *fp = rbnode_nil;
+	held_t held;
+	int dir = 1, last, cmp;
+
+	held.count = 0;
+	held_lock(&held, head);
+
+	q = head;
+	g = p = rbnode_nil;
+
+	while (!rbnode_is_nil(rbnode_child(q, dir))) {
+		last = dir;
+		g = p;
+		p = q;
+		q = rbnode_child(q, dir);
+		held_lock(&held, q);
+
+		cmp = mt->tree.keycmp(q->key, key);
+		dir = cmp < 0;
+		if (cmp == 0)
+			f = q;
+
+		held_lock(&held, q->left);
+		held_lock(&held, q->right);
+
+		if (rbnode_is_black(q) && rbnode_is_black(rbnode_child(q, dir))) {
+			if (rbnode_is_red(rbnode_child(q, !dir))) {
+				s = mt_single(q, dir);
+				mt_link(mt, p, last, s);
+				p = s;
+			}
+			else if (!rbnode_is_nil(s = rbnode_child(p, !last))) {
+				held_lock(&held, s);
+				held_lock(&held, s->left);
+				held_lock(&held, s->right);
+
+				if (rbnode_is_black(s->left) && rbnode_is_black(s->right)) {
+					rbnode_set_black(p);
+					rbnode_set_red(s);
+					rbnode_set_red(q);
+				}
+				else {
+					int dir2 = g->right == p;
+					if (rbnode_is_red(rbnode_child(s, last)))
+						mt_link(mt, g, dir2, mt_double(p, last));
+					else
+						mt_link(mt, g, dir2, mt_single(p, last));
+
+					s = rbnode_child(g, dir2);
+					rbnode_set_red(q);
+					rbnode_set_red(s);
+					rbnode_set_black(s->left);
+					rbnode_set_black(s->right);
+				}
+			}
+		}
+
+		mt_blacken_root(mt, &held);
+
+		/* the match and its parent stay locked until the end,
+		its parent only changes by rotations inside the window */
+		if (!rbnode_is_nil(f))
+			fp = rbnode_is_nil(f->parent) ? head : f->parent;
+
+		keep[0] = p;
+		keep[1] = q;
+		keep[2] = rbnode_child(q, dir);
+		keep[3] = f;
+		keep[4] = fp;
+		held_release(&held, keep, 5);
+	}
+
+	if (!rbnode_is_nil(f)) {
+		/* 'q' is red (or the root) with at most one child */
+		c = rbnode_is_nil(q->left) ? q->right : q->left;
+		mt_link(mt, p, p->right == q, c);
+
+		/* the first node has no predecessor, so it's 'q' itself,
+		its successor is its child or its parent */
+		if (q == f && f == __atomic_load_n(&mt->tree.leftmost, __ATOMIC_RELAXED))
+			__atomic_store_n(&mt->tree.leftmost,
+				!rbnode_is_nil(c) ? c : (p == head ? rbnode_nil : p), __ATOMIC_RELAXED);
+
+		if (q != f) {
+			q->left = f->left;
+			q->right = f->right;
+			q->color = f->color;
+			if (!rbnode_is_nil(q->left))
+				q->left->parent = q;
+			if (!rbnode_is_nil(q->right))
+				q->right->parent = q;
+			fp = rbnode_is_nil(f->parent) ? head : f->parent;
+			mt_link(mt, fp, fp->right == f, q);
+		}
+
+		f->left = f->right = f->parent = rbnode_nil;
+		__atomic_sub_fetch(&mt->tree.count, 1, __ATOMIC_RELAXED);
+	}
+
+	held_release(&held, NULL, 0);
+	return rbnode_is_nil(f) ? NULL : mtnode(f);
+}
+
+int rbtree_mt_lookup(rbtree_mt_t *mt, const void *key,
+	rbtree_iterate_func_t fn, void *state)
+{
+	rbmtnode_t *prev = &mt->head;
+	rbnode_t *x;
+	int cmp, r;
+
+	pthread_mutex_lock(&prev->lock);
+	x = mt->tree.root;
+	while (!rbnode_is_nil(x)) {
+		pthread_mutex_lock(&mtnode(x)->lock);
+		pthread_mutex_unlock(&prev->lock);
+		prev = mtnode(x);
+
+		cmp = mt->tree.keycmp(x->key, key);
+		if (cmp == 0) {
+			r = fn(&mt->tree, x, state);
+			pthread_mutex_unlock(&prev->lock);
+			return r;
+		}
+		x = cmp > 0 ? x->left : x->right;
+	}
+	pthread_mutex_unlock(&prev->lock);
+
+	errno = ENOENT;
+	return -1;
+}
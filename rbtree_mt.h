@@ -0,0 +1,91 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef RBTREE_MT_H_
+#define RBTREE_MT_H_
+
+#include <pthread.h>
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Concurrent tree with lock coupling (hand-over-hand locking).
+Every node has its own lock, writers use the top-down passes, so a thread
+only holds the few locks around its current position (plus the match and
+its parent when removing), threads in disjoint subtrees don't block each
+other. Locks are always taken from parent to child, which can't deadlock.
+RBTREE_MULTI_* and RBTREE_LAZY_DELETE are not supported.
+
+When no thread is using it, 'tree' is an ordinary rbtree_t, so all the
+rbtree_* functions (iteration, profile, clear, ...) work on it. */
+
+typedef struct rbmtnode_t rbmtnode_t;
+typedef struct rbtree_mt_t rbtree_mt_t;
+
+struct rbmtnode_t {
+	rbnode_t base;
+	pthread_mutex_t lock;
+};
+
+struct rbtree_mt_t {
+	rbtree_t tree;
+	rbmtnode_t head;	/* its lock guards 'tree.root', 'head.base.right' mirrors it */
+};
+
+/* Returns 0 on success, otherwise -1 and errno is set. */
+int rbtree_mt_init(rbtree_mt_t *mt, rbtree_keycmp_func_t keycmp);
+
+/* Destroy the head lock, nodes are left to the caller (see rbtree_clear). */
+void rbtree_mt_destroy(rbtree_mt_t *mt);
+
+/* Returns 0 on success, otherwise -1 and errno is set. */
+int rbmtnode_init(rbmtnode_t *n);
+
+void rbmtnode_destroy(rbmtnode_t *n);
+
+/* Insert node.
+If successful, returns 0, otherwise returns -1,
+and errno set to EEXIST when failure.*/
+int rbtree_mt_insert(rbtree_mt_t *mt, rbmtnode_t *n);
+
+/* Remove the node with 'key'.
+Returns the removed node, or NULL if not found.
+No other thread references the node after return, it can be freed. */
+rbmtnode_t *rbtree_mt_remove(rbtree_mt_t *mt, const void *key);
+
+/* Lookup node by key, and call 'fn' with the node locked.
+Returns what 'fn' returns, or -1 with errno set to ENOENT if not found. */
+int rbtree_mt_lookup(rbtree_mt_t *mt, const void *key,
+	rbtree_iterate_func_t fn, void *state);
+
+/* Writers update the count atomically, so it's read that way. */
+#define rbtree_mt_size(mt) __atomic_load_n(&(mt)->tree.count, __ATOMIC_RELAXED)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
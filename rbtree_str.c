@@ -0,0 +1,266 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "rbtree_str.h"
+
+#define PREFIX_WORDS		(RBSTR_PREFIX_SIZE / 8)
+#define CHUNK_SIZE			(64 * 1024)
+#define SLOTS_MIN			64
+
+struct rbstrchunk_t {
+	rbstrchunk_t *next;
+};
+
+void rbstrarena_init(rbstrarena_t *arena)
+{
+	memset(arena, 0, sizeof(rbstrarena_t));
+}
+
+void rbstrarena_free(rbstrarena_t *arena)
+{
+	rbstrchunk_t *c, *next;
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(arena->slots);
+	rbstrarena_init(arena);
+}
+
+/* FNV-1a */
+static unsigned int str_hash(const char *s, size_t len)
+{
+	unsigned int h = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int arena_grow_slots(rbstrarena_t *arena)
+{
+	rbstrkey_t **slots, *k;
+	size_t count, i, j;
+
+	count = arena->slot_count ? arena->slot_count * 2 : SLOTS_MIN;
+	slots = calloc(count, sizeof(rbstrkey_t *));
+	if (slots == NULL)
+		return -1;
+
+	for (i = 0; i < arena->slot_count; i++) {
+		k = arena->slots[i];
+		if (k == NULL)
+			continue;
+		j = k->hash & (count - 1);
+		while (slots[j] != NULL)
+			j = (j + 1) & (count - 1);
+		slots[j] = k;
+	}
+
+	free(arena->slots);
+	arena->slots = slots;
+	arena->slot_count = count;
+	return 0;
+}
+
+static void *arena_alloc(rbstrarena_t *arena, size_t size)
+{
+	void *p;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	if (arena->avail < size) {
+		rbstrchunk_t *c;
+		size_t csize = sizeof(rbstrchunk_t) + size;
+		if (csize < CHUNK_SIZE)
+			csize = CHUNK_SIZE;
+		c = malloc(csize);
+		if (c == NULL)
+			return NULL;
+		c->next = arena->chunks;
+		arena->chunks = c;
+		arena->ptr = (char *)(c + 1);
+		arena->avail = csize - sizeof(rbstrchunk_t);
+	}
+
+	p = arena->ptr;
+	arena->ptr += size;
+	arena->avail -= size;
+	return p;
+}
+
+const rbstrkey_t *rbstrarena_intern(rbstrarena_t *arena, const char *s, size_t len)
+{
+	unsigned int h;
+	size_t i;
+	rbstrkey_t *k;
+
+	if ((arena->count + 1) * 4 > arena->slot_count * 3) {
+		if (arena_grow_slots(arena) != 0)
+			return NULL;
+	}
+
+	h = str_hash(s, len);
+	i = h & (arena->slot_count - 1);
+	while ((k = arena->slots[i]) != NULL) {
+		if (k->hash == h && k->len == len && memcmp(k->data, s, len) == 0)
+			return k;
+		i = (i + 1) & (arena->slot_count - 1);
+	}
+
+	k = arena_alloc(arena, sizeof(rbstrkey_t) + len + 1);
+	if (k == NULL)
+		return NULL;
+	k->len = len;
+	k->hash = h;
+	memcpy(k->data, s, len);
+	k->data[len] = '\0';
+
+	arena->slots[i] = k;
+	arena->count++;
+
+	return k;
+}
+
+void rbtree_str_prefix(const char *s, size_t len, uint64_t prefix[RBSTR_PREFIX_SIZE / 8])
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i, w;
+	uint64_t v;
+
+	if (len > RBSTR_PREFIX_SIZE)
+		len = RBSTR_PREFIX_SIZE;
+
+	for (w = 0; w < PREFIX_WORDS; w++) {
+		v = 0;
+		for (i = w * 8; i < w * 8 + 8; i++) {
+			v <<= 8;
+			if (i < len)
+				v |= p[i];
+		}
+		prefix[w] = v;
+	}
+}
+
+static inline int prefix_cmp(const uint64_t *a, const uint64_t *b)
+{
+	int i;
+	for (i = 0; i < PREFIX_WORDS; i++) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Compare the bytes behind the prefix, only valid when prefixes are equal. */
+static inline int tail_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	size_t m = alen < blen ? alen : blen;
+	if (m > RBSTR_PREFIX_SIZE) {
+		int r = memcmp(a + RBSTR_PREFIX_SIZE, b + RBSTR_PREFIX_SIZE, m - RBSTR_PREFIX_SIZE);
+		if (r != 0)
+			return r;
+	}
+	if (alen == blen)
+		return 0;
+	return alen < blen ? -1 : 1;
+}
+
+int rbtree_str_keycmp(const void *a, const void *b)
+{
+	const rbstrkey_t *x = a, *y = b;
+	size_t m = x->len < y->len ? x->len : y->len;
+	int r = memcmp(x->data, y->data, m);
+	if (r != 0)
+		return r;
+	if (x->len == y->len)
+		return 0;
+	return x->len < y->len ? -1 : 1;
+}
+
+int rbtree_str_insert(rbtree_t *tree, rbstrnode_t *n)
+{
+	const rbstrkey_t *key = rbstrnode_key(n), *k;
+	rbnode_t *x, *y, **link;
+	rbstrnode_t *m;
+	int cmp;
+
+	rbtree_str_prefix(key->data, key->len, n->prefix);
+
+	y = rbnode_nil;
+	link = &tree->root;
+	x = tree->root;
+	while (!rbnode_is_nil(x)) {
+		m = rbtree_container_of(x, rbstrnode_t, base);
+		cmp = prefix_cmp(n->prefix, m->prefix);
+		if (cmp == 0) {
+			k = rbstrnode_key(m);
+			cmp = tail_cmp(key->data, key->len, k->data, k->len);
+		}
+		y = x;
+		if (cmp < 0)
+			link = &x->left;
+		else if (cmp > 0)
+			link = &x->right;
+		else {
+			errno = EEXIST;
+			return -1;
+		}
+		x = *link;
+	}
+
+	rbtree_link(tree, y, link, &n->base);
+
+	return 0;
+}
+
+rbstrnode_t *rbtree_str_lookup(rbtree_t *tree, const char *s, size_t len)
+{
+	uint64_t prefix[PREFIX_WORDS];
+	const rbstrkey_t *k;
+	rbnode_t *x = tree->root;
+	rbstrnode_t *m;
+	int cmp;
+
+	rbtree_str_prefix(s, len, prefix);
+
+	while (!rbnode_is_nil(x)) {
+		m = rbtree_container_of(x, rbstrnode_t, base);
+		cmp = prefix_cmp(prefix, m->prefix);
+		if (cmp == 0) {
+			k = rbstrnode_key(m);
+			cmp = tail_cmp(s, len, k->data, k->len);
+			if (cmp == 0)
+				return m;
+		}
+		x = cmp < 0 ? x->left : x->right;
+	}
+	return NULL;
+}
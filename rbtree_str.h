@@ -0,0 +1,108 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef RBTREE_STR_H_
+#define RBTREE_STR_H_
+
+#include <stdint.h>
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes of the key which are cached in the node. */
+#define RBSTR_PREFIX_SIZE	16
+
+typedef struct rbstrkey_t rbstrkey_t;
+typedef struct rbstrnode_t rbstrnode_t;
+typedef struct rbstrarena_t rbstrarena_t;
+typedef struct rbstrchunk_t rbstrchunk_t;
+
+/* Key of string-keyed tree, 'data' is 'len' bytes followed by '\0'. */
+struct rbstrkey_t {
+	size_t len;
+	unsigned int hash;
+	char data[];
+};
+
+/* Node of string-keyed tree.
+'base.key' points to a rbstrkey_t, and 'prefix' holds the first
+RBSTR_PREFIX_SIZE bytes of it as big-endian integers (zero padded),
+so comparing two prefixes as integers gives the same order as memcmp().
+Lookups only touch 'base.key' when the prefixes are equal. */
+struct rbstrnode_t {
+	rbnode_t base;
+	uint64_t prefix[RBSTR_PREFIX_SIZE / 8];
+};
+
+/* Interned key storage.
+Keys are packed into large chunks and never freed one by one,
+equal strings share one rbstrkey_t. */
+struct rbstrarena_t {
+	rbstrchunk_t *chunks;
+	char *ptr;
+	size_t avail;
+	rbstrkey_t **slots;
+	size_t slot_count;
+	size_t count;
+};
+
+#define RBSTRARENA_INIT() { 0 }
+
+void rbstrarena_init(rbstrarena_t *arena);
+
+/* Release all keys of the arena. */
+void rbstrarena_free(rbstrarena_t *arena);
+
+/* Returns the interned copy of 's', adds it when not exists.
+Returns NULL when out of memory. */
+const rbstrkey_t *rbstrarena_intern(rbstrarena_t *arena, const char *s, size_t len);
+
+/* Compare two rbstrkey_t, it's the 'keycmp' of string-keyed trees. */
+int rbtree_str_keycmp(const void *a, const void *b);
+
+#define RBTREE_STR_INIT() RBTREE_INIT(rbtree_str_keycmp)
+
+#define rbtree_str_init(tree) rbtree_init((tree), rbtree_str_keycmp)
+
+/* Fill 'prefix' from the first RBSTR_PREFIX_SIZE bytes of 's'. */
+void rbtree_str_prefix(const char *s, size_t len, uint64_t prefix[RBSTR_PREFIX_SIZE / 8]);
+
+/* Insert node, 'n->base.key' should be set to a rbstrkey_t before.
+If successful, returns 0, otherwise returns -1,
+and errno set to EEXIST when failure.*/
+int rbtree_str_insert(rbtree_t *tree, rbstrnode_t *n);
+
+/* Lookup node by string.
+If found, returns node that found, otherwise returns NULL. */
+rbstrnode_t *rbtree_str_lookup(rbtree_t *tree, const char *s, size_t len);
+
+#define rbstrnode_key(n) ((const rbstrkey_t *)((n)->base.key))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
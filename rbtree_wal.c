@@ -0,0 +1,642 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define open	_open
+#define close	_close
+#define read	_read
+#define write	_write
+#define lseek	_lseek
+#define fsync	_commit
+#define ftruncate	_chsize
+#else
+#include <unistd.h>
+#define O_BINARY	0
+#endif
+#include "rbtree_wal.h"
+
+#define WAL_INSERT		1
+#define WAL_REMOVE		2
+
+#define LOG_MAGIC		"RBWALOG1"
+#define CKPT_MAGIC		"RBWALCK1"
+#define MAGIC_SIZE		8
+#define HEADER_SIZE		(MAGIC_SIZE + 8)
+#define RECORD_HEAD		5		/* u32 size, u8 op */
+#define RECORD_TAIL		4		/* u32 checksum */
+#define RECORD_MAX		(1 << 24)
+#define FLUSH_SIZE		(64 * 1024)
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)v);
+	put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+/* FNV-1a, only to detect torn or garbage records. */
+static uint32_t checksum(const unsigned char *p, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* Returns the number of bytes written, less than 'len' on error. */
+static size_t write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	size_t done = 0;
+	int r;
+
+	while (done < len) {
+		r = write(fd, p + done, (unsigned int)(len - done > FLUSH_SIZE ? FLUSH_SIZE : len - done));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		done += r;
+	}
+	return done;
+}
+
+/* Read the whole file, returns NULL with errno set on error. */
+static unsigned char *read_all(int fd, size_t *size)
+{
+	unsigned char *buf = NULL, *p;
+	size_t len = 0, cap = 0;
+	int r;
+
+	for (;;) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : FLUSH_SIZE;
+			p = realloc(buf, cap);
+			if (p == NULL) {
+				free(buf);
+				errno = ENOMEM;
+				return NULL;
+			}
+			buf = p;
+		}
+		r = read(fd, buf + len, (unsigned int)(cap - len));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return NULL;
+		}
+		if (r == 0)
+			break;
+		len += r;
+	}
+
+	*size = len;
+	return buf;
+}
+
+static int buf_reserve(rbwal_t *wal, size_t size)
+{
+	char *p;
+	size_t cap;
+
+	if (wal->len + size <= wal->cap)
+		return 0;
+
+	cap = wal->cap ? wal->cap : FLUSH_SIZE;
+	while (cap < wal->len + size)
+		cap *= 2;
+	p = realloc(wal->buf, cap);
+	if (p == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	wal->buf = p;
+	wal->cap = cap;
+	return 0;
+}
+
+/* Encode one record at the end of the buffer. */
+static int buf_record(rbwal_t *wal, int op, const void *key)
+{
+	unsigned char *rec;
+	size_t avail;
+	int size;
+
+	if (buf_reserve(wal, RECORD_HEAD + RECORD_TAIL + 16) != 0)
+		return -1;
+
+	for (;;) {
+		avail = wal->cap - wal->len - RECORD_HEAD - RECORD_TAIL;
+		size = wal->encode(key, wal->buf + wal->len + RECORD_HEAD, avail, wal->state);
+		if (size < 0 || size > RECORD_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+		if ((size_t)size <= avail)
+			break;
+		if (buf_reserve(wal, RECORD_HEAD + RECORD_TAIL + size) != 0)
+			return -1;
+	}
+
+	rec = (unsigned char *)wal->buf + wal->len;
+	put_u32(rec, (uint32_t)size);
+	rec[4] = (unsigned char)op;
+	put_u32(rec + RECORD_HEAD + size, checksum(rec + 4, 1 + size));
+	wal->len += RECORD_HEAD + size + RECORD_TAIL;
+	return 0;
+}
+
+static void buf_header(rbwal_t *wal, const char *magic, uint64_t generation)
+{
+	memcpy(wal->buf, magic, MAGIC_SIZE);
+	put_u64((unsigned char *)wal->buf + MAGIC_SIZE, generation);
+	wal->len = HEADER_SIZE;
+}
+
+/* Write the buffered records to the log. What is written is dropped
+from the buffer even on error, so a retry goes on after it instead of
+writing it twice. */
+static int flush_log(rbwal_t *wal)
+{
+	size_t done;
+	int err;
+
+	if (wal->len == 0)
+		return 0;
+
+	done = write_all(wal->fd, wal->buf, wal->len);
+	if (done == wal->len) {
+		wal->len = 0;
+		return 0;
+	}
+
+	err = errno;
+	memmove(wal->buf, wal->buf + done, wal->len - done);
+	wal->len -= done;
+	errno = err;
+	return -1;
+}
+
+/* For rbtree_purge(), which needs a free function. */
+static void purge_node(rbnode_t *n, void *state)
+{
+	rbwal_t *wal = state;
+	if (wal->free_node)
+		wal->free_node(n, wal->state);
+}
+
+/* Apply one record to the tree. */
+static int replay(rbwal_t *wal, int op, const unsigned char *data, size_t size)
+{
+	rbnode_t *n, *m;
+
+	n = wal->decode(data, size, wal->state);
+	if (n == NULL)
+		return -1;
+
+	if (op == WAL_INSERT) {
+		if (rbtree_insert(wal->tree, n) == 0)
+			return 0;
+	}
+	else {
+		m = rbtree_lookup(wal->tree, n->key);
+		if (m != NULL) {
+			rbtree_remove(wal->tree, m);
+			/* a tombstone stays linked until recover() purges it */
+			if (!(wal->tree->flags & RBTREE_LAZY_DELETE) && wal->free_node)
+				wal->free_node(m, wal->state);
+		}
+	}
+
+	if (wal->free_node)
+		wal->free_node(n, wal->state);
+	return 0;
+}
+
+/* Replay the records of 'buf', '*end' is set to the length of the
+valid part. Returns -1 if a record could not be applied. */
+static int replay_all(rbwal_t *wal, const unsigned char *buf, size_t len, size_t *end)
+{
+	size_t off = HEADER_SIZE, size;
+	int r = 0;
+
+	while (len - off >= RECORD_HEAD + RECORD_TAIL) {
+		size = get_u32(buf + off);
+		if (size > RECORD_MAX || len - off - RECORD_HEAD - RECORD_TAIL < size)
+			break;
+		if ((buf[off + 4] != WAL_INSERT && buf[off + 4] != WAL_REMOVE) ||
+			get_u32(buf + off + RECORD_HEAD + size) != checksum(buf + off + 4, 1 + size))
+			break;
+		if (replay(wal, buf[off + 4], buf + off + RECORD_HEAD, size) != 0) {
+			r = -1;
+			break;
+		}
+		off += RECORD_HEAD + size + RECORD_TAIL;
+		wal->log_records++;
+	}
+
+	*end = off;
+	return r;
+}
+
+static char *ckpt_path(const char *path, const char *ext)
+{
+	char *p = malloc(strlen(path) + strlen(ext) + 1);
+	if (p == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	strcpy(p, path);
+	strcat(p, ext);
+	return p;
+}
+
+/* Load '<path>.ckpt' if exists, returns its generation, 0 if none, -1 on error. */
+static int64_t load_checkpoint(rbwal_t *wal)
+{
+	unsigned char *buf;
+	size_t len, end;
+	char *path;
+	int64_t generation;
+	int fd, r;
+
+	if ((path = ckpt_path(wal->path, ".ckpt")) == NULL)
+		return -1;
+	fd = open(path, O_RDONLY | O_BINARY);
+	free(path);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	buf = read_all(fd, &len);
+	close(fd);
+	if (buf == NULL)
+		return -1;
+
+	if (len < HEADER_SIZE || memcmp(buf, CKPT_MAGIC, MAGIC_SIZE) != 0) {
+		free(buf);
+		errno = EINVAL;
+		return -1;
+	}
+
+	generation = (int64_t)get_u64(buf + MAGIC_SIZE);
+	r = replay_all(wal, buf, len, &end);
+	free(buf);
+	wal->log_records = 0;
+	if (r != 0)
+		return -1;
+
+	/* written by rename, so a short one is not a torn tail */
+	if (end != len) {
+		errno = EINVAL;
+		return -1;
+	}
+	return generation;
+}
+
+/* Truncate the log to an empty one of 'generation'. */
+static int reset_log(rbwal_t *wal, uint64_t generation)
+{
+	char header[HEADER_SIZE];
+
+	memcpy(header, LOG_MAGIC, MAGIC_SIZE);
+	put_u64((unsigned char *)header + MAGIC_SIZE, generation);
+
+	if (ftruncate(wal->fd, 0) != 0 ||
+		lseek(wal->fd, 0, SEEK_SET) != 0 ||
+		write_all(wal->fd, header, HEADER_SIZE) != HEADER_SIZE ||
+		fsync(wal->fd) != 0) {
+		wal->failed = errno;
+		return -1;
+	}
+
+	wal->generation = generation;
+	wal->log_records = 0;
+	wal->pending = 0;
+	wal->failed = 0;
+	return 0;
+}
+
+static int recover(rbwal_t *wal)
+{
+	unsigned char *buf;
+	size_t len, end;
+	int64_t ckpt;
+	uint64_t generation;
+	int r;
+
+	if ((ckpt = load_checkpoint(wal)) < 0)
+		return -1;
+
+	if ((buf = read_all(wal->fd, &len)) == NULL)
+		return -1;
+
+	if (len < HEADER_SIZE) {
+		/* new log, or crashed while writing the header */
+		free(buf);
+		return reset_log(wal, (uint64_t)ckpt);
+	}
+
+	if (memcmp(buf, LOG_MAGIC, MAGIC_SIZE) != 0) {
+		free(buf);
+		errno = EINVAL;
+		return -1;
+	}
+
+	generation = get_u64(buf + MAGIC_SIZE);
+	if (generation < (uint64_t)ckpt) {
+		/* crashed after the checkpoint, before truncating the log */
+		free(buf);
+		return reset_log(wal, (uint64_t)ckpt);
+	}
+	if (generation > (uint64_t)ckpt) {
+		/* the checkpoint which the log continues is lost */
+		free(buf);
+		errno = EINVAL;
+		return -1;
+	}
+
+	wal->generation = generation;
+	r = replay_all(wal, buf, len, &end);
+	free(buf);
+	if (r != 0)
+		return -1;
+
+	/* removed and replaced nodes of a lazy tree are still linked */
+	if (wal->tree->flags & RBTREE_LAZY_DELETE)
+		rbtree_purge(wal->tree, 0, purge_node, wal);
+
+	if (end != len) {
+		/* drop the torn tail */
+		if (ftruncate(wal->fd, (long)end) != 0)
+			return -1;
+	}
+
+	return lseek(wal->fd, (long)end, SEEK_SET) == (long)end ? 0 : -1;
+}
+
+int rbwal_open(rbwal_t *wal, rbtree_t *tree, const char *path,
+	rbwal_encode_func_t encode, rbwal_decode_func_t decode,
+	rbnode_free_func_t free_node, void *state)
+{
+	int err;
+
+	memset(wal, 0, sizeof(rbwal_t));
+	wal->tree = tree;
+	wal->encode = encode;
+	wal->decode = decode;
+	wal->free_node = free_node;
+	wal->state = state;
+	wal->group = RBWAL_GROUP_DEFAULT;
+	wal->checkpoint_interval = RBWAL_CHECKPOINT_DEFAULT;
+
+	if ((wal->path = ckpt_path(path, "")) == NULL)
+		return -1;
+
+	wal->fd = open(path, O_RDWR | O_CREAT | O_BINARY, 0644);
+	if (wal->fd < 0) {
+		err = errno;
+		free(wal->path);
+		errno = err;
+		return -1;
+	}
+
+	if (recover(wal) != 0) {
+		err = errno;
+		close(wal->fd);
+		free(wal->path);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int rbwal_close(rbwal_t *wal)
+{
+	int r;
+
+	r = rbwal_sync(wal);
+	if (close(wal->fd) != 0)
+		r = -1;
+	free(wal->buf);
+	free(wal->path);
+	wal->buf = wal->path = NULL;
+	wal->fd = -1;
+	return r;
+}
+
+int rbwal_sync(rbwal_t *wal)
+{
+	if (flush_log(wal) != 0)
+		return -1;
+
+	/* after a failed fsync the written pages may be dropped, and
+	the next fsync would succeed without them */
+	if (wal->failed) {
+		errno = wal->failed;
+		return -1;
+	}
+
+	if (wal->pending > 0) {
+		if (fsync(wal->fd) != 0) {
+			wal->failed = errno;
+			return -1;
+		}
+		wal->pending = 0;
+		wal->syncs++;
+	}
+
+	return 0;
+}
+
+/* Count one appended record, sync or checkpoint when it's time. */
+static int appended(rbwal_t *wal)
+{
+	wal->pending++;
+	wal->log_records++;
+
+	if (wal->checkpoint_interval > 0 && wal->log_records >= wal->checkpoint_interval)
+		return rbwal_checkpoint(wal);
+
+	if (wal->group > 0 && wal->pending >= wal->group)
+		return rbwal_sync(wal);
+
+	if (wal->len >= FLUSH_SIZE)
+		return flush_log(wal);
+
+	return 0;
+}
+
+int rbwal_insert(rbwal_t *wal, rbnode_t *n)
+{
+	size_t len = wal->len;
+
+	/* buffer the record first, dropping it is easier than undoing
+	the insert (a revived tombstone can't be restored) */
+	if (buf_record(wal, WAL_INSERT, n->key) != 0)
+		return -1;
+
+	if (rbtree_insert(wal->tree, n) != 0) {
+		wal->len = len;
+		return -1;
+	}
+
+	return appended(wal) == 0 ? 0 : RBWAL_NOT_DURABLE;
+}
+
+int rbwal_remove(rbwal_t *wal, rbnode_t *n)
+{
+	if (buf_record(wal, WAL_REMOVE, n->key) != 0)
+		return -1;
+
+	rbtree_remove(wal->tree, n);
+
+	return appended(wal) == 0 ? 0 : RBWAL_NOT_DURABLE;
+}
+
+int rbwal_sync_dir(const char *path)
+{
+#ifdef _WIN32
+	return 0;
+#else
+	char *dir, *p;
+	int fd, r;
+
+	if ((dir = ckpt_path(path, "")) == NULL)
+		return -1;
+	p = strrchr(dir, '/');
+	if (p == NULL)
+		strcpy(dir, ".");
+	else if (p == dir)
+		p[1] = '\0';
+	else
+		*p = '\0';
+
+	fd = open(dir, O_RDONLY);
+	free(dir);
+	if (fd < 0)
+		return -1;
+	r = fsync(fd);
+	close(fd);
+	return r;
+#endif
+}
+
+int rbwal_checkpoint(rbwal_t *wal)
+{
+	char *tmp = NULL, *path = NULL;
+	rbnode_t *n;
+	int fd = -1, err;
+
+	/* the log stays complete if the checkpoint fails, after a failed
+	fsync only a checkpoint makes the updates durable again */
+	if (rbwal_sync(wal) != 0 && (wal->len > 0 || !wal->failed))
+		return -1;
+
+	if ((tmp = ckpt_path(wal->path, ".ckpt.tmp")) == NULL ||
+		(path = ckpt_path(wal->path, ".ckpt")) == NULL)
+		goto error;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (fd < 0)
+		goto error;
+
+	if (buf_reserve(wal, HEADER_SIZE) != 0)
+		goto error;
+	buf_header(wal, CKPT_MAGIC, wal->generation + 1);
+
+	for (n = rbtree_first(wal->tree); n != NULL; n = rbtree_next(wal->tree, n)) {
+		if (buf_record(wal, WAL_INSERT, n->key) != 0)
+			goto error;
+		if (wal->len >= FLUSH_SIZE) {
+			if (write_all(fd, wal->buf, wal->len) != wal->len)
+				goto error;
+			wal->len = 0;
+		}
+	}
+
+	if (write_all(fd, wal->buf, wal->len) != wal->len || fsync(fd) != 0)
+		goto error;
+	wal->len = 0;
+	close(fd);
+	fd = -1;
+
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(tmp, path) != 0 || rbwal_sync_dir(path) != 0)
+		goto error;
+
+	free(tmp);
+	free(path);
+
+	if (reset_log(wal, wal->generation + 1) != 0)
+		return -1;
+
+	wal->checkpoints++;
+	return 0;
+
+error:
+	err = errno;
+	wal->len = 0;
+	if (fd >= 0) {
+		close(fd);
+		remove(tmp);
+	}
+	free(tmp);
+	free(path);
+	errno = err;
+	return -1;
+}
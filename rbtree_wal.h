@@ -0,0 +1,130 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef RBTREE_WAL_H_
+#define RBTREE_WAL_H_
+
+#include <stdint.h>
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Write-ahead log of a tree.
+Every insert/remove appends one small binary record to '<path>', records
+are written and fsync'ed in groups (group commit), so a durable update
+costs a share of one sequential write instead of a rewrite of the tree.
+A checkpoint writes all keys to '<path>.ckpt' (via a temporary file and
+rename) and truncates the log; recovery loads the checkpoint and replays
+the log on it, a torn record at the end of the log is dropped.
+
+Record: u32 payload size, u8 op, payload, u32 checksum of op and payload,
+all little-endian. Both files start with a 8 bytes magic and a u64
+generation, which tells whether the log is newer than the checkpoint. */
+
+#define RBWAL_GROUP_DEFAULT			32
+
+/* Returned by rbwal_insert() and rbwal_remove() when the tree was
+updated and the record buffered, but writing, syncing or checkpointing
+the log failed (errno is set). The update is not known to be durable,
+the records not written yet are written by the next rbwal_sync().
+After a failed fsync, rbwal_sync() keeps failing until rbwal_checkpoint()
+succeeds, as the kernel may have dropped the written pages. */
+#define RBWAL_NOT_DURABLE			1
+#define RBWAL_CHECKPOINT_DEFAULT	100000
+
+typedef struct rbwal_t rbwal_t;
+
+/* Serialize 'key' into 'buf' of 'size' bytes.
+Returns the encoded size (when greater than 'size', the function
+is called again with a larger buffer), or -1 on error. */
+typedef int (*rbwal_encode_func_t)(const void *key, void *buf, size_t size, void *state);
+
+/* Create a node from an encoded key, returns NULL on error. */
+typedef rbnode_t *(*rbwal_decode_func_t)(const void *buf, size_t size, void *state);
+
+struct rbwal_t {
+	rbtree_t *tree;
+	rbwal_encode_func_t encode;
+	rbwal_decode_func_t decode;
+	rbnode_free_func_t free_node;	/* frees decoded nodes which are not used */
+	void *state;
+
+	int fd;
+	char *path;
+	uint64_t generation;
+
+	char *buf;				/* records not written yet */
+	size_t len;
+	size_t cap;
+
+	size_t pending;			/* records since the last sync */
+	size_t group;			/* sync after this many records, 0 only by rbwal_sync() */
+	size_t log_records;		/* records in the log since the last checkpoint */
+	size_t checkpoint_interval;	/* checkpoint after this many log records, 0 never */
+	size_t syncs;
+	size_t checkpoints;
+	int failed;				/* errno of a failed fsync or log reset, cleared by a checkpoint */
+};
+
+/* Open (or create) the log at 'path' and recover 'tree' from it,
+'tree' should be empty. 'free_node' may be NULL if decoded nodes
+need no freeing. A RBTREE_LAZY_DELETE tree is purged after the replay.
+Returns 0 on success, otherwise -1 and errno is set. */
+int rbwal_open(rbwal_t *wal, rbtree_t *tree, const char *path,
+	rbwal_encode_func_t encode, rbwal_decode_func_t decode,
+	rbnode_free_func_t free_node, void *state);
+
+/* Flush and close the log, the tree is left as is. */
+int rbwal_close(rbwal_t *wal);
+
+/* rbtree_insert() and log it.
+Returns 0 on success, RBWAL_NOT_DURABLE if 'n' is in the tree but the
+log failed, otherwise -1 and errno is set, and 'n' is not in the tree. */
+int rbwal_insert(rbwal_t *wal, rbnode_t *n);
+
+/* Log the removal of 'n' and rbtree_remove() it,
+the node is left to the caller. In a RBTREE_LAZY_DELETE tree it
+stays linked as a tombstone until rbtree_purge().
+Returns 0 on success, RBWAL_NOT_DURABLE if 'n' is removed but the log
+failed, otherwise -1 and errno is set, and 'n' is still in the tree. */
+int rbwal_remove(rbwal_t *wal, rbnode_t *n);
+
+/* Write the pending records and fsync the log,
+all updates before are durable when it returns 0. */
+int rbwal_sync(rbwal_t *wal);
+
+/* Snapshot the tree to '<path>.ckpt' and truncate the log. */
+int rbwal_checkpoint(rbwal_t *wal);
+
+/* Fsync the directory of 'path', so that a file renamed to 'path'
+stays there after a crash. Does nothing on Windows. */
+int rbwal_sync_dir(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
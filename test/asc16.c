@@ -29,8 +29,8 @@
 
 void asc16_free(asc16_t *asc16)
 {
-	if (asc16 != NULL) {
-		free(asc16->data);
+	if (asc16 != NULL && asc16->data != (const char *)asc16_font) {
+		free((char *)asc16->data);
 	}
 }
 
@@ -82,24 +82,32 @@ int asc16_load(asc16_t *asc16, const char *filename)
 {
 	FILE *pf;
 	int size;
+	char *data;
 
 	pf = fopen(filename, "rb");
 	if (pf == NULL)
 		return -1;
 
-	size = file_readall(pf, &asc16->data);
+	size = file_readall(pf, &data);
 	
 	fclose(pf);
 
 	if (size == -1)
 		return -1;
 
+	asc16->data = data;
 	asc16->size = size;
 
 	return 0;
 }
 
-void asc16_gylph_print(char *d)
+void asc16_builtin(asc16_t *asc16)
+{
+	asc16->data = (const char *)asc16_font;
+	asc16->size = asc16_font_size;
+}
+
+void asc16_gylph_print(const char *d)
 {
 	int i, j;
 	for (j = 0; j < ASC16_GYLPH_HEIGHT; j++, d++) {
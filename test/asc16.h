@@ -35,7 +35,7 @@ extern "C" {
 #define ASC16_ADVANCE		8	/* ַǰȡ磬 A 󣬺 10 غ󣬻һַ B */
 
 typedef struct asc16_t {
-	char *data;
+	const char *data;
 	int size;
 } asc16_t;
 
@@ -53,11 +53,18 @@ typedef struct asc16_t {
 
 #define asc16_gylph_data(asc16, ch) ((asc16)->data + (ASC16_GYLPH_SIZE * (ch)))
 
+/* The font compiled in from ASC16, see asc16gen.c. */
+extern const unsigned char asc16_font[];
+extern const int asc16_font_size;
+
 void asc16_free(asc16_t *asc16);
 
 int asc16_load(asc16_t *asc16, const char *filename);
 
-void asc16_gylph_print(char *d);
+/* Use the compiled in font, without reading or copying it. */
+void asc16_builtin(asc16_t *asc16);
+
+void asc16_gylph_print(const char *d);
 
 #ifdef __cplusplus
 }
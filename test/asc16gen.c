@@ -0,0 +1,94 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/* Build step: converts the ASC16 font file into C source,
+so that the font is compiled into the binary.
+
+	asc16gen ASC16 asc16_font.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define BYTES_PER_LINE	12
+
+static int gen(FILE *in, FILE *out)
+{
+	int c, n = 0;
+
+	fprintf(out, "/* Generated from ASC16 by asc16gen, do not edit. */\n\n");
+	fprintf(out, "#include \"asc16.h\"\n\n");
+	fprintf(out, "const unsigned char asc16_font[] = {");
+	while ((c = getc(in)) != EOF) {
+		fprintf(out, "%s0x%02x,", n % BYTES_PER_LINE ? " " : "\n\t", c);
+		n++;
+	}
+	if (ferror(in))
+		return -1;
+	if (n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	fprintf(out, "\n};\n\n");
+	fprintf(out, "const int asc16_font_size = sizeof(asc16_font);\n");
+	return ferror(out) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *in, *out;
+	int r;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <font> <output.c>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	out = fopen(argv[2], "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		fclose(in);
+		return EXIT_FAILURE;
+	}
+
+	r = gen(in, out);
+	fclose(in);
+	if (fclose(out) != 0)
+		r = -1;
+	if (r != 0) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		remove(argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BENCH_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_RDTSC
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "bench.h"
+#include "bitmap.h"
+
+#define OVERHEAD_SAMPLES	1000
+
+static inline uint64_t ticks()
+{
+#if defined(BENCH_RDTSC)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t v;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#elif defined(_WIN32)
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return (uint64_t)t.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+double bench_seconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, t;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+void bench_hist_init(bench_hist_t *hist)
+{
+	memset(hist, 0, sizeof(bench_hist_t));
+}
+
+/* Values below 2 * BENCH_HIST_SUB have a bucket each, above that
+the buckets of [SUB << k, SUB << (k + 1)) are 2^k wide. */
+static inline int hist_index(uint64_t v)
+{
+	int k;
+	for (k = 0; (v >> k) >= 2 * BENCH_HIST_SUB; k++);
+	return k * BENCH_HIST_SUB + (int)(v >> k);
+}
+
+static inline uint64_t hist_highest(int index)
+{
+	int k = index < 2 * BENCH_HIST_SUB ? 0 : index / BENCH_HIST_SUB - 1;
+	return ((uint64_t)(index - k * BENCH_HIST_SUB) << k) + ((uint64_t)1 << k) - 1;
+}
+
+void bench_hist_record(bench_hist_t *hist, uint64_t v)
+{
+	hist->counts[hist_index(v)]++;
+	hist->total++;
+	if (hist->max < v)
+		hist->max = v;
+}
+
+uint64_t bench_hist_percentile(const bench_hist_t *hist, double percentile)
+{
+	uint64_t rank, seen = 0, v;
+	int i;
+
+	if (hist->total == 0)
+		return 0;
+	rank = (uint64_t)(percentile / 100 * hist->total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > hist->total)
+		rank = hist->total;
+
+	for (i = 0; i < BENCH_HIST_SIZE; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			v = hist_highest(i);
+			return v < hist->max ? v : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = ptoi(a), y = ptoi(b);
+	return x < y ? -1 : x > y;
+}
+
+/* xorshift64*, the same keys on every run */
+static inline uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static void shuffle(int *a, int n, uint64_t *state)
+{
+	int i, j, t;
+	for (i = n - 1; i > 0; i--) {
+		j = (int)(next_random(state) % (uint64_t)(i + 1));
+		t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+/* The least time of an empty measurement. */
+static uint64_t timer_overhead()
+{
+	uint64_t t0, t1, min = UINT64_MAX;
+	int i;
+	for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+		t0 = ticks();
+		t1 = ticks();
+		if (min > t1 - t0)
+			min = t1 - t0;
+	}
+	return min;
+}
+
+#define bench_record(hist, t0, t1, overhead) \
+	bench_hist_record((hist), (t1) - (t0) > (overhead) ? (t1) - (t0) - (overhead) : 0)
+
+int bench_run(bench_op_t op, int random, int n, bench_report_t *report)
+{
+	rbtree_t tree = RBTREE_INIT(keycmp);
+	rbnode_t *nodes;
+	int *order, i;
+	uint64_t state = 0x9e3779b97f4a7c15ULL, overhead, t0, t1, start, end;
+	double wall;
+
+	if (n <= 0 || (op != BENCH_INSERT && op != BENCH_FIND && op != BENCH_DELETE)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nodes = calloc(n, sizeof(rbnode_t));
+	order = malloc(n * sizeof(int));
+	if (nodes == NULL || order == NULL) {
+		free(nodes);
+		free(order);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* node 'i' has key 'i' */
+	for (i = 0; i < n; i++) {
+		nodes[i].key = itop(i);
+		order[i] = i;
+	}
+
+	if (op != BENCH_INSERT) {
+		shuffle(order, n, &state);
+		for (i = 0; i < n; i++)
+			rbtree_insert(&tree, nodes + order[i]);
+		for (i = 0; i < n; i++)
+			order[i] = i;
+	}
+	if (random)
+		shuffle(order, n, &state);
+
+	bench_hist_init(&report->hist);
+	overhead = timer_overhead();
+
+	wall = bench_seconds();
+	start = ticks();
+	switch (op) {
+	case BENCH_INSERT:
+		for (i = 0; i < n; i++) {
+			t0 = ticks();
+			rbtree_insert(&tree, nodes + order[i]);
+			t1 = ticks();
+			bench_record(&report->hist, t0, t1, overhead);
+		}
+		break;
+	case BENCH_FIND:
+		for (i = 0; i < n; i++) {
+			t0 = ticks();
+			rbtree_lookup(&tree, itop(order[i]));
+			t1 = ticks();
+			bench_record(&report->hist, t0, t1, overhead);
+		}
+		break;
+	case BENCH_DELETE:
+		for (i = 0; i < n; i++) {
+			t0 = ticks();
+			rbtree_remove(&tree, nodes + order[i]);
+			t1 = ticks();
+			bench_record(&report->hist, t0, t1, overhead);
+		}
+		break;
+	}
+	end = ticks();
+	wall = bench_seconds() - wall;
+
+	report->ops = n;
+	report->secs = wall;
+	report->ns_per_tick = end > start ? wall * 1e9 / (end - start) : 1;
+
+	free(nodes);
+	free(order);
+	return 0;
+}
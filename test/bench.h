@@ -0,0 +1,86 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Latency benchmark of the tree operations, for the "bench" command.
+
+Every call is timed with the cycle counter (rdtsc on x86, cntvct_el0 on
+ARM64, the monotonic clock elsewhere), and the samples are counted in a
+log-linear histogram in the way of HdrHistogram: 2^BENCH_HIST_SUB_BITS
+linear buckets per power of two, so any value is kept within about 3%. */
+
+#define BENCH_HIST_SUB_BITS	5
+#define BENCH_HIST_SUB		(1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_SIZE		((64 - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB)
+
+typedef struct bench_hist_t {
+	uint64_t counts[BENCH_HIST_SIZE];
+	uint64_t total;
+	uint64_t max;
+} bench_hist_t;
+
+void bench_hist_init(bench_hist_t *hist);
+
+void bench_hist_record(bench_hist_t *hist, uint64_t v);
+
+/* The highest value equivalent to the one at 'percentile' (0-100). */
+uint64_t bench_hist_percentile(const bench_hist_t *hist, double percentile);
+
+typedef enum bench_op_t {
+	BENCH_INSERT,
+	BENCH_FIND,
+	BENCH_DELETE
+} bench_op_t;
+
+typedef struct bench_report_t {
+	size_t ops;
+	double secs;			/* wall time of the timed calls, with the timer */
+	double ns_per_tick;
+	bench_hist_t hist;		/* latencies in ticks, less the timer overhead */
+} bench_report_t;
+
+/* Time 'n' calls of 'op' on a private tree of int keys 0 to n-1,
+in random or ascending order. find and delete run on a tree
+filled in random order first. Returns 0 on success, otherwise -1
+and errno is set. */
+int bench_run(bench_op_t op, int random, int n, bench_report_t *report);
+
+/* Wall clock in seconds. */
+double bench_seconds();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
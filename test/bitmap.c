@@ -26,7 +26,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BITMAP_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BITMAP_SSE2
+#endif
 
 #include "bitmap.h"
 
@@ -36,29 +52,55 @@
 
 #define NIL_KEY				(-1)
 
+#define RENDER_TILE_SIZE	256
+#define RENDER_THREADS_MAX	64
+#define RENDER_MEMORY_MAX	(256 << 20)	/* whole images up to this many bytes of pixels */
+
 typedef struct rbnil_t {
 	rbpoint_t base;
 	dlitem_t dlentry;
 } rbnil_t;
 
 typedef struct draw_state_t {
-	int minX;
 	int maxValue;
 	int radius;
 	int advanceX, advanceY;
 
 	int bitmapW, bitmapH;
 
-	dllist_t *rows;
-	int rowcount;
+	rbpoint_t **points;	/* preorder, by level after sort_levels() */
+	size_t count, capacity;
+	size_t *levels;		/* points of level 'i' start at 'levels[i]' */
+	int depth;			/* number of levels */
 
 	int draw_nil;
 	dllist_t nils;
 
 	bitmap_t *bitmap;
-	asc16_t *asc16;
+	glyph_cache_t *glyphs;	/* keys in white, NULL without a font */
 } draw_state_t;
 
+/* Node of the tidy tree layout (Reingold-Tilford), parallel to 'points'.
+'offset' is the distance from the node to each of its children, in half
+node widths. The lowest node of a shallower subtree gets a thread
+('thread' set, 'left' or 'right' to the next node of the contour,
+'offset' away), so contours are walked in time of their height. */
+typedef struct tidy_t {
+	struct tidy_t *left, *right;
+	int offset;
+	int thread;
+} tidy_t;
+
+/* The leftmost or rightmost node on the lowest level of a subtree,
+'off' is relative to the subtree root. */
+typedef struct extreme_t {
+	tidy_t *node;
+	int off;
+	int level;
+} extreme_t;
+
+#define MIN_SEP				2	/* between neighbors, in half node widths */
+
 static rbnil_t *new_nil()
 {
 	rbnil_t *nil;
@@ -76,26 +118,19 @@ void free_nil(rbnil_t *nil)
 	free(nil);
 }
 
-static int add_row(draw_state_t *st, int rowindex, dlitem_t *item)
+static int add_point(draw_state_t *st, rbpoint_t *point)
 {
-	if (st->rowcount <= rowindex) {
-		dllist_t *rows;
-		int i;
-		rows = malloc((rowindex + 1) * sizeof(dllist_t));
-		if (rows == NULL)
+	if (st->count == st->capacity) {
+		size_t capacity = st->capacity ? st->capacity * 2 : 256;
+		rbpoint_t **points = realloc(st->points, capacity * sizeof(rbpoint_t *));
+		if (points == NULL)
 			return -1;
-		for (i = 0; i < st->rowcount; i++) {
-			dllist_init(rows + i);
-			dllist_add_list_to_tail(rows + i, st->rows + i);
-		}
-		for (; i <= rowindex; i++) {
-			dllist_init(rows + i);
-		}
-		free(st->rows);
-		st->rows = rows;
-		st->rowcount = rowindex + 1;
+		st->points = points;
+		st->capacity = capacity;
 	}
-	dllist_add(st->rows + rowindex, item);
+	/* 'x' holds the index until the layout is done */
+	point->x = (int)st->count;
+	st->points[st->count++] = point;
 	return 0;
 }
 
@@ -105,7 +140,9 @@ static void free_draw_state(draw_state_t *st)
 	rbnil_t *nil;
 
 	if (st) {
-		free(st->rows);
+		free(st->points);
+		free(st->levels);
+		glyph_cache_free(st->glyphs);
 		dllist_foreach(&st->nils, curr, next, rbnil_t, nil, dlentry) {
 			dllist_remove(curr);
 			if (rbnode_is_left(&nil->base.rbentry))
@@ -117,356 +154,1399 @@ static void free_draw_state(draw_state_t *st)
 	}
 }
 
-static int predraw(rbtree_t *tree, rbnode_t *n, void *state)
+static rbnode_t *add_nil(draw_state_t *st, rbnode_t *parent)
+{
+	rbnil_t *nil = new_nil();
+	if (nil == NULL)
+		return NULL;
+	nil->base.rbentry.parent = parent;
+	dllist_add(&st->nils, &nil->dlentry);
+	return &nil->base.rbentry;
+}
+
+/* Collect the points in preorder and their depths ('y'),
+hang NIL nodes under the tree when drawing them. */
+static int predraw(draw_state_t *st, rbnode_t *n, int depth)
 {
-	draw_state_t *st = state;
 	rbpoint_t *a = container_of(n, rbpoint_t, rbentry);
-	if (n->parent == NULL) {
-		st->minX = a->x = a->y = 0;
-		st->maxValue = ptoi(n->key);
+
+	a->y = depth;
+	if (st->depth <= depth)
+		st->depth = depth + 1;
+	if (ptoi(n->key) != NIL_KEY) {
+		if (st->count == 0 || st->maxValue < ptoi(n->key))
+			st->maxValue = ptoi(n->key);
+		if (st->draw_nil) {
+			if (rbnode_is_nil(n->left) && (n->left = add_nil(st, n)) == NULL)
+				return -1;
+			if (rbnode_is_nil(n->right) && (n->right = add_nil(st, n)) == NULL)
+				return -1;
+		}
+	}
+
+	if (add_point(st, a) != 0)
+		return -1;
+	if (!rbnode_is_nil(n->left) && predraw(st, n->left, depth + 1) != 0)
+		return -1;
+	if (!rbnode_is_nil(n->right) && predraw(st, n->right, depth + 1) != 0)
+		return -1;
+	return 0;
+}
+
+static inline int draw_key(draw_state_t *st, rbpoint_t *point)
+{
+	int key = ptoi(point->rbentry.key);
+	int w = bitmap_int_glyphs(key) * ASC16_ADVANCE;
+
+	return bitmap_draw_int(st->bitmap, key,
+		point->x - w / 2 + 1, point->y - ASC16_GYLPH_HEIGHT / 2 + 1,
+		st->glyphs);
+}
+
+static inline int draw_nil(bitmap_t *bitmap, int x, int y, glyph_cache_t *glyphs)
+{
+    int x0, y0, x1, y1;
+    x0 = x - (3 * ASC16_GYLPH_WIDTH / 2) - CIRCLE_PADDING;
+    y0 = y - (ASC16_GYLPH_HEIGHT / 2);
+    x1 = x0 + 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING + CIRCLE_PADDING;
+    y1 = y0 + ASC16_GYLPH_HEIGHT;
+    if (bitmap_draw_rect(bitmap, x0, y0, x1, y1, 1, COLOR_BLACK) != 0)
+        return -1;
+
+    if (bitmap_draw_glyphs(bitmap, "NIL", x0 + CIRCLE_PADDING + 1, y0 + 1, glyphs) != 0)
+        return -1;
+
+    return 0;
+}
+
+static inline int draw_rbnode(draw_state_t *st, rbpoint_t *point)
+{
+	if (ptoi(point->rbentry.key) == NIL_KEY) {
+        return draw_nil(st->bitmap, point->x, point->y, st->glyphs);
 	}
 	else {
-		rbpoint_t *p = container_of(n->parent, rbpoint_t, rbentry);
+		if (bitmap_draw_circle(st->bitmap,
+			point->x, point->y,
+			st->radius, 1,
+			rbnode_is_red(&point->rbentry) ? COLOR_RED : COLOR_BLACK) != 0)
+			return -1;
+
+		if (draw_key(st, point) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int get_radius(int value)
+{
+	int r = 1;
+
+	value /= 10;
+	while (value != 0) {
+		r++;
+		value /= 10;
+	}
+
+	if (r < 3)
+		r = 3;
+
+	r *= ASC16_ADVANCE;
+	r /= 2;
+
+	r += CIRCLE_PADDING;
+
+	return r;
+}
+
+static tidy_t *tidy_child(tidy_t *tidy, rbnode_t *n)
+{
+	if (rbnode_is_nil(n))
+		return NULL;
+	return tidy + container_of(n, rbpoint_t, rbentry)->x;
+}
 
-		if (rbnode_is_right(n)) {
-			a->x = p->x + 1;
-			if (st->maxValue < ptoi(n->key))
-				st->maxValue = ptoi(n->key);
+/* Post-order pass of the layout: place the subtrees of 't' as close as
+'MIN_SEP' allows on every level, by walking the right contour of the
+left subtree against the left contour of the right one, then thread the
+shallower contour to the deeper one. Returns the extremes of 't'. */
+static void tidy_setup(tidy_t *t, int level, extreme_t *lmost, extreme_t *rmost)
+{
+	extreme_t ll, lr, rl, rr;
+	tidy_t *l, *r;
+	int cursep, rootsep, loffsum, roffsum;
+
+	if (t->left == NULL && t->right == NULL) {
+		t->offset = 0;
+		lmost->node = rmost->node = t;
+		lmost->off = rmost->off = 0;
+		lmost->level = rmost->level = level;
+		return;
+	}
+
+	ll.level = lr.level = rl.level = rr.level = -1;
+	if (t->left != NULL)
+		tidy_setup(t->left, level + 1, &ll, &lr);
+	if (t->right != NULL)
+		tidy_setup(t->right, level + 1, &rl, &rr);
+
+	l = t->left;
+	r = t->right;
+	cursep = rootsep = MIN_SEP;
+	loffsum = roffsum = 0;
+	while (l != NULL && r != NULL) {
+		if (cursep < MIN_SEP) {
+			rootsep += MIN_SEP - cursep;
+			cursep = MIN_SEP;
+		}
+		/* down the right contour of the left subtree */
+		if (l->right != NULL) {
+			loffsum += l->offset;
+			cursep -= l->offset;
+			l = l->right;
+		}
+		else {
+			loffsum -= l->offset;
+			cursep += l->offset;
+			l = l->left;
+		}
+		/* down the left contour of the right subtree */
+		if (r->left != NULL) {
+			roffsum -= r->offset;
+			cursep -= r->offset;
+			r = r->left;
 		}
 		else {
-			a->x = p->x - 1;
-			if (st->minX > a->x)
-				st->minX = a->x;
+			roffsum += r->offset;
+			cursep += r->offset;
+			r = r->right;
 		}
-		a->y = p->y + 1;
 	}
 
-	if (st->draw_nil && ptoi(n->key) != NIL_KEY) {
-		if (rbnode_is_nil(n->left)) {
-			rbnil_t *nil = new_nil();
-			if (nil == NULL)
-				return -1;
-			nil->base.rbentry.parent = n;
-			n->left = &nil->base.rbentry;
-			dllist_add(&st->nils, &nil->dlentry);
-		}
+	t->offset = (rootsep + 1) / 2;
+	loffsum -= t->offset;
+	roffsum += t->offset;
 
-		if (rbnode_is_nil(n->right)) {
-			rbnil_t *nil = new_nil();
-			if (nil == NULL)
-				return -1;
-			nil->base.rbentry.parent = n;
-			n->right = &nil->base.rbentry;
-			dllist_add(&st->nils, &nil->dlentry);
-		}
+	if (rl.level > ll.level || t->left == NULL) {
+		*lmost = rl;
+		lmost->off += t->offset;
+	}
+	else {
+		*lmost = ll;
+		lmost->off -= t->offset;
+	}
+	if (lr.level > rr.level || t->right == NULL) {
+		*rmost = lr;
+		rmost->off -= t->offset;
+	}
+	else {
+		*rmost = rr;
+		rmost->off += t->offset;
 	}
 
+	if (l != NULL && l != t->left) {
+		/* the left subtree is deeper */
+		rr.node->thread = 1;
+		rr.node->offset = abs(rr.off + t->offset - loffsum);
+		if (loffsum - t->offset <= rr.off)
+			rr.node->left = l;
+		else
+			rr.node->right = l;
+	}
+	else if (r != NULL && r != t->right) {
+		ll.node->thread = 1;
+		ll.node->offset = abs(ll.off - t->offset - roffsum);
+		if (roffsum + t->offset >= ll.off)
+			ll.node->right = r;
+		else
+			ll.node->left = r;
+	}
+}
 
-	return add_row(st, a->y, &a->dlentry);
+/* Pre-order pass: absolute positions from the offsets. */
+static void tidy_petrify(draw_state_t *st, tidy_t *tidy, tidy_t *t, int x, int *minx)
+{
+	st->points[t - tidy]->x = x;
+	if (*minx > x)
+		*minx = x;
+	if (t->thread)
+		return;
+	if (t->left != NULL)
+		tidy_petrify(st, tidy, t->left, x - t->offset, minx);
+	if (t->right != NULL)
+		tidy_petrify(st, tidy, t->right, x + t->offset, minx);
 }
 
-static inline int draw_lines(draw_state_t *st)
+/* Lay out the tree in O(n) and set the bitmap size. */
+static int calc_xy(draw_state_t *st)
 {
-	int i;
-	dllist_t *list;
-	dlitem_t *curr, *next;
+	tidy_t *tidy;
+	extreme_t lmost, rmost;
 	rbpoint_t *point;
+	size_t i;
+	int w, h, minx = 0, left, spanX;
+
+	st->radius = get_radius(st->maxValue);
+	st->advanceX = (st->radius + CIRCLE_PADDING) * 2;
+	st->advanceY = (int)((float)st->advanceX * GOLDEN_RATIO);
+
+	w = h = 0;
+	if (st->count > 0) {
+		tidy = malloc(st->count * sizeof(tidy_t));
+		if (tidy == NULL)
+			return -1;
+		for (i = 0; i < st->count; i++) {
+			point = st->points[i];
+			tidy[i].left = tidy_child(tidy, point->rbentry.left);
+			tidy[i].right = tidy_child(tidy, point->rbentry.right);
+			tidy[i].thread = 0;
+		}
+		tidy_setup(tidy, 0, &lmost, &rmost);
+		tidy_petrify(st, tidy, tidy, 0, &minx);
+		free(tidy);
+	}
+
+	left = st->advanceX; /* left margin */
+	spanX = st->advanceX; /* between neighbors */
+	if (st->draw_nil) {
+		left += 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING * 2;
+		spanX += (3 * ASC16_GYLPH_WIDTH) / 2 + CIRCLE_PADDING;
+	}
+
+	for (i = 0; i < st->count; i++) {
+		point = st->points[i];
+		point->x = (point->x - minx) * spanX / MIN_SEP + left;
+		point->y = point->y * st->advanceY + st->advanceX; /* top margin */
+		if (w < point->x)
+			w = point->x;
+		if (h < point->y)
+			h = point->y;
+	}
+
+	w += st->advanceX;  /* right margin */
+	h += st->advanceX; /* bottom margin */
+
+	if (st->draw_nil) {
+		w += 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING * 2;
+		h += st->advanceY - (st->radius - ASC16_GYLPH_HEIGHT);
+	}
+
+
+	st->bitmapW = w;
+	st->bitmapH = h;
+
+	return 0;
+}
+
+/* Collect the points of 'tree' and lay them out. */
+static int layout_tree(draw_state_t *st, rbtree_t *tree, asc16_t *asc16, int nil)
+{
+	st->draw_nil = nil;
+	dllist_init(&st->nils);
+
+	/* expanded before drawing, the threads only read it */
+	if (asc16 != NULL && (st->glyphs = glyph_cache_new(asc16, COLOR_WHITE)) == NULL)
+		return -1;
+
+	if (!rbnode_is_nil(tree->root) && predraw(st, tree->root, 0) != 0)
+		return -1;
+
+	return calc_xy(st);
+}
+
+bitmap_t *rbtree_save_as_bitmap(rbtree_t *tree, asc16_t *asc16, int nil)
+{
+	return rbtree_render_bitmap(tree, asc16, nil, 0);
+}
+
+/* Reorder the points by level (counting sort, stable). */
+static int sort_levels(draw_state_t *st)
+{
+	rbpoint_t **points;
+	size_t i, *next;
+	int d;
+
+	st->levels = calloc(st->depth + 1, sizeof(size_t));
+	points = malloc((st->count + 1) * sizeof(rbpoint_t *));
+	next = malloc((st->depth + 1) * sizeof(size_t));
+	if (st->levels == NULL || points == NULL || next == NULL) {
+		free(points);
+		free(next);
+		return -1;
+	}
+
+	for (i = 0; i < st->count; i++)
+		st->levels[(st->points[i]->y - st->advanceX) / st->advanceY + 1]++;
+	for (d = 0; d < st->depth; d++)
+		st->levels[d + 1] += st->levels[d];
+	memcpy(next, st->levels, (st->depth + 1) * sizeof(size_t));
+	for (i = 0; i < st->count; i++)
+		points[next[(st->points[i]->y - st->advanceX) / st->advanceY]++] = st->points[i];
+
+	free(next);
+	free(st->points);
+	st->points = points;
+	return 0;
+}
+
+/* Draw what of levels 'first' to 'last' falls into the band
+(the lines to their parents first, then the nodes). */
+static int draw_levels(draw_state_t *st, int first, int last)
+{
+	rbpoint_t *point, *parent;
+	size_t i;
+
+	for (i = st->levels[first]; i < st->levels[last + 1]; i++) {
+		point = st->points[i];
+		if (rbnode_is_root(&point->rbentry))
+			continue;
+		parent = container_of(point->rbentry.parent, rbpoint_t, rbentry);
+		if (bitmap_draw_line(st->bitmap,
+			parent->x, parent->y,
+			point->x, point->y, LINE_COLOR) != 0)
+			return -1;
+	}
+
+	for (i = st->levels[first]; i < st->levels[last + 1]; i++) {
+		if (draw_rbnode(st, st->points[i]) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Levels reaching into rows 'y0' to 'y1' (exclusive): nodes stick out
+less than half a level, lines go up to the level above. */
+static int band_levels(draw_state_t *st, int y0, int y1, int *first, int *last)
+{
+	*first = (y0 - st->advanceX) / st->advanceY - 1;
+	*last = (y1 - st->advanceX) / st->advanceY + 1;
+	if (*first < 0)
+		*first = 0;
+	if (*last >= st->depth)
+		*last = st->depth - 1;
+	return *first <= *last;
+}
+
+#define BY_X		0	/* the point */
+#define BY_XMAX		1	/* the right end of the line to its parent */
+#define BY_XMIN		2	/* the left end of the line to its parent */
+
+static inline int point_key(rbpoint_t *point, int by)
+{
+	rbpoint_t *parent;
+
+	if (by == BY_X)
+		return point->x;
+	parent = container_of(point->rbentry.parent, rbpoint_t, rbentry);
+	if ((by == BY_XMAX) == (parent->x > point->x))
+		return parent->x;
+	return point->x;
+}
 
-	for (i = 0; i < st->rowcount; i++) {
-		list = st->rows + i;
-		dllist_foreach(list, curr, next, rbpoint_t, point, dlentry) {
-			if (!rbnode_is_root(&point->rbentry)) {
-				rbpoint_t *parent = container_of(point->rbentry.parent, rbpoint_t, rbentry);
-				if (bitmap_draw_line(st->bitmap,
-					parent->x, parent->y,
+/* First of the points 'lo' to 'hi' of a level with key 'by' >= 'x'.
+The points of a level are left to right, and so are their parents,
+so all three keys are ascending. */
+static size_t level_search(draw_state_t *st, size_t lo, size_t hi, int x, int by)
+{
+	size_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (point_key(st->points[mid], by) < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Draw the tile at ('col', 'row') into 'tile' and copy it into 'fb'. */
+static int render_tile(draw_state_t *st, bitmap_t *fb, bitmap_t *tile, int col, int row)
+{
+	draw_state_t local = *st;
+	rbpoint_t *point, *parent;
+	size_t i, lo, hi;
+	int d, first, last, m, j;
+
+	tile->x0 = col * RENDER_TILE_SIZE;
+	tile->y0 = row * RENDER_TILE_SIZE;
+	tile->cw = fb->w - tile->x0 < RENDER_TILE_SIZE ? fb->w - tile->x0 : RENDER_TILE_SIZE;
+	tile->ch = fb->h - tile->y0 < RENDER_TILE_SIZE ? fb->h - tile->y0 : RENDER_TILE_SIZE;
+	bitmap_fill(tile, COLOR_WHITE);
+	local.bitmap = tile;
+
+	if (band_levels(st, tile->y0, tile->y0 + tile->ch, &first, &last)) {
+		/* lines under the nodes, the root has none */
+		for (d = first > 0 ? first : 1; d <= last; d++) {
+			lo = level_search(st, st->levels[d], st->levels[d + 1], tile->x0, BY_XMAX);
+			hi = level_search(st, lo, st->levels[d + 1], tile->x0 + tile->cw, BY_XMIN);
+			for (i = lo; i < hi; i++) {
+				point = st->points[i];
+				parent = container_of(point->rbentry.parent, rbpoint_t, rbentry);
+				if (bitmap_draw_line(tile, parent->x, parent->y,
 					point->x, point->y, LINE_COLOR) != 0)
 					return -1;
 			}
 		}
+
+		m = st->advanceX + (3 * ASC16_GYLPH_WIDTH) / 2 + CIRCLE_PADDING;
+		for (d = first; d <= last; d++) {
+			lo = level_search(st, st->levels[d], st->levels[d + 1], tile->x0 - m, BY_X);
+			hi = level_search(st, lo, st->levels[d + 1], tile->x0 + tile->cw + m, BY_X);
+			for (i = lo; i < hi; i++) {
+				if (draw_rbnode(&local, st->points[i]) != 0)
+					return -1;
+			}
+		}
+	}
+
+	for (j = 0; j < tile->ch; j++) {
+		memcpy(fb->colors + (size_t)(tile->y0 + j) * fb->cw + tile->x0,
+			tile->colors + (size_t)j * tile->cw, tile->cw * sizeof(color_t));
 	}
 
 	return 0;
 }
 
-static inline int draw_key(draw_state_t *st, rbpoint_t *point)
+/* Tiles 'index', 'index + step', ... of a render, drawn by one thread. */
+typedef struct render_share_t {
+	draw_state_t *st;
+	bitmap_t *fb;
+	int index, step;
+	int cols, tiles;
+	int error;			/* errno of the failure, 0 if none */
+} render_share_t;
+
+static void render_share(render_share_t *sh)
 {
-	int w;
-	char *key;
+	bitmap_t tile;
+	int t;
 
-	key = keytostr(point->rbentry.key);
+	if (bitmap_init_view(&tile, sh->fb->w, sh->fb->h, 0, 0,
+		RENDER_TILE_SIZE, RENDER_TILE_SIZE, COLOR_WHITE) != 0) {
+		sh->error = errno ? errno : ENOMEM;
+		return;
+	}
 
-	w = strlen(key) * ASC16_ADVANCE;
+	for (t = sh->index; t < sh->tiles; t += sh->step) {
+		if (render_tile(sh->st, sh->fb, &tile, t % sh->cols, t / sh->cols) != 0) {
+			sh->error = errno ? errno : ERANGE;
+			break;
+		}
+	}
 
-	if (bitmap_draw_string(st->bitmap, key,
-		point->x - w / 2 + 1, point->y - ASC16_GYLPH_HEIGHT / 2 + 1,
-		COLOR_WHITE, st->asc16) != 0)
+	bitmap_free(&tile);
+}
+
+#ifdef _WIN32
+
+typedef HANDLE render_thread_t;
+
+static DWORD WINAPI render_main(LPVOID arg)
+{
+	render_share((render_share_t *)arg);
+	return 0;
+}
+
+static int render_start(render_thread_t *t, render_share_t *sh)
+{
+	*t = CreateThread(NULL, 0, render_main, sh, 0, NULL);
+	return *t == NULL ? -1 : 0;
+}
+
+static void render_join(render_thread_t t)
+{
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+
+static int cpu_count()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+}
+
+#else
+
+typedef pthread_t render_thread_t;
+
+static void *render_main(void *arg)
+{
+	render_share((render_share_t *)arg);
+	return NULL;
+}
+
+static int render_start(render_thread_t *t, render_share_t *sh)
+{
+	return pthread_create(t, NULL, render_main, sh) == 0 ? 0 : -1;
+}
+
+static void render_join(render_thread_t t)
+{
+	pthread_join(t, NULL);
+}
+
+static int cpu_count()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+#endif
+
+/* Draw the laid out tree of 'st' into 'bitmap' tile by tile.
+Returns 0, or -1 with errno set. */
+static int render_tiles(draw_state_t *st, bitmap_t *bitmap, int threads)
+{
+	render_share_t shares[RENDER_THREADS_MAX];
+	render_thread_t handles[RENDER_THREADS_MAX];
+	int started[RENDER_THREADS_MAX];
+	int i, cols, rows, err = 0;
+
+	cols = (st->bitmapW + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	rows = (st->bitmapH + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	if (threads <= 0)
+		threads = cpu_count();
+	if (threads > RENDER_THREADS_MAX)
+		threads = RENDER_THREADS_MAX;
+	if (threads > cols * rows)
+		threads = cols * rows > 0 ? cols * rows : 1;
+
+	for (i = 0; i < threads; i++) {
+		shares[i].st = st;
+		shares[i].fb = bitmap;
+		shares[i].index = i;
+		shares[i].step = threads;
+		shares[i].cols = cols;
+		shares[i].tiles = cols * rows;
+		shares[i].error = 0;
+		started[i] = i > 0 && render_start(&handles[i], &shares[i]) == 0;
+	}
+
+	/* this thread takes the first share, and those it could not start */
+	for (i = 0; i < threads; i++) {
+		if (!started[i])
+			render_share(&shares[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		if (started[i])
+			render_join(handles[i]);
+		if (shares[i].error != 0)
+			err = shares[i].error;
+	}
+
+	if (err != 0) {
+		errno = err;
 		return -1;
+	}
+	return 0;
+}
 
+bitmap_t *rbtree_render_bitmap(rbtree_t *tree, asc16_t *asc16, int nil, int threads)
+{
+	bitmap_t *bitmap;
+	draw_state_t st = { 0 };
+	int err;
+
+	bitmap = malloc(sizeof(bitmap_t));
+	if (bitmap == NULL)
+		return NULL;
+
+	memset(bitmap, 0, sizeof(bitmap_t));
+
+	if (layout_tree(&st, tree, asc16, nil) != 0 || sort_levels(&st) != 0 ||
+		bitmap_init(bitmap, st.bitmapW, st.bitmapH, COLOR_WHITE) != 0) {
+		free(bitmap);
+		free_draw_state(&st);
+		return NULL;
+	}
+
+	if (render_tiles(&st, bitmap, threads) != 0) {
+		err = errno;
+		bitmap_free(bitmap);
+		free(bitmap);
+		free_draw_state(&st);
+		errno = err;
+		return NULL;
+	}
+
+	free_draw_state(&st);
+	return bitmap;
+}
+
+int rbtree_write_bitmap(rbtree_t *tree, asc16_t *asc16, int nil, int threads, FILE *pf)
+{
+	draw_state_t st = { 0 };
+	bitmap_t band = { 0 };
+	unsigned char *rows = NULL;
+	size_t stride;
+	int y0, n, first, last, r = -1;
+
+	if (layout_tree(&st, tree, asc16, nil) != 0 || sort_levels(&st) != 0)
+		goto out;
+
+	/* small enough to be drawn whole, by all the threads */
+	if (threads != 1 &&
+		(double)st.bitmapW * st.bitmapH * sizeof(color_t) <= RENDER_MEMORY_MAX) {
+		if (bitmap_init(&band, st.bitmapW, st.bitmapH, COLOR_WHITE) == 0 &&
+			render_tiles(&st, &band, threads) == 0 &&
+			bitmap_print(&band, pf) == 0)
+			r = 0;
+		goto out;
+	}
+
+	if (bitmap_write_header(st.bitmapW, st.bitmapH, pf) != 0)
+		goto out;
+
+	/* one level of nodes per band */
+	n = st.advanceY;
+	if (bitmap_init_view(&band, st.bitmapW, st.bitmapH, 0, 0, st.bitmapW, n, COLOR_WHITE) != 0)
+		goto out;
+	stride = bitmap_stride(st.bitmapW);
+	rows = malloc(stride * n);
+	if (rows == NULL)
+		goto out;
+	st.bitmap = &band;
+
+	/* the file starts with the bottom row */
+	for (y0 = (st.bitmapH - 1) / n * n; y0 >= 0; y0 -= n) {
+		band.y0 = y0;
+		band.ch = st.bitmapH - y0 < n ? st.bitmapH - y0 : n;
+		bitmap_fill(&band, COLOR_WHITE);
+
+		if (band_levels(&st, y0, y0 + band.ch, &first, &last) &&
+			draw_levels(&st, first, last) != 0)
+			goto out;
+
+		bitmap_encode_rows(&band, rows, stride);
+		if (fwrite(rows, stride, band.ch, pf) != (size_t)band.ch)
+			goto out;
+	}
+	r = 0;
+
+out:
+	free(rows);
+	bitmap_free(&band);
+	free_draw_state(&st);
+	return r;
+}
+
+/* Node of a pyramid, in preorder: the subtree of node 'i' is
+nodes 'i' to 'i + size - 1', its left child (if any) is 'i + 1'. */
+typedef struct pyrnode_t {
+	int x, y;
+	int key;
+	int red;
+	int right;			/* index of the right child, or -1 */
+	int has_left;
+	int xmin, xmax;		/* subtree extent, node centers */
+	int ymax;
+	int size, reds;		/* subtree nodes, red ones */
+} pyrnode_t;
+
+struct rblayout_t {
+	pyrnode_t *nodes;
+	int count;
+	int depth;
+	int radius;
+	int margin;			/* from a center to the edge of what's drawn for it */
+	glyph_cache_t *glyphs;
+};
+
+/* Copy the layout out of 'st', with subtree summaries. */
+static int pyramid_layout(struct rblayout_t *lt, draw_state_t *st)
+{
+	pyrnode_t *nodes, *nd, *c;
+	rbpoint_t *point;
+	int i;
+
+	if (st->count > (size_t)INT_MAX) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	nodes = malloc((st->count + 1) * sizeof(pyrnode_t));
+	if (nodes == NULL)
+		return -1;
+
+	for (i = (int)st->count - 1; i >= 0; i--) {
+		point = st->points[i];
+		nd = nodes + i;
+		nd->x = nd->xmin = nd->xmax = point->x;
+		nd->y = nd->ymax = point->y;
+		nd->key = ptoi(point->rbentry.key);
+		nd->red = nd->key != NIL_KEY && rbnode_is_red(&point->rbentry);
+		nd->has_left = !rbnode_is_nil(point->rbentry.left);
+		nd->size = 1;
+		nd->reds = nd->red;
+		nd->right = -1;
+		if (nd->has_left) {
+			c = nodes + i + 1;
+			nd->size += c->size;
+			nd->reds += c->reds;
+			nd->xmin = c->xmin;
+			if (nd->ymax < c->ymax)
+				nd->ymax = c->ymax;
+		}
+		if (!rbnode_is_nil(point->rbentry.right)) {
+			nd->right = i + nd->size;
+			c = nodes + nd->right;
+			nd->size += c->size;
+			nd->reds += c->reds;
+			nd->xmax = c->xmax;
+			if (nd->ymax < c->ymax)
+				nd->ymax = c->ymax;
+		}
+	}
+
+	lt->nodes = nodes;
+	lt->count = (int)st->count;
+	lt->depth = st->depth;
+	lt->radius = st->radius;
+	lt->margin = st->advanceX + (3 * ASC16_GYLPH_WIDTH) / 2 + CIRCLE_PADDING;
+	lt->glyphs = st->glyphs;
+	st->glyphs = NULL;
 	return 0;
 }
 
-static inline int draw_nil(bitmap_t *bitmap, int x, int y, asc16_t *asc16)
+int rbpyramid_init(rbpyramid_t *pyr, rbtree_t *tree, asc16_t *asc16, int nil, int tile)
 {
-    int x0, y0, x1, y1;
-    x0 = x - (3 * ASC16_GYLPH_WIDTH / 2) - CIRCLE_PADDING;
-    y0 = y - (ASC16_GYLPH_HEIGHT / 2);
-    x1 = x0 + 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING + CIRCLE_PADDING;
-    y1 = y0 + ASC16_GYLPH_HEIGHT;
-    if (bitmap_draw_rect(bitmap, x0, y0, x1, y1, 1, COLOR_BLACK) != 0)
-        return -1;
+	draw_state_t st = { 0 };
+	struct rblayout_t *lt;
+	int k, r;
 
-    if (bitmap_draw_string(bitmap, "NIL", x0 + CIRCLE_PADDING + 1, y0 + 1, COLOR_WHITE, asc16) != 0)
-        return -1;
+	if (tile <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
 
-    return 0;
+	lt = malloc(sizeof(struct rblayout_t));
+	if (lt == NULL)
+		return -1;
+
+	r = layout_tree(&st, tree, asc16, nil);
+	if (r == 0)
+		r = pyramid_layout(lt, &st);
+	free_draw_state(&st);
+	if (r != 0) {
+		free(lt);
+		return -1;
+	}
+
+	pyr->w = st.bitmapW;
+	pyr->h = st.bitmapH;
+	pyr->tile = tile;
+	pyr->layout = lt;
+
+	/* halve the larger side down to a pixel */
+	for (k = 0; k < 30 && (1 << k) < (pyr->w > pyr->h ? pyr->w : pyr->h); k++);
+	pyr->levels = k + 1;
+
+	return 0;
 }
 
-static inline int draw_rbnode(draw_state_t *st, rbpoint_t *point)
+void rbpyramid_free(rbpyramid_t *pyr)
 {
-	if (ptoi(point->rbentry.key) == NIL_KEY) {
-        return draw_nil(st->bitmap, point->x, point->y, st->asc16);
+	if (pyr != NULL && pyr->layout != NULL) {
+		free(pyr->layout->nodes);
+		glyph_cache_free(pyr->layout->glyphs);
+		free(pyr->layout);
+		pyr->layout = NULL;
 	}
-	else {
-		if (bitmap_draw_circle(st->bitmap,
-			point->x, point->y,
-			st->radius, 1,
-			rbnode_is_red(&point->rbentry) ? COLOR_RED : COLOR_BLACK) != 0)
-			return -1;
+}
 
-		if (draw_key(st, point) != 0)
+void rbpyramid_level_size(rbpyramid_t *pyr, int level, int *w, int *h)
+{
+	int shift = pyr->levels - 1 - level;
+	*w = (int)(((long long)pyr->w + (1LL << shift) - 1) >> shift);
+	*h = (int)(((long long)pyr->h + (1LL << shift) - 1) >> shift);
+}
+
+/* A tile being rendered, the window is in full resolution pixels. */
+typedef struct pyrtile_t {
+	bitmap_t *bitmap;
+	struct rblayout_t *lt;
+	int shift;
+	long long wx0, wy0, wx1, wy1;	/* window, exclusive ends */
+	float *total, *reds;	/* density of summarized subtrees per pixel */
+	int *visible;			/* nodes drawn one by one */
+	int nvisible;
+} pyrtile_t;
+
+/* Spread a subtree, narrower than a pixel, over the pixels it covers. */
+static void pyramid_summarize(pyrtile_t *pt, pyrnode_t *nd)
+{
+	bitmap_t *b = pt->bitmap;
+	int x0, x1, y0, y1, x, y;
+	float share;
+	size_t i;
+
+	x0 = (nd->xmin >> pt->shift) - b->x0;
+	x1 = (nd->xmax >> pt->shift) - b->x0;
+	y0 = (nd->y >> pt->shift) - b->y0;
+	y1 = (nd->ymax >> pt->shift) - b->y0;
+	share = 1.0f / ((x1 - x0 + 1) * (y1 - y0 + 1));
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 >= b->cw)
+		x1 = b->cw - 1;
+	if (y1 >= b->ch)
+		y1 = b->ch - 1;
+
+	for (y = y0; y <= y1; y++) {
+		for (x = x0; x <= x1; x++) {
+			i = (size_t)y * b->cw + x;
+			pt->total[i] += nd->size * share;
+			pt->reds[i] += nd->reds * share;
+		}
+	}
+}
+
+/* Walk down to the subtrees which reach into the window, stopping at the
+ones narrower than a pixel. */
+static int pyramid_collect(pyrtile_t *pt)
+{
+	struct rblayout_t *lt = pt->lt;
+	pyrnode_t *nd;
+	int *stack, top = 0, i, m = lt->margin;
+
+	if (lt->count == 0)
+		return 0;
+
+	stack = malloc((lt->depth + 1) * sizeof(int));
+	pt->visible = malloc(lt->count * sizeof(int));
+	if (stack == NULL || pt->visible == NULL) {
+		free(stack);
+		return -1;
+	}
+
+	stack[top++] = 0;
+	while (top > 0) {
+		i = stack[--top];
+		nd = lt->nodes + i;
+		if (nd->xmax + m < pt->wx0 || nd->xmin - m >= pt->wx1 ||
+			nd->ymax + m < pt->wy0 || nd->y - m >= pt->wy1)
+			continue;
+		if (pt->shift > 0 && nd->size > 1 && nd->xmax - nd->xmin < (1 << pt->shift)) {
+			pyramid_summarize(pt, nd);
+			continue;
+		}
+		pt->visible[pt->nvisible++] = i;
+		if (nd->right >= 0)
+			stack[top++] = nd->right;
+		if (nd->has_left)
+			stack[top++] = i + 1;
+	}
+
+	free(stack);
+	return 0;
+}
+
+static inline color_t blend(color_t a, color_t b, float t)
+{
+	int r, g, bl;
+	r = (int)(((a >> 16) & 0xff) * (1 - t) + ((b >> 16) & 0xff) * t);
+	g = (int)(((a >> 8) & 0xff) * (1 - t) + ((b >> 8) & 0xff) * t);
+	bl = (int)((a & 0xff) * (1 - t) + (b & 0xff) * t);
+	return (color_t)(0xff000000 | (r << 16) | (g << 8) | bl);
+}
+
+/* Shade the summarized pixels by how much of them would be ink,
+from black to red by the share of red nodes. */
+static void pyramid_shade(pyrtile_t *pt)
+{
+	bitmap_t *b = pt->bitmap;
+	float ink, area;
+	size_t i, n = (size_t)b->cw * b->ch;
+
+	/* a node inks about the square of its diameter */
+	area = (float)(2 * pt->lt->radius) * (2 * pt->lt->radius) /
+		((float)(1 << pt->shift) * (1 << pt->shift));
+
+	for (i = 0; i < n; i++) {
+		if (pt->total[i] <= 0)
+			continue;
+		ink = pt->total[i] * area;
+		b->colors[i] = blend(COLOR_WHITE,
+			blend(COLOR_BLACK, COLOR_RED, pt->reds[i] / pt->total[i]),
+			ink < 1 ? ink : 1);
+	}
+}
+
+static int pyramid_draw_node(pyrtile_t *pt, pyrnode_t *nd)
+{
+	bitmap_t *b = pt->bitmap;
+	int x = nd->x >> pt->shift, y = nd->y >> pt->shift;
+	int r = pt->lt->radius >> pt->shift, hw, hh;
+
+	if (nd->key == NIL_KEY) {
+		if (pt->shift == 0)
+			return draw_nil(b, x, y, pt->lt->glyphs);
+		hw = ((3 * ASC16_GYLPH_WIDTH) / 2 + CIRCLE_PADDING) >> pt->shift;
+		hh = (ASC16_GYLPH_HEIGHT / 2) >> pt->shift;
+		return bitmap_draw_rect(b, x - hw, y - hh, x + hw, y + hh + 1, 1, COLOR_BLACK);
+	}
+
+	if (r < 1)
+		return bitmap_draw_point(b, x, y, nd->red ? COLOR_RED : COLOR_BLACK);
+
+	if (bitmap_draw_circle(b, x, y, r, 1, nd->red ? COLOR_RED : COLOR_BLACK) != 0)
+		return -1;
+
+	/* keys only at full resolution */
+	if (pt->shift == 0) {
+		hw = bitmap_int_glyphs(nd->key) * ASC16_ADVANCE / 2;
+		if (bitmap_draw_int(b, nd->key, x - hw + 1, y - ASC16_GYLPH_HEIGHT / 2 + 1,
+			pt->lt->glyphs) != 0)
 			return -1;
 	}
 
-	return 0;
+	return 0;
+}
+
+int rbpyramid_render_tile(rbpyramid_t *pyr, int level, int col, int row, bitmap_t *tile)
+{
+	pyrtile_t pt = { 0 };
+	pyrnode_t *nd, *c;
+	int w, h, x0, y0, i, r = -1;
+	size_t n;
+
+	if (level < 0 || level >= pyr->levels || col < 0 || row < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	rbpyramid_level_size(pyr, level, &w, &h);
+	if (col > (w - 1) / pyr->tile || row > (h - 1) / pyr->tile) {
+		errno = EINVAL;
+		return -1;
+	}
+	x0 = col * pyr->tile;
+	y0 = row * pyr->tile;
+
+	if (bitmap_init_view(tile, w, h, x0, y0,
+		w - x0 < pyr->tile ? w - x0 : pyr->tile,
+		h - y0 < pyr->tile ? h - y0 : pyr->tile, COLOR_WHITE) != 0)
+		return -1;
+
+	pt.bitmap = tile;
+	pt.lt = pyr->layout;
+	pt.shift = pyr->levels - 1 - level;
+	pt.wx0 = (long long)x0 << pt.shift;
+	pt.wy0 = (long long)y0 << pt.shift;
+	pt.wx1 = (long long)(x0 + tile->cw) << pt.shift;
+	pt.wy1 = (long long)(y0 + tile->ch) << pt.shift;
+
+	n = (size_t)tile->cw * tile->ch;
+	if (pt.shift > 0) {
+		pt.total = calloc(n, sizeof(float));
+		pt.reds = calloc(n, sizeof(float));
+		if (pt.total == NULL || pt.reds == NULL)
+			goto out;
+	}
+
+	if (pyramid_collect(&pt) != 0)
+		goto out;
+
+	if (pt.shift > 0)
+		pyramid_shade(&pt);
+
+	/* lines under the nodes */
+	for (i = 0; i < pt.nvisible; i++) {
+		nd = pt.lt->nodes + pt.visible[i];
+		if (nd->has_left) {
+			c = nd + 1;
+			if (bitmap_draw_line(tile, nd->x >> pt.shift, nd->y >> pt.shift,
+				c->x >> pt.shift, c->y >> pt.shift, LINE_COLOR) != 0)
+				goto out;
+		}
+		if (nd->right >= 0) {
+			c = pt.lt->nodes + nd->right;
+			if (bitmap_draw_line(tile, nd->x >> pt.shift, nd->y >> pt.shift,
+				c->x >> pt.shift, c->y >> pt.shift, LINE_COLOR) != 0)
+				goto out;
+		}
+	}
+
+	for (i = 0; i < pt.nvisible; i++) {
+		if (pyramid_draw_node(&pt, pt.lt->nodes + pt.visible[i]) != 0)
+			goto out;
+	}
+	r = 0;
+
+out:
+	free(pt.total);
+	free(pt.reds);
+	free(pt.visible);
+	if (r != 0)
+		bitmap_free(tile);
+	return r;
+}
+
+#define OUTBUF_SIZE			(256 * 1024)
+#define DOT_STACK_SIZE		(RBTREE_PROFILE_DEPTH_MAX + 2)
+
+/* Buffered text output, written in large blocks.
+An error sticks until out_flush() reports it. */
+typedef struct outbuf_t {
+	FILE *pf;
+	size_t len;
+	int error;
+	char buf[OUTBUF_SIZE];
+} outbuf_t;
+
+static int out_flush(outbuf_t *o)
+{
+	if (o->len > 0 && !o->error) {
+		if (fwrite(o->buf, 1, o->len, o->pf) != o->len)
+			o->error = 1;
+	}
+	o->len = 0;
+	return o->error ? -1 : 0;
 }
 
-static inline int draw_rbnodes(draw_state_t *st)
+static void out_str(outbuf_t *o, const char *s)
 {
-	int i;
-	dllist_t *list;
-	dlitem_t *curr, *next;
-	rbpoint_t *point;
-
-	for (i = 0; i < st->rowcount; i++) {
-		list = st->rows + i;
-		dllist_foreach(list, curr, next, rbpoint_t, point, dlentry) {
-			if (draw_rbnode(st, point) != 0)
-				return -1;
-		}
+	size_t n = strlen(s), k;
+
+	while (n > 0) {
+		if (o->len == OUTBUF_SIZE)
+			out_flush(o);
+		k = OUTBUF_SIZE - o->len;
+		if (k > n)
+			k = n;
+		memcpy(o->buf + o->len, s, k);
+		o->len += k;
+		s += k;
+		n -= k;
 	}
+}
 
-	return 0;
+static void out_int(outbuf_t *o, int v)
+{
+	char tmp[16], *p = tmp + sizeof(tmp);
+	unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+
+	*--p = '\0';
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+	if (v < 0)
+		*--p = '-';
+	out_str(o, p);
 }
 
-static inline int draw_rbtree(draw_state_t *st)
+static outbuf_t *out_open(FILE *pf)
 {
-	if (draw_lines(st) != 0)
-		return -1;
+	outbuf_t *o = malloc(sizeof(outbuf_t));
+	if (o == NULL)
+		return NULL;
+	o->pf = pf;
+	o->len = 0;
+	o->error = 0;
+	return o;
+}
 
-	if (draw_rbnodes(st) != 0)
-		return -1;
+static int out_close(outbuf_t *o)
+{
+	int r = out_flush(o);
+	free(o);
+	return r;
+}
 
-	return 0;
+static void svg_node(outbuf_t *o, draw_state_t *st, rbpoint_t *point)
+{
+	if (ptoi(point->rbentry.key) == NIL_KEY) {
+		out_str(o, "<rect x=\"");
+		out_int(o, point->x - (3 * ASC16_GYLPH_WIDTH / 2) - CIRCLE_PADDING);
+		out_str(o, "\" y=\"");
+		out_int(o, point->y - (ASC16_GYLPH_HEIGHT / 2));
+		out_str(o, "\" width=\"");
+		out_int(o, 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING * 2);
+		out_str(o, "\" height=\"");
+		out_int(o, ASC16_GYLPH_HEIGHT);
+		out_str(o, "\"/><text x=\"");
+		out_int(o, point->x);
+		out_str(o, "\" y=\"");
+		out_int(o, point->y);
+		out_str(o, "\">NIL</text>\n");
+	}
+	else {
+		out_str(o, rbnode_is_red(&point->rbentry) ? "<circle class=\"r\" cx=\"" : "<circle cx=\"");
+		out_int(o, point->x);
+		out_str(o, "\" cy=\"");
+		out_int(o, point->y);
+		out_str(o, "\" r=\"");
+		out_int(o, st->radius);
+		out_str(o, "\"/><text x=\"");
+		out_int(o, point->x);
+		out_str(o, "\" y=\"");
+		out_int(o, point->y);
+		out_str(o, "\">");
+		out_int(o, ptoi(point->rbentry.key));
+		out_str(o, "</text>\n");
+	}
 }
 
-static int get_radius(int value)
+int rbtree_write_svg(rbtree_t *tree, int nil, FILE *pf)
 {
-	int r = 1;
+	draw_state_t st = { 0 };
+	outbuf_t *o;
+	rbpoint_t *point, *parent;
+	size_t i;
 
-	value /= 10;
-	while (value != 0) {
-		r++;
-		value /= 10;
+	o = out_open(pf);
+	if (o == NULL)
+		return -1;
+
+	if (layout_tree(&st, tree, NULL, nil) != 0) {
+		free(o);
+		free_draw_state(&st);
+		return -1;
 	}
 
-	if (r < 3)
-		r = 3;
+	out_str(o, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+	out_int(o, st.bitmapW);
+	out_str(o, "\" height=\"");
+	out_int(o, st.bitmapH);
+	out_str(o, "\" style=\"background:#fff\">\n"
+		"<style>path{stroke:#333;fill:none}circle,rect{fill:#333}.r{fill:#f33}"
+		"text{fill:#fff;font:14px monospace;"
+		"text-anchor:middle;dominant-baseline:central}</style>\n");
+
+	/* all the lines in one path, under the nodes */
+	out_str(o, "<path d=\"");
+	for (i = 1; i < st.count; i++) {
+		point = st.points[i];
+		parent = container_of(point->rbentry.parent, rbpoint_t, rbentry);
+		out_str(o, "M");
+		out_int(o, parent->x);
+		out_str(o, " ");
+		out_int(o, parent->y);
+		out_str(o, "L");
+		out_int(o, point->x);
+		out_str(o, " ");
+		out_int(o, point->y);
+		out_str(o, "\n");
+	}
+	out_str(o, "\"/>\n");
 
-	r *= ASC16_ADVANCE;
-	r /= 2;
+	for (i = 0; i < st.count; i++)
+		svg_node(o, &st, st.points[i]);
 
-	r += CIRCLE_PADDING;
+	out_str(o, "</svg>\n");
 
-	return r;
+	free_draw_state(&st);
+	return out_close(o);
 }
 
-static void move_x_fixup(draw_state_t *st, rbpoint_t *point)
+/* Preorder walk with a stack (one pending right child per level),
+nodes are numbered in the order they are written. */
+int rbtree_write_dot(rbtree_t *tree, int nil, FILE *pf)
 {
+	struct {
+		rbnode_t *n;
+		int parent;
+	} stack[DOT_STACK_SIZE];
+	outbuf_t *o;
 	rbnode_t *n;
-	rbpoint_t *m;
-	dllist_t *list;
-	int x;
-	n = rbnode_is_nil(point->rbentry.left) ?
-		point->rbentry.right :
-		point->rbentry.left;
-	if (!rbnode_is_nil(n)) {
-		m = container_of(n, rbpoint_t, rbentry);
-		if (m->x < point->x - 1) {
-			x = point->x - 1 - m->x;
-			m->x += x;
-			list = st->rows + m->y;
-			while (m->dlentry.next != &list->head) {
-				m = container_of(m->dlentry.next, rbpoint_t, dlentry);
-				m->x += x;
-				move_x_fixup(st, m);
-			}
-		}
-	}
-}
+	int top = 0, id = 0, parent;
 
-static int calc_xy(draw_state_t *st)
-{
-	int i, w, h, x;
-	dllist_t *list;
-	dlitem_t *currItem, *nextItem;
-	rbpoint_t *curr, *prev, *left, *right;
+	o = out_open(pf);
+	if (o == NULL)
+		return -1;
 
-	st->radius = get_radius(st->maxValue);
-	st->advanceX = (st->radius + CIRCLE_PADDING) * 2;
-	st->advanceY = (int)((float)st->advanceX * GOLDEN_RATIO);
+	out_str(o, "digraph rbtree {\n"
+		"\tgraph [ordering=out];\n"
+		"\tnode [shape=circle, style=filled, fillcolor=\"#333333\", "
+		"fontcolor=white, fontname=monospace];\n"
+		"\tedge [arrowhead=none, color=\"#333333\"];\n");
 
-	w = 0;
-	/* صɨ裬ʹýڵ㲻ص */
-	for (i = st->rowcount - 1; i >= 0; i--) {
-		list = st->rows + i;
-		x = -st->minX;
-		dllist_foreach(list, currItem, nextItem, rbpoint_t, curr, dlentry) {
-
-			if (!dllist_is_start(list, currItem->prev)) {
-				prev = container_of(currItem->prev, rbpoint_t, dlentry);
-				if ((curr->x + x) <= prev->x)
-					x += prev->x - curr->x - x + 1;
-				if (!rbnode_is_nil(curr->rbentry.left)) {
-					left = container_of(curr->rbentry.left, rbpoint_t, rbentry);
-					if ((curr->x + x) <= left->x)
-						x += left->x - curr->x - x + 1;
-				}
-			}
+	if (!rbnode_is_nil(tree->root)) {
+		stack[top].n = tree->root;
+		stack[top++].parent = -1;
+	}
 
-			curr->x += x;
+	while (top > 0) {
+		n = stack[--top].n;
+		parent = stack[top].parent;
 
-			move_x_fixup(st, curr);
+		out_str(o, "\tn");
+		out_int(o, id);
+		if (rbnode_is_nil(n)) {
+			out_str(o, " [shape=box, label=\"NIL\", fontsize=8, height=0.2];\n");
+		}
+		else {
+			out_str(o, " [label=\"");
+			out_int(o, ptoi(n->key));
+			out_str(o, rbnode_is_red(n) ? "\", fillcolor=\"#ff3333\"];\n" : "\"];\n");
+		}
+		if (parent >= 0) {
+			out_str(o, "\tn");
+			out_int(o, parent);
+			out_str(o, " -> n");
+			out_int(o, id);
+			out_str(o, ";\n");
 		}
-	}
-
-	w = 0;
-	h = 0;
-	for (i = st->rowcount - 1; i >= 0; i--) {
-		list = st->rows + i;
-		dllist_foreach(list, currItem, nextItem, rbpoint_t, curr, dlentry) {
 
-			if (!rbnode_is_leaf(&curr->rbentry)) {
-				left = container_of(curr->rbentry.left, rbpoint_t, rbentry);
-				right = container_of(curr->rbentry.right, rbpoint_t, rbentry);
-				curr->x = left->x + (right->x - left->x) / 2;
+		if (!rbnode_is_nil(n)) {
+			if (top + 2 > DOT_STACK_SIZE) {
+				free(o);
+				errno = EOVERFLOW;
+				return -1;
 			}
-			else {
-				curr->x *= st->advanceX;
-				curr->x += st->advanceX; /* left margin */
-				if (st->draw_nil)
-					curr->x += 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING * 2;
+			/* right first, so that the left subtree is written first */
+			if (nil || !rbnode_is_nil(n->right)) {
+				stack[top].n = n->right;
+				stack[top++].parent = id;
+			}
+			if (nil || !rbnode_is_nil(n->left)) {
+				stack[top].n = n->left;
+				stack[top++].parent = id;
 			}
-
-			curr->y *= st->advanceY;
-			curr->y += st->advanceX; /* top margin */
-
-			if (w < curr->x)
-				w = curr->x;
-			if (h < curr->y)
-				h = curr->y;
 		}
+		id++;
 	}
 
-	w += st->advanceX;  /* right margin */
-	h += st->advanceX; /* bottom margin */
-
-	if (st->draw_nil) {
-		w += 3 * ASC16_GYLPH_WIDTH + CIRCLE_PADDING * 2;
-		h += st->advanceY - (st->radius - ASC16_GYLPH_HEIGHT);
-	}
-
-
-	st->bitmapW = w;
-	st->bitmapH = h;
+	out_str(o, "}\n");
 
-	return 0;
+	return out_close(o);
 }
 
-bitmap_t *rbtree_save_as_bitmap(rbtree_t *tree, asc16_t *asc16, int nil)
+int bitmap_init(bitmap_t *bitmap, int w, int h, color_t bg)
 {
-	bitmap_t *bitmap;
-	draw_state_t st = { 0 };
+	return bitmap_init_view(bitmap, w, h, 0, 0, w, h, bg);
+}
 
-	st.draw_nil = nil;
-	dllist_init(&st.nils);
+int bitmap_init_view(bitmap_t *bitmap, int w, int h,
+	int x0, int y0, int cw, int ch, color_t bg)
+{
+	if (w < 0 || h < 0 || cw < 0 || ch < 0 ||
+		(cw > 0 && (size_t)ch > SIZE_MAX / sizeof(color_t) / (size_t)cw)) {
+		errno = ERANGE;
+		return -1;
+	}
 
-	bitmap = malloc(sizeof(bitmap_t));
-	if (bitmap == NULL)
-		return NULL;
+	bitmap->w = w;
+	bitmap->h = h;
+	bitmap->x0 = x0;
+	bitmap->y0 = y0;
+	bitmap->cw = cw;
+	bitmap->ch = ch;
 
-	memset(bitmap, 0, sizeof(bitmap_t));
+	bitmap->colors = malloc((size_t)cw * ch * sizeof(color_t));
+	if (bitmap->colors == NULL && (size_t)cw * ch > 0)
+		return -1;
+	bitmap_fill(bitmap, bg);
+	return 0;
+}
 
-	st.bitmap = bitmap;
-	st.asc16 = asc16;
+/* Set 'n' pixels from 'p' on. */
+static void fill_span(color_t *p, size_t n, color_t c)
+{
+#ifdef BITMAP_AVX2
+	__m256i v8 = _mm256_set1_epi32(c);
+	for (; n >= 8; n -= 8, p += 8)
+		_mm256_storeu_si256((__m256i *)p, v8);
+#endif
+#ifdef BITMAP_SSE2
+	__m128i v4 = _mm_set1_epi32(c);
+	for (; n >= 4; n -= 4, p += 4)
+		_mm_storeu_si128((__m128i *)p, v4);
+#endif
+	for (; n > 0; n--)
+		*p++ = c;
+}
 
-	if (rbtree_foreach_preorder(tree, predraw, &st) != 0) {
-		free(bitmap);
-		free_draw_state(&st);
-		return NULL;
-	}
+/* Draw the pixels 'x0' to 'x1' of row 'y', clipped once for the whole run.
+Fails with ERANGE if some of them are outside of the image,
+the rest are drawn anyway. */
+static int draw_span(bitmap_t *bitmap, int y, int x0, int x1, color_t c)
+{
+	int r = 0, lo, hi;
 
-	calc_xy(&st);
+	if (x0 > x1)
+		return 0;
 
-	if (bitmap_init(bitmap, st.bitmapW, st.bitmapH, COLOR_WHITE) != 0) {
-		free(bitmap);
-		free_draw_state(&st);
-		return NULL;
+	if (y < 0 || y >= bitmap->h || x0 < 0 || x1 >= bitmap->w) {
+		errno = ERANGE;
+		r = -1;
+		if (y < 0 || y >= bitmap->h)
+			return r;
+		if (x0 < 0)
+			x0 = 0;
+		if (x1 >= bitmap->w)
+			x1 = bitmap->w - 1;
 	}
 
-	if (draw_rbtree(&st) != 0) {
-		free(bitmap);
-		free_draw_state(&st);
-		return NULL;
-	}
+	y -= bitmap->y0;
+	if (y < 0 || y >= bitmap->ch)
+		return r;
+	lo = x0 - bitmap->x0;
+	hi = x1 - bitmap->x0;
+	if (lo < 0)
+		lo = 0;
+	if (hi >= bitmap->cw)
+		hi = bitmap->cw - 1;
+	if (lo <= hi)
+		fill_span(bitmap->colors + (size_t)y * bitmap->cw + lo, hi - lo + 1, c);
 
-	free_draw_state(&st);
+	return r;
+}
 
-	return bitmap;
+/* Whether the box is within both the image and the view,
+so that it can be drawn without checking every pixel. */
+static inline int box_inside(bitmap_t *bitmap, int x0, int y0, int x1, int y1)
+{
+	return x0 >= 0 && y0 >= 0 && x1 < bitmap->w && y1 < bitmap->h &&
+		x0 >= bitmap->x0 && y0 >= bitmap->y0 &&
+		x1 < bitmap->x0 + bitmap->cw && y1 < bitmap->y0 + bitmap->ch;
 }
 
-int bitmap_init(bitmap_t *bitmap, int w, int h, color_t bg)
+static inline color_t *pixel_at(bitmap_t *bitmap, int x, int y)
 {
-	int i;
-	bitmap->w = w;
-	bitmap->h = h;
+	return bitmap->colors + (size_t)(y - bitmap->y0) * bitmap->cw + (x - bitmap->x0);
+}
 
-	bitmap->colors = malloc(w * h * sizeof(color_t));
-	if (bitmap->colors == NULL)
-		return -1;
-	for (i = 0; i < w * h; i++) {
-		bitmap->colors[i] = bg;
-	}
-	return 0;
+void bitmap_fill(bitmap_t *bitmap, color_t c)
+{
+	fill_span(bitmap->colors, (size_t)bitmap->cw * bitmap->ch, c);
 }
 
 void bitmap_free(bitmap_t *bitmap)
 {
 	if (bitmap != NULL) {
 		free(bitmap->colors);
+		bitmap->colors = NULL;
 	}
 }
 
 int bitmap_draw_point(bitmap_t *bitmap, int x, int y, color_t c)
 {
-	int i = x + y * bitmap->w;
-	if (i >= 0 && i < (bitmap->w * bitmap->h)) {
-		bitmap->colors[i] = c;
-		return 0;
+	if (x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h) {
+		errno = ERANGE;
+		return -1;
 	}
-	else {
+	x -= bitmap->x0;
+	y -= bitmap->y0;
+	/* clipped by the view */
+	if (x >= 0 && x < bitmap->cw && y >= 0 && y < bitmap->ch)
+		bitmap->colors[x + (size_t)y * bitmap->cw] = c;
+	return 0;
+}
+
+/* Fails with ERANGE like bitmap_draw_point(), without drawing. */
+static inline int point_check(bitmap_t *bitmap, int x, int y)
+{
+	if (x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h) {
 		errno = ERANGE;
 		return -1;
 	}
+	return 0;
 }
 
 static inline void swap_int(int *a, int *b)
@@ -476,13 +1556,28 @@ static inline void swap_int(int *a, int *b)
 	*a ^= *b;
 }
 
-/* Bresenham's line algorithm */
+/* Draw the run from 'x0' up to, but not including, 'x1' in direction 'ix'. */
+static inline int draw_run(bitmap_t *bitmap, int y, int x0, int x1, int ix, color_t c)
+{
+	if (ix > 0)
+		return draw_span(bitmap, y, x0, x1 - 1, c);
+	else
+		return draw_span(bitmap, y, x1 + 1, x0, c);
+}
+
+/* Bresenham's line algorithm, started at the first step inside the
+view: before step 'k' the minor axis has moved (2dy*k + dx) / 2dx. */
 int bitmap_draw_line(bitmap_t *bitmap, int x1, int y1, int x2, int y2, color_t color)
 {
 	int ix, iy, cx, cy, n2dy, n2dydx, d;
-	int dx, dy, yy;
+	int dx, dy, yy, run, inside, lo, hi, xend;
+	long long k0, k1, s;
 	int r = 0;
-	
+
+	inside = box_inside(bitmap,
+		x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2,
+		x1 < x2 ? x2 : x1, y1 < y2 ? y2 : y1);
+
 	dx = abs(x2 - x1);
 	dy = abs(y2 - y1);
 	yy = 0;
@@ -494,16 +1589,52 @@ int bitmap_draw_line(bitmap_t *bitmap, int x1, int y1, int x2, int y2, color_t c
 		swap_int(&dx, &dy);
 	}
 
+	if (dx == 0)
+		return 0;
+
 	ix = (x2 - x1) > 0 ? 1 : -1;
 	iy = (y2 - y1) > 0 ? 1 : -1;
-	cx = x1;
-	cy = y1;
 	n2dy = dy * 2;
 	n2dydx = (dy - dx) * 2;
-	d = dy * 2 - dx;
+
+	/* steps 'k0' to 'k1' are inside the view along the major axis */
+	k0 = 0;
+	k1 = dx - 1;
+	if (!inside) {
+		/* a monotone line leaves the image if its first or last pixel does */
+		s = ((long long)n2dy + dx) / (2LL * dx);
+		if ((yy ? point_check(bitmap, y1 + iy * (int)s, x1) :
+				point_check(bitmap, x1, y1 + iy * (int)s)) != 0 ||
+			(yy ? point_check(bitmap, y2, x2 - ix) :
+				point_check(bitmap, x2 - ix, y2)) != 0)
+			r = -1;
+
+		lo = yy ? bitmap->y0 : bitmap->x0;
+		hi = lo + (yy ? bitmap->ch : bitmap->cw) - 1;
+		if (ix > 0) {
+			if (k0 < (long long)lo - x1)
+				k0 = (long long)lo - x1;
+			if (k1 > (long long)hi - x1)
+				k1 = (long long)hi - x1;
+		}
+		else {
+			if (k0 < (long long)x1 - hi)
+				k0 = (long long)x1 - hi;
+			if (k1 > (long long)x1 - lo)
+				k1 = (long long)x1 - lo;
+		}
+		if (k0 > k1)
+			return r;
+	}
+
+	s = (2LL * dy * k0 + dx) / (2LL * dx);
+	cx = x1 + ix * (int)k0;
+	cy = y1 + iy * (int)s;
+	d = (int)(2LL * dy * (k0 + 1) - dx - 2LL * dx * s);
+	xend = x1 + ix * (int)(k1 + 1);
 
 	if (yy) { /* ֱ x ļнǴ 45  */
-		while (cx != x2) {
+		while (cx != xend) {
 			if (d < 0) {
 				d += n2dy;
 			}
@@ -511,24 +1642,30 @@ int bitmap_draw_line(bitmap_t *bitmap, int x1, int y1, int x2, int y2, color_t c
 				cy += iy;
 				d += n2dydx;
 			}
-			if (bitmap_draw_point(bitmap, cy, cx, color) != 0)
+			if (inside)
+				*pixel_at(bitmap, cy, cx) = color;
+			else if (bitmap_draw_point(bitmap, cy, cx, color) != 0)
 				r = -1;
 			cx += ix;
 		}
 	}
 	else { /* ֱ x ļнС 45  */
-		while (cx != x2) {
+		run = cx; /* pixels 'run' to 'cx' are on row 'cy' */
+		while (cx != xend) {
 			if (d < 0) {
 				d += n2dy;
 			}
 			else {
+				if (cx != run && draw_run(bitmap, cy, run, cx, ix, color) != 0)
+					r = -1;
+				run = cx;
 				cy += iy;
 				d += n2dydx;
 			}
-			if (bitmap_draw_point(bitmap, cx, cy, color) != 0)
-				r = -1;
 			cx += ix;
 		}
+		if (cx != run && draw_run(bitmap, cy, run, cx, ix, color) != 0)
+			r = -1;
 	}
 
 	return r;
@@ -538,6 +1675,18 @@ int bitmap_draw_line(bitmap_t *bitmap, int x1, int y1, int x2, int y2, color_t c
 static inline int draw_circle_8(bitmap_t *bitmap, int xc, int yc, int x, int y, color_t color)
 {
 	int r = 0;
+	if (box_inside(bitmap, xc - x, yc - y, xc + x, yc + y) &&
+		box_inside(bitmap, xc - y, yc - x, xc + y, yc + x)) {
+		*pixel_at(bitmap, xc + x, yc + y) = color;
+		*pixel_at(bitmap, xc - x, yc + y) = color;
+		*pixel_at(bitmap, xc + x, yc - y) = color;
+		*pixel_at(bitmap, xc - x, yc - y) = color;
+		*pixel_at(bitmap, xc + y, yc + x) = color;
+		*pixel_at(bitmap, xc - y, yc + x) = color;
+		*pixel_at(bitmap, xc + y, yc - x) = color;
+		*pixel_at(bitmap, xc - y, yc - x) = color;
+		return 0;
+	}
 	if (bitmap_draw_point(bitmap, xc + x, yc + y, color) != 0)
 		r = -1;
 	if (bitmap_draw_point(bitmap, xc - x, yc + y, color) != 0)
@@ -560,7 +1709,7 @@ static inline int draw_circle_8(bitmap_t *bitmap, int xc, int yc, int x, int y,
 /* Bresenham's circle algorithm */
 int bitmap_draw_circle(bitmap_t *bitmap, int xc, int yc, int r, int fill, color_t c)
 {
-	int x = 0, y = r, yi, d;
+	int x = 0, y = r, d;
 	int rc = 0;
 
 	/* ԲͼƬɼ⣬ֱ˳ */
@@ -570,20 +1719,33 @@ int bitmap_draw_circle(bitmap_t *bitmap, int xc, int yc, int r, int fill, color_
 		return -1;
 	}
 
+	/* outside of the view */
+	if (xc + r < bitmap->x0 || xc - r >= bitmap->x0 + bitmap->cw ||
+		yc + r < bitmap->y0 || yc - r >= bitmap->y0 + bitmap->ch)
+		return 0;
+
 	d = 3 - 2 * r;
 
 	if (fill) {
 		/* 䣨ʵԲ*/
+		/* one span per row: rows 'yc' +- 'x' reach out to 'y',
+		and rows 'yc' +- 'y' reach out to the last 'x' before 'y' steps */
 		while (x <= y) {
-			for (yi = x; yi <= y; yi++) {
-				if (draw_circle_8(bitmap, xc, yc, x, yi, c) != 0)
-					rc = -1;
-			}
+			if (draw_span(bitmap, yc + x, xc - y, xc + y, c) != 0)
+				rc = -1;
+			if (x > 0 && draw_span(bitmap, yc - x, xc - y, xc + y, c) != 0)
+				rc = -1;
 
 			if (d < 0) {
 				d = d + 4 * x + 6;
 			}
 			else {
+				if (y > x) {
+					if (draw_span(bitmap, yc + y, xc - x, xc + x, c) != 0)
+						rc = -1;
+					if (draw_span(bitmap, yc - y, xc - x, xc + x, c) != 0)
+						rc = -1;
+				}
 				d = d + 4 * (x - y) + 10;
 				y--;
 			}
@@ -612,23 +1774,19 @@ int bitmap_draw_circle(bitmap_t *bitmap, int xc, int yc, int r, int fill, color_
 
 int bitmap_draw_rect(bitmap_t *bitmap, int x0, int y0, int x1, int y1, int fill, color_t color)
 {
-	int x, y;
+	int y;
 	int r = 0;
 	if (fill) {
 		for (y = y0; y < y1; y++) {
-			for (x = x0; x <= x1; x++) {
-				if (bitmap_draw_point(bitmap, x, y, color) != 0)
-					r = -1;
-			}
+			if (draw_span(bitmap, y, x0, x1, color) != 0)
+				r = -1;
 		}
 	}
 	else {
-		for (x = x0; x <= x1; x++) {
-			if (bitmap_draw_point(bitmap, x, y0, color) != 0)
-				r = -1;
-			if (bitmap_draw_point(bitmap, x, y1, color) != 0)
-				r = -1;
-		}
+		if (draw_span(bitmap, y0, x0, x1, color) != 0)
+			r = -1;
+		if (draw_span(bitmap, y1, x0, x1, color) != 0)
+			r = -1;
 		for (y = y0; y < y1; y++) {
 			if (bitmap_draw_point(bitmap, x0, y, color) != 0)
 				r = -1;
@@ -643,8 +1801,18 @@ int bitmap_draw_rect(bitmap_t *bitmap, int x0, int y0, int x1, int y1, int fill,
 int bitmap_draw_char(bitmap_t *bitmap, int ch, int x, int y, color_t c, asc16_t *asc16)
 {
 	int i, j, r = 0;
-	char *d;
+	const char *d;
 	d = asc16_gylph_data(asc16, ch);
+	if (box_inside(bitmap, x, y, x + ASC16_GYLPH_WIDTH - 1, y + ASC16_GYLPH_HEIGHT - 1)) {
+		color_t *p = pixel_at(bitmap, x, y);
+		for (j = 0; j < ASC16_GYLPH_HEIGHT; j++, d++, p += bitmap->cw) {
+			for (i = 0; i < ASC16_GYLPH_WIDTH; i++) {
+				if (asc16_is_setpixel(d, i))
+					p[i] = c;
+			}
+		}
+		return 0;
+	}
 	for (j = 0; j < ASC16_GYLPH_HEIGHT; j++, d++) {
 		for (i = 0; i < ASC16_GYLPH_WIDTH; i++) {
 			if (asc16_is_setpixel(d, i))
@@ -667,106 +1835,242 @@ int bitmap_draw_string(bitmap_t *bitmap, char *str, int x, int y, color_t c, asc
 	return r;
 }
 
-static inline int fwritei32(int v, FILE *pf)
+#define GLYPH_CACHE_COUNT	256
+
+struct glyph_cache_t {
+	int count;
+	unsigned char bits[GLYPH_CACHE_COUNT][ASC16_GYLPH_HEIGHT];
+	/* a row is drawn as (pixels & ~mask) | ink */
+	color_t mask[GLYPH_CACHE_COUNT][ASC16_GYLPH_HEIGHT][ASC16_GYLPH_WIDTH];
+	color_t ink[GLYPH_CACHE_COUNT][ASC16_GYLPH_HEIGHT][ASC16_GYLPH_WIDTH];
+	color_t color;
+};
+
+glyph_cache_t *glyph_cache_new(asc16_t *asc16, color_t color)
 {
-	char buf[4];
-	int r;
-	buf[0] = v & 0xff;
-	buf[1] = (v >> 8) & 0xff;
-	buf[2] = (v >> 16) & 0xff;
-	buf[3] = (v >> 24) & 0xff;
-	r = fwrite(buf, 1, 4, pf);
-	if (r != 4)
-		return -1;
-	return 0;
+	glyph_cache_t *cache;
+	const char *d;
+	int ch, i, j;
+
+	cache = malloc(sizeof(glyph_cache_t));
+	if (cache == NULL)
+		return NULL;
+
+	cache->count = asc16_gylph_count(asc16);
+	if (cache->count > GLYPH_CACHE_COUNT)
+		cache->count = GLYPH_CACHE_COUNT;
+	cache->color = color;
+
+	for (ch = 0; ch < cache->count; ch++) {
+		d = asc16_gylph_data(asc16, ch);
+		for (j = 0; j < ASC16_GYLPH_HEIGHT; j++, d++) {
+			cache->bits[ch][j] = (unsigned char)*d;
+			for (i = 0; i < ASC16_GYLPH_WIDTH; i++) {
+				cache->mask[ch][j][i] = asc16_is_setpixel(d, i) ? ~(color_t)0 : 0;
+				cache->ink[ch][j][i] = cache->mask[ch][j][i] & color;
+			}
+		}
+	}
+
+	return cache;
 }
 
-static inline int fwritei24(int v, FILE *pf)
+void glyph_cache_free(glyph_cache_t *cache)
 {
-	char buf[4];
-	int r;
-	buf[0] = v & 0xff;
-	buf[1] = (v >> 8) & 0xff;
-	buf[2] = (v >> 16) & 0xff;
-	r = fwrite(buf, 1, 3, pf);
-	if (r != 3)
-		return -1;
-	return 0;
+	free(cache);
 }
 
-static inline int fwritei16(int v, FILE *pf)
+/* Blend 8 pixels of a glyph row into 'p'. */
+static inline void blit_glyph_row(color_t *p, const color_t *mask, const color_t *ink)
 {
-	char buf[4];
-	int r;
-	buf[0] = v & 0xff;
-	buf[1] = (v >> 8) & 0xff;
-	r = fwrite(buf, 1, 2, pf);
-	if (r != 2)
-		return -1;
-	return 0;
+#if defined(BITMAP_AVX2)
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	v = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)mask), v);
+	v = _mm256_or_si256(v, _mm256_loadu_si256((const __m256i *)ink));
+	_mm256_storeu_si256((__m256i *)p, v);
+#elif defined(BITMAP_SSE2)
+	int i;
+	__m128i v;
+	for (i = 0; i < ASC16_GYLPH_WIDTH; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		v = _mm_andnot_si128(_mm_loadu_si128((const __m128i *)(mask + i)), v);
+		v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *)(ink + i)));
+		_mm_storeu_si128((__m128i *)(p + i), v);
+	}
+#else
+	int i;
+	for (i = 0; i < ASC16_GYLPH_WIDTH; i++)
+		p[i] = (p[i] & ~mask[i]) | ink[i];
+#endif
 }
 
-int bitmap_print(bitmap_t *bitmap, FILE *pf)
+static int draw_glyph(bitmap_t *bitmap, int ch, int x, int y, glyph_cache_t *cache)
 {
-	char buf[1024];
-	int r, i, j;
+	int i, j, r = 0;
+	unsigned char *bits;
+	color_t *p;
 
-	buf[0] = 'B';
-	buf[1] = 'M';
+	if (cache == NULL || ch < 0 || ch >= cache->count)
+		return 0;
+	bits = cache->bits[ch];
+
+	if (box_inside(bitmap, x, y, x + ASC16_GYLPH_WIDTH - 1, y + ASC16_GYLPH_HEIGHT - 1)) {
+		p = pixel_at(bitmap, x, y);
+		for (j = 0; j < ASC16_GYLPH_HEIGHT; j++, p += bitmap->cw) {
+			if (bits[j])
+				blit_glyph_row(p, cache->mask[ch][j], cache->ink[ch][j]);
+		}
+		return 0;
+	}
+
+	for (j = 0; j < ASC16_GYLPH_HEIGHT; j++, bits++) {
+		for (i = 0; *bits && i < ASC16_GYLPH_WIDTH; i++) {
+			if (asc16_is_setpixel(bits, i))
+				if (bitmap_draw_point(bitmap, x + i, y + j, cache->color) != 0)
+					r = -1;
+		}
+	}
+	return r;
+}
+
+int bitmap_draw_glyphs(bitmap_t *bitmap, const char *str, int x, int y, glyph_cache_t *cache)
+{
+	int r = 0;
+	while (*str) {
+		if (draw_glyph(bitmap, (unsigned char)*str, x, y, cache) != 0)
+			r = -1;
+		x += ASC16_ADVANCE;
+		str++;
+	}
+	return r;
+}
 
-	r = fwrite(buf, 1, 2, pf);
-	if (r != 2) return -1;
+int bitmap_int_glyphs(int v)
+{
+	int n = v < 0 ? 2 : 1;
+	while (v <= -10 || v >= 10) {
+		v /= 10;
+		n++;
+	}
+	return n;
+}
 
-	r = fwritei32(bitmap->w * bitmap->h * 3 + 54, pf);
-	if (r != 0) return -1;
+int bitmap_draw_int(bitmap_t *bitmap, int v, int x, int y, glyph_cache_t *cache)
+{
+	int n, r = 0;
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+	n = bitmap_int_glyphs(v);
+	if (v < 0 && draw_glyph(bitmap, '-', x, y, cache) != 0)
+		r = -1;
 
-	r = fwritei32(54, pf);
-	if (r != 0) return -1;
+	/* from the last digit back, negative to reach INT_MIN */
+	if (v > 0)
+		v = -v;
+	x += (n - 1) * ASC16_ADVANCE;
+	do {
+		if (draw_glyph(bitmap, '0' - v % 10, x, y, cache) != 0)
+			r = -1;
+		x -= ASC16_ADVANCE;
+		v /= 10;
+	} while (v != 0);
 
-	r = fwritei32(40, pf);
-	if (r != 0) return -1;
+	return r;
+}
 
-	r = fwritei32(bitmap->w, pf);
-	if (r != 0) return -1;
+static inline void puti32(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
 
-	r = fwritei32(bitmap->h, pf);
-	if (r != 0) return -1;
+static inline void puti16(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
 
-	r = fwritei16(1, pf);
-	if (r != 0) return -1;
+size_t bitmap_stride(int w)
+{
+	return ((size_t)w * 3 + 3) & ~(size_t)3;
+}
 
-	r = fwritei16(24, pf);
-	if (r != 0) return -1;
+int bitmap_write_header(int w, int h, FILE *pf)
+{
+	unsigned char buf[BITMAP_HEADER_SIZE] = { 0 };
+	size_t size;
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+	/* sizes are 32-bit in the file */
+	if (w < 0 || h < 0 || (h > 0 && bitmap_stride(w) > (0xffffffffu - BITMAP_HEADER_SIZE) / h)) {
+		errno = EFBIG;
+		return -1;
+	}
+	size = bitmap_stride(w) * h + BITMAP_HEADER_SIZE;
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+	buf[0] = 'B';
+	buf[1] = 'M';
+	puti32(buf + 2, (unsigned int)size);
+	puti32(buf + 10, BITMAP_HEADER_SIZE);	/* offset of the pixels */
+	puti32(buf + 14, 40);					/* BITMAPINFOHEADER */
+	puti32(buf + 18, w);
+	puti32(buf + 22, h);					/* bottom-up */
+	puti16(buf + 26, 1);					/* planes */
+	puti16(buf + 28, 24);					/* bits per pixel */
+
+	if (fwrite(buf, 1, sizeof(buf), pf) != sizeof(buf))
+		return -1;
+	return 0;
+}
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+void bitmap_encode_rows(bitmap_t *bitmap, unsigned char *buf, size_t stride)
+{
+	const color_t *c;
+	unsigned char *p;
+	int i, j;
+
+	/* bottom-up, BGR, rows padded to 'stride' */
+	for (j = bitmap->ch - 1; j >= 0; j--, buf += stride) {
+		c = bitmap->colors + (size_t)j * bitmap->cw;
+		p = buf;
+		for (i = 0; i < bitmap->cw; i++) {
+			*p++ = c[i] & 0xff;
+			*p++ = (c[i] >> 8) & 0xff;
+			*p++ = (c[i] >> 16) & 0xff;
+		}
+		memset(p, 0, buf + stride - p);
+	}
+}
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+int bitmap_print(bitmap_t *bitmap, FILE *pf)
+{
+	unsigned char *row;
+	size_t stride;
+	bitmap_t line;
+	int j, r = 0;
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+	/* the pixels held, a tile prints as an image of its own */
+	if (bitmap_write_header(bitmap->cw, bitmap->ch, pf) != 0)
+		return -1;
 
-	r = fwritei32(0, pf);
-	if (r != 0) return -1;
+	stride = bitmap_stride(bitmap->cw);
+	row = malloc(stride);
+	if (row == NULL)
+		return -1;
 
-	for (j = bitmap->h - 1; j >= 0; j--) {
-		for (i = 0; i < bitmap->w; i++) {
-			r = fwritei24(bitmap->colors[i + j * bitmap->w], pf);
-			if (r != 0) return -1;
+	line = *bitmap;
+	line.ch = 1;
+	for (j = bitmap->ch - 1; j >= 0; j--) {
+		line.colors = bitmap->colors + (size_t)j * bitmap->cw;
+		bitmap_encode_rows(&line, row, stride);
+		if (fwrite(row, 1, stride, pf) != stride) {
+			r = -1;
+			break;
 		}
 	}
 
-	return 0;
+	free(row);
+	return r;
 }
 
 int bitmap_save(bitmap_t *bitmap, const char *filename)
@@ -41,17 +41,24 @@ extern "C" {
 
 typedef struct rbpoint_t {
 	rbnode_t rbentry;
-	dlitem_t dlentry;
 	int x, y;
 } rbpoint_t;
 
 typedef int color_t;
 
+/* 'w' x 'h' image, of which the 'cw' x 'ch' pixels at ('x0', 'y0')
+are held in 'colors' (all of them, unless it's a band or a tile).
+Drawing outside of the held pixels is clipped silently,
+outside of the image it fails with ERANGE. */
 typedef struct bitmap_t {
 	int w, h;
+	int x0, y0;
+	int cw, ch;
 	color_t *colors;
 } bitmap_t;
 
+#define BITMAP_HEADER_SIZE	54
+
 union piconvert_t {
 	int i;
 	void *p;
@@ -71,10 +78,64 @@ static inline void *itop(int i)
 	return c.p;
 }
 
+/* Render 'tree' with one thread per processor. */
 bitmap_t *rbtree_save_as_bitmap(rbtree_t *tree, asc16_t *asc16, int nil);
 
+/* Render 'tree' in tiles, shared out among 'threads' threads
+(0 for one per processor). The image is the same for any number. */
+bitmap_t *rbtree_render_bitmap(rbtree_t *tree, asc16_t *asc16, int nil, int threads);
+
+/* Render 'tree' as BMP into 'pf'. An image which fits in memory is
+rendered whole by rbtree_render_bitmap()'s 'threads' threads, a larger
+one (or any, when 'threads' is 1) band by band, one level of nodes each,
+so only a band of pixels is in memory whatever the size of the image.
+The file is the same either way.
+Returns 0, or -1 with errno set (EFBIG when it's too large for BMP). */
+int rbtree_write_bitmap(rbtree_t *tree, asc16_t *asc16, int nil, int threads, FILE *pf);
+
+/* Deep zoom pyramid over the layout of a tree. Level 'levels - 1' is
+the full resolution bitmap, every level below halves it, down to a
+pixel at level 0. Each level is cut into 'tile' x 'tile' tiles, rendered
+on demand. Below full resolution, subtrees narrower than a pixel are
+shaded by their density instead of drawn node by node.
+The pyramid keeps a copy of the layout, the tree can change afterwards
+(and the pyramid will show it as it was). */
+typedef struct rbpyramid_t {
+	int w, h;		/* full resolution */
+	int levels;
+	int tile;
+	struct rblayout_t *layout;
+} rbpyramid_t;
+
+#define RBPYRAMID_TILE_SIZE	256
+
+int rbpyramid_init(rbpyramid_t *pyr, rbtree_t *tree, asc16_t *asc16, int nil, int tile);
+
+void rbpyramid_free(rbpyramid_t *pyr);
+
+/* Size in pixels of the image at 'level'. */
+void rbpyramid_level_size(rbpyramid_t *pyr, int level, int *w, int *h);
+
+/* Render tile ('col', 'row') of 'level' into 'tile', a view of that level
+(release it with bitmap_free()). Fails with EINVAL if there's no such tile. */
+int rbpyramid_render_tile(rbpyramid_t *pyr, int level, int col, int row, bitmap_t *tile);
+
+/* Write 'tree' as SVG, with the same layout as the bitmap. */
+int rbtree_write_svg(rbtree_t *tree, int nil, FILE *pf);
+
+/* Write 'tree' as a Graphviz digraph, which 'dot' lays out itself.
+Walks the tree once, without a layout. */
+int rbtree_write_dot(rbtree_t *tree, int nil, FILE *pf);
+
 int bitmap_init(bitmap_t *bitmap, int w, int h, color_t bg);
 
+/* Init a bitmap which holds the 'cw' x 'ch' pixels at ('x0', 'y0')
+of a 'w' x 'h' image. */
+int bitmap_init_view(bitmap_t *bitmap, int w, int h,
+	int x0, int y0, int cw, int ch, color_t bg);
+
+void bitmap_fill(bitmap_t *bitmap, color_t c);
+
 void bitmap_free(bitmap_t *bitmap);
 
 /* convert key to string, it's thread-unsafe. */
@@ -97,6 +158,31 @@ int bitmap_draw_char(bitmap_t *bitmap, int ch, int x, int y, color_t color, asc1
 
 int bitmap_draw_string(bitmap_t *bitmap, char *str, int x, int y, color_t color, asc16_t *asc16);
 
+/* Glyphs of a font expanded into pixel masks in one color,
+so that text is drawn a glyph row at a time. */
+typedef struct glyph_cache_t glyph_cache_t;
+
+glyph_cache_t *glyph_cache_new(asc16_t *asc16, color_t color);
+
+void glyph_cache_free(glyph_cache_t *cache);
+
+int bitmap_draw_glyphs(bitmap_t *bitmap, const char *str, int x, int y, glyph_cache_t *cache);
+
+/* Draw the decimal digits of 'v', without formatting them first. */
+int bitmap_draw_int(bitmap_t *bitmap, int v, int x, int y, glyph_cache_t *cache);
+
+/* Width of bitmap_draw_int() text, in glyphs. */
+int bitmap_int_glyphs(int v);
+
+/* Bytes per row in a 24-bit BMP, padded to 4 bytes. */
+size_t bitmap_stride(int w);
+
+/* Write the BMP file header of a 'w' x 'h' 24-bit image. */
+int bitmap_write_header(int w, int h, FILE *pf);
+
+/* Encode the held rows bottom-up into 'buf', 'stride' bytes each. */
+void bitmap_encode_rows(bitmap_t *bitmap, unsigned char *buf, size_t stride);
+
 int bitmap_print(bitmap_t *bitmap, FILE *pf);
 
 int bitmap_save(bitmap_t *bitmap, const char *filename);
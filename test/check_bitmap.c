@@ -0,0 +1,127 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/* Bitmap rendering tests, run by 'make check'. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			return 1; \
+		} \
+	} while (0)
+
+static const int tree_sizes[] = { 0, 1, 7, 100, 400 };
+static const int thread_counts[] = { 2, 3, 8 };
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = ptoi(a), y = ptoi(b);
+	return x < y ? -1 : x > y;
+}
+
+/* Contents of a BMP written by 'threads', in 'buf'. */
+static int write_file(rbtree_t *tree, asc16_t *asc16, int nil, int threads,
+	char **buf, size_t *size)
+{
+	FILE *pf;
+	long len;
+
+	pf = tmpfile();
+	CHECK(pf != NULL);
+	CHECK(rbtree_write_bitmap(tree, asc16, nil, threads, pf) == 0);
+	CHECK(fflush(pf) == 0 && (len = ftell(pf)) > 0);
+	*size = (size_t)len;
+	*buf = malloc(*size);
+	CHECK(*buf != NULL);
+	rewind(pf);
+	CHECK(fread(*buf, 1, *size, pf) == *size);
+	fclose(pf);
+	return 0;
+}
+
+/* Any number of threads draws the same pixels, and the file written
+whole is the one written band by band. */
+static int test_render(int n, int nil, asc16_t *asc16)
+{
+	rbtree_t tree = RBTREE_INIT(keycmp);
+	rbpoint_t *points;
+	bitmap_t *one, *many;
+	char *bands, *whole;
+	size_t bands_size, whole_size;
+	int i, t;
+
+	points = calloc(n + 1, sizeof(rbpoint_t));
+	CHECK(points != NULL);
+	srand(n);
+	for (i = 0; i < n; i++) {
+		points[i].rbentry.key = itop(rand() % (n * 10));
+		rbtree_insert(&tree, &points[i].rbentry);
+	}
+
+	one = rbtree_render_bitmap(&tree, asc16, nil, 1);
+	CHECK(one != NULL);
+	for (t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+		many = rbtree_render_bitmap(&tree, asc16, nil, thread_counts[t]);
+		CHECK(many != NULL);
+		CHECK(many->w == one->w && many->h == one->h);
+		CHECK(memcmp(many->colors, one->colors,
+			(size_t)one->w * one->h * sizeof(color_t)) == 0);
+		bitmap_free(many);
+		free(many);
+	}
+	bitmap_free(one);
+	free(one);
+
+	CHECK(write_file(&tree, asc16, nil, 1, &bands, &bands_size) == 0);
+	CHECK(write_file(&tree, asc16, nil, 0, &whole, &whole_size) == 0);
+	CHECK(bands_size == whole_size && memcmp(bands, whole, bands_size) == 0);
+	free(bands);
+	free(whole);
+
+	free(points);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	asc16_t asc16;
+	int i, bad = 0;
+
+	asc16_builtin(&asc16);
+	for (i = 0; i < (int)(sizeof(tree_sizes) / sizeof(tree_sizes[0])); i++) {
+		bad += test_render(tree_sizes[i], 1, &asc16);
+		bad += test_render(tree_sizes[i], 0, &asc16);
+	}
+	asc16_free(&asc16);
+
+	printf("check_bitmap: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/* Flat combining tests, run by 'make check'. */
+
+#include <stdio.h>
+#include <string.h>
+
+/* the source itself, for the static fc_combine() */
+#include "../rbtree_fc.c"
+
+#define SLOTS		50
+#define KEYS		40
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			return 1; \
+		} \
+	} while (0)
+
+typedef struct item_t {
+	rbnode_t entry;
+	int key;
+} item_t;
+
+static item_t items[KEYS * 2];
+static int keys[SLOTS];
+
+static rbnode_t *node_of(item_t *it)
+{
+	return it == NULL ? NULL : &it->entry;
+}
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Publish a request in every slot without serving it, as the threads
+waiting in fc_execute() do, then run one combining pass over all of
+them. The batch must be applied in key order, and every slot must get
+the result of applying it at its place in that order. */
+static int test_batch(void)
+{
+	rbtree_fc_t fc;
+	rbfcslot_t slots[SLOTS], *s;
+	item_t *present[KEYS];	/* the expected tree */
+	int i, k, prev;
+
+	CHECK(rbtree_fc_init(&fc, keycmp, 0) == 0);
+	memset(present, 0, sizeof(present));
+	for (i = 0; i < KEYS * 2; i++) {
+		items[i].key = i % KEYS;
+		items[i].entry.key = &items[i].key;
+	}
+	for (k = 0; k < KEYS; k += 2) {
+		CHECK(rbtree_insert(&fc.tree, &items[k].entry) == 0);
+		present[k] = &items[k];
+	}
+
+	srand(1);
+	for (i = 0; i < SLOTS; i++) {
+		CHECK(rbtree_fc_register(&fc, &slots[i]) == 0);
+		s = &slots[i];
+		keys[i] = rand() % KEYS;
+		s->error = -1;
+		switch (i % 3) {
+		case 0:
+			s->node = &items[keys[i] + (i & 1 ? KEYS : 0)].entry;
+			s->op = FC_INSERT;
+			break;
+		case 1:
+			s->key = &keys[i];
+			s->op = FC_REMOVE;
+			break;
+		default:
+			s->key = &keys[i];
+			s->op = FC_LOOKUP;
+			break;
+		}
+	}
+	/* key 0 is removed, then inserted with another node (slots are
+	served in list order, latest registered first, for equal keys) */
+	keys[0] = 0;
+	slots[0].node = &items[KEYS].entry;
+	keys[1] = 0;
+
+	pthread_mutex_lock(&fc.lock);
+	fc_combine(&fc);
+	pthread_mutex_unlock(&fc.lock);
+
+	CHECK(fc.batches == 1 && fc.combined == SLOTS);
+
+	/* replay the batch in the order the combiner left it */
+	prev = -1;
+	for (i = 0; i < SLOTS; i++) {
+		s = fc.batch[i];
+		CHECK(s->op == 0);
+		CHECK(s >= &slots[0] && s < &slots[SLOTS]);
+		k = keys[s - slots];
+		CHECK(k >= prev);
+		prev = k;
+		switch ((s - slots) % 3) {
+		case 0:
+			if (present[k] != NULL) {
+				CHECK(s->error == EEXIST && s->node == NULL);
+			}
+			else {
+				CHECK(s->error == 0 && s->node != NULL);
+				present[k] = (item_t *)s->node;
+			}
+			break;
+		case 1:
+			CHECK(s->error == 0 && s->node == node_of(present[k]));
+			present[k] = NULL;
+			break;
+		default:
+			CHECK(s->error == 0 && s->node == node_of(present[k]));
+			break;
+		}
+	}
+
+	CHECK(slots[1].node == &items[0].entry && slots[0].error == 0);
+	for (k = 0; k < KEYS; k++)
+		CHECK(rbtree_lookup(&fc.tree, &k) == node_of(present[k]));
+
+	rbtree_fc_destroy(&fc);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int bad = 0;
+
+	bad += test_batch();
+
+	printf("check_fc: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
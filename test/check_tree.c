@@ -0,0 +1,238 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/* Red-black invariants after random updates, run by 'make check'. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "../rbtree_mt.h"
+
+#define KEYS		2000
+#define OPS			200000
+#define CHECK_EVERY	997
+#define THREADS		8
+#define MT_OPS		100000
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			return 1; \
+		} \
+	} while (0)
+
+typedef struct item_t {
+	rbmtnode_t entry;
+	int key;
+	int in;		/* in the tree, only touched by the thread owning the key */
+} item_t;
+
+static item_t items[KEYS];
+
+static rbtree_mt_t mt;
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Returns the black height of 'n', or -1 if the subtree is broken:
+a child not pointing back to its parent, a red node with a red child,
+paths with different numbers of black nodes, keys out of order. */
+static int black_height(rbtree_t *tree, rbnode_t *n, rbnode_t **prev, size_t *count)
+{
+	int left, right;
+
+	if (rbnode_is_nil(n))
+		return 0;
+
+	if ((!rbnode_is_nil(n->left) && n->left->parent != n) ||
+		(!rbnode_is_nil(n->right) && n->right->parent != n))
+		return -1;
+	if (rbnode_is_red(n) && (rbnode_is_red(n->left) || rbnode_is_red(n->right)))
+		return -1;
+	if (n->flags != 0 || !rbnode_is_nil(n->dup))
+		return -1;
+
+	if ((left = black_height(tree, n->left, prev, count)) < 0)
+		return -1;
+	if (*prev != NULL && tree->keycmp((*prev)->key, n->key) >= 0)
+		return -1;
+	*prev = n;
+	(*count)++;
+	if ((right = black_height(tree, n->right, prev, count)) < 0 || left != right)
+		return -1;
+
+	return left + rbnode_is_black(n);
+}
+
+/* Check the whole tree, which should hold the keys with 'in' set. */
+static int check_tree(rbtree_t *tree)
+{
+	rbnode_t *prev = NULL, *n;
+	size_t count = 0, in = 0;
+	int i;
+
+	CHECK(rbnode_is_nil(tree->root) ||
+		(rbnode_is_nil(tree->root->parent) && rbnode_is_black(tree->root)));
+	CHECK(black_height(tree, tree->root, &prev, &count) >= 0);
+	CHECK(count == tree->count && tree->tombstones == 0);
+
+	for (n = tree->root; !rbnode_is_nil(n) && !rbnode_is_nil(n->left); n = n->left)
+		;
+	CHECK(tree->leftmost == n);
+
+	for (i = 0; i < KEYS; i++) {
+		n = rbtree_lookup(tree, &items[i].key);
+		CHECK(n == (items[i].in ? &items[i].entry.base : NULL));
+		in += items[i].in;
+	}
+	CHECK(count == in);
+	return 0;
+}
+
+static void reset(void)
+{
+	int i;
+
+	for (i = 0; i < KEYS; i++) {
+		items[i].key = i;
+		items[i].entry.base.key = &items[i].key;
+		items[i].in = 0;
+	}
+}
+
+/* A random mix of the bottom-up and top-down insert and remove. */
+static int test_random(void)
+{
+	rbtree_t tree = RBTREE_INIT(keycmp);
+	item_t *it;
+	int i, r;
+
+	reset();
+	srand(1);
+	for (i = 0; i < OPS; i++) {
+		it = items + rand() % KEYS;
+		switch (rand() % 4) {
+		case 0:
+			r = rbtree_insert(&tree, &it->entry.base);
+			CHECK(it->in ? r == -1 && errno == EEXIST : r == 0);
+			it->in = 1;
+			break;
+		case 1:
+			r = rbtree_insert_topdown(&tree, &it->entry.base);
+			CHECK(it->in ? r == -1 && errno == EEXIST : r == 0);
+			it->in = 1;
+			break;
+		case 2:
+			if (it->in)
+				rbtree_remove(&tree, &it->entry.base);
+			it->in = 0;
+			break;
+		default:
+			CHECK(rbtree_remove_topdown(&tree, &it->key) ==
+				(it->in ? &it->entry.base : NULL));
+			it->in = 0;
+			break;
+		}
+		if (i % CHECK_EVERY == 0)
+			CHECK(check_tree(&tree) == 0);
+	}
+	CHECK(check_tree(&tree) == 0);
+	return 0;
+}
+
+static int found(rbtree_t *tree, rbnode_t *n, void *state)
+{
+	return n == state ? 0 : 1;
+}
+
+/* Thread 'id' works on the keys k with k % THREADS == id, so it knows
+what every call must return. Returns the number of wrong results. */
+static void *worker(void *arg)
+{
+	int id = (int)(long)arg, i, r, bad = 0;
+	unsigned int seed = (unsigned int)id + 1;
+	item_t *it;
+
+	for (i = 0; i < MT_OPS; i++) {
+		it = items + (rand_r(&seed) % (KEYS / THREADS)) * THREADS + id;
+		if (rand_r(&seed) & 1) {
+			r = rbtree_mt_lookup(&mt, &it->key, found, &it->entry.base);
+			bad += it->in ? r != 0 : r != -1;
+		}
+		else if (it->in) {
+			bad += rbtree_mt_remove(&mt, &it->key) != &it->entry;
+			it->in = 0;
+		}
+		else {
+			bad += rbtree_mt_insert(&mt, &it->entry) != 0;
+			it->in = 1;
+		}
+	}
+	return (void *)(long)bad;
+}
+
+/* The tree left by concurrent lock coupled updates. */
+static int test_mt(void)
+{
+	pthread_t threads[THREADS];
+	void *bad;
+	int i;
+
+	reset();
+	CHECK(rbtree_mt_init(&mt, keycmp) == 0);
+	for (i = 0; i < KEYS; i++)
+		CHECK(rbmtnode_init(&items[i].entry) == 0);
+
+	for (i = 0; i < THREADS; i++)
+		CHECK(pthread_create(&threads[i], NULL, worker, (void *)(long)i) == 0);
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &bad);
+		CHECK(bad == NULL);
+	}
+
+	CHECK(check_tree(&mt.tree) == 0);
+	CHECK(rbtree_mt_size(&mt) == mt.tree.count);
+
+	for (i = 0; i < KEYS; i++)
+		rbmtnode_destroy(&items[i].entry);
+	rbtree_mt_destroy(&mt);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int bad = 0;
+
+	bad += test_random();
+	bad += test_mt();
+
+	printf("check_tree: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/* Recovery tests of rbtree_wal, run by 'make check'. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "../rbtree_wal.h"
+
+#define LOG_PATH	"test/check_wal.log"
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+			return 1; \
+		} \
+	} while (0)
+
+typedef struct item_t {
+	rbnode_t entry;
+	int key;
+	int freed;	/* marked instead of freed, so a use after free is seen */
+} item_t;
+
+static int fail_key = -1;	/* encoding this key fails */
+
+static int keycmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+static item_t *new_item(int key)
+{
+	item_t *it = calloc(1, sizeof(item_t));
+	if (it == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	it->key = key;
+	it->entry.key = &it->key;
+	return it;
+}
+
+static int encode(const void *key, void *buf, size_t size, void *state)
+{
+	if (*(const int *)key == fail_key)
+		return -1;
+	if (size >= sizeof(int))
+		memcpy(buf, key, sizeof(int));
+	return sizeof(int);
+}
+
+static rbnode_t *decode(const void *buf, size_t size, void *state)
+{
+	int key;
+
+	if (size != sizeof(int))
+		return NULL;
+	memcpy(&key, buf, sizeof(int));
+	return &new_item(key)->entry;
+}
+
+static void free_item(rbnode_t *n, void *state)
+{
+	((item_t *)n)->freed = 1;
+}
+
+static void cleanup(void)
+{
+	remove(LOG_PATH);
+	remove(LOG_PATH ".ckpt");
+	remove(LOG_PATH ".ckpt.tmp");
+}
+
+static int reopen(rbwal_t *wal, rbtree_t *tree, unsigned int flags)
+{
+	rbtree_init_ex(tree, keycmp, flags);
+	return rbwal_open(wal, tree, LOG_PATH, encode, decode, free_item, NULL);
+}
+
+/* The live keys are 'keys', there are no tombstones left, and no freed
+node is linked. */
+static int check_keys(rbtree_t *tree, const int *keys, int n)
+{
+	rbnode_t *node;
+	item_t *it;
+	int i = 0;
+
+	CHECK(tree->count == (size_t)n);
+	CHECK(tree->tombstones == 0 && tree->graveyard == NULL);
+	for (node = rbtree_first(tree); node != NULL; node = rbtree_next(tree, node)) {
+		it = (item_t *)node;
+		CHECK(i < n && it->key == keys[i] && !it->freed);
+		i++;
+	}
+	CHECK(i == n);
+	return 0;
+}
+
+/* Insert 1..5, remove 3, remove 4 and insert another node for it,
+remove 2 and insert the same node again, then recover. */
+static int test_recover(unsigned int flags)
+{
+	static const int keys[] = { 1, 2, 4, 5 };
+	rbwal_t wal;
+	rbtree_t tree;
+	item_t *items[6];
+	int i;
+
+	cleanup();
+	CHECK(reopen(&wal, &tree, flags) == 0);
+	for (i = 1; i <= 5; i++) {
+		items[i] = new_item(i);
+		CHECK(rbwal_insert(&wal, &items[i]->entry) == 0);
+	}
+	CHECK(rbwal_remove(&wal, &items[3]->entry) == 0);
+	CHECK(rbwal_remove(&wal, &items[4]->entry) == 0);
+	CHECK(rbwal_insert(&wal, &new_item(4)->entry) == 0);
+	CHECK(rbwal_remove(&wal, &items[2]->entry) == 0);
+	CHECK(rbwal_insert(&wal, &items[2]->entry) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+
+	CHECK(reopen(&wal, &tree, flags) == 0);
+	CHECK(check_keys(&tree, keys, 4) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+	return 0;
+}
+
+/* A failed rbwal_insert() leaves the tree and the log as they were,
+a tombstone of the key included. */
+static int test_insert_fails(unsigned int flags)
+{
+	static const int keys[] = { 1, 2 };
+	rbwal_t wal;
+	rbtree_t tree;
+	item_t *three;
+	size_t len;
+	int i;
+
+	cleanup();
+	CHECK(reopen(&wal, &tree, flags) == 0);
+	for (i = 1; i <= 3; i++)
+		CHECK(rbwal_insert(&wal, &new_item(i)->entry) == 0);
+	i = 3;
+	three = (item_t *)rbtree_lookup(&tree, &i);
+	CHECK(rbwal_remove(&wal, &three->entry) == 0);
+	if (!(flags & RBTREE_LAZY_DELETE))
+		free_item(&three->entry, NULL);
+
+	len = wal.len;
+	fail_key = 3;
+	CHECK(rbwal_insert(&wal, &new_item(3)->entry) == -1 && errno == EINVAL);
+	fail_key = -1;
+	CHECK(rbwal_insert(&wal, &new_item(1)->entry) == -1 && errno == EEXIST);
+	CHECK(wal.len == len && rbtree_lookup(&tree, &i) == NULL);
+	CHECK(rbtree_size(&tree) == 2);
+	CHECK(tree.tombstones == (flags & RBTREE_LAZY_DELETE ? 1u : 0u));
+	CHECK(rbwal_close(&wal) == 0);
+
+	CHECK(reopen(&wal, &tree, flags) == 0);
+	CHECK(check_keys(&tree, keys, 2) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+	return 0;
+}
+
+/* A write which stops in the middle of a record goes on from there
+when retried, instead of writing the record again after the torn part. */
+static int test_short_write(void)
+{
+	int keys[40];
+	rbwal_t wal;
+	rbtree_t tree;
+	struct rlimit lim, old;
+	struct stat st;
+	int i;
+
+	cleanup();
+	CHECK(reopen(&wal, &tree, 0) == 0);
+	wal.group = 0;
+	wal.checkpoint_interval = 0;
+	for (i = 0; i < 40; i++) {
+		keys[i] = i;
+		if (i == 20) {
+			CHECK(rbwal_sync(&wal) == 0);
+			CHECK(fstat(wal.fd, &st) == 0);
+			CHECK(getrlimit(RLIMIT_FSIZE, &old) == 0);
+			lim = old;
+			lim.rlim_cur = st.st_size + 30;
+			CHECK(setrlimit(RLIMIT_FSIZE, &lim) == 0);
+		}
+		CHECK(rbwal_insert(&wal, &new_item(i)->entry) == 0);
+	}
+	CHECK(rbwal_sync(&wal) == -1 && errno == EFBIG);
+	CHECK(wal.len > 0);
+	CHECK(setrlimit(RLIMIT_FSIZE, &old) == 0);
+	CHECK(rbwal_sync(&wal) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+
+	CHECK(reopen(&wal, &tree, 0) == 0);
+	CHECK(check_keys(&tree, keys, 40) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+	return 0;
+}
+
+/* After a failed fsync nothing is reported durable until a checkpoint. */
+static int test_failed_fsync(void)
+{
+	static const int keys[] = { 1, 2 };
+	rbwal_t wal;
+	rbtree_t tree;
+
+	cleanup();
+	CHECK(reopen(&wal, &tree, 0) == 0);
+	wal.group = 0;
+	CHECK(rbwal_insert(&wal, &new_item(1)->entry) == 0);
+	wal.failed = EIO;	/* as rbwal_sync() leaves it */
+	CHECK(rbwal_sync(&wal) == -1 && errno == EIO);
+	CHECK(rbwal_insert(&wal, &new_item(2)->entry) == 0);
+	CHECK(rbwal_sync(&wal) == -1 && errno == EIO);
+	CHECK(rbwal_checkpoint(&wal) == 0);
+	CHECK(rbwal_sync(&wal) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+
+	CHECK(reopen(&wal, &tree, 0) == 0);
+	CHECK(check_keys(&tree, keys, 2) == 0);
+	CHECK(rbwal_close(&wal) == 0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int bad = 0;
+
+	signal(SIGXFSZ, SIG_IGN);
+
+	bad += test_recover(0);
+	bad += test_recover(RBTREE_LAZY_DELETE);
+	bad += test_insert_fails(0);
+	bad += test_insert_fails(RBTREE_LAZY_DELETE);
+	bad += test_short_write();
+	bad += test_failed_fsync();
+	cleanup();
+
+	printf("check_wal: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,333 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FASTLOAD_SSE2
+#endif
+
+#include "fastload.h"
+
+#define VALUES_MIN		1024
+#define RADIX_BITS		11
+#define RADIX_SIZE		(1 << RADIX_BITS)
+
+/* Scanner state, carried across chunks. */
+typedef struct scan_t {
+	int *values;
+	size_t count;
+	size_t cap;
+	unsigned int v;		/* value being parsed */
+	int in;				/* inside a number */
+	int error;
+} scan_t;
+
+static int emit(scan_t *s)
+{
+	int *values;
+	size_t cap;
+
+	if (s->count == s->cap) {
+		cap = s->cap ? s->cap * 2 : VALUES_MIN;
+		values = realloc(s->values, cap * sizeof(int));
+		if (values == NULL) {
+			s->error = ENOMEM;
+			return -1;
+		}
+		s->values = values;
+		s->cap = cap;
+	}
+	s->values[s->count++] = (int)s->v;
+	s->v = 0;
+	s->in = 0;
+	return 0;
+}
+
+static int digit(scan_t *s, int ch)
+{
+	unsigned int d = (unsigned int)(ch - '0');
+	if (s->v > (INT_MAX - d) / 10) {
+		s->error = ERANGE;
+		return -1;
+	}
+	s->v = s->v * 10 + d;
+	s->in = 1;
+	return 0;
+}
+
+#define is_space(ch) ((ch) == ' ' || ((ch) >= '\t' && (ch) <= '\r'))
+
+static int scan_scalar(scan_t *s, const unsigned char *p, const unsigned char *end)
+{
+	int ch;
+
+	for (; p < end; p++) {
+		ch = *p;
+		if (ch >= '0' && ch <= '9') {
+			if (digit(s, ch) != 0)
+				return -1;
+		}
+		else if (is_space(ch)) {
+			if (s->in && emit(s) != 0)
+				return -1;
+		}
+		else {
+			s->error = EINVAL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#ifdef FASTLOAD_SSE2
+
+static int ctz(unsigned int m)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, m);
+	return (int)i;
+#else
+	return __builtin_ctz(m);
+#endif
+}
+
+/* 'm' has a bit for every digit of the 16 bytes at 'p',
+runs of digits are parsed, runs of white space end the number. */
+static int scan_chunk(scan_t *s, const unsigned char *p, unsigned int m)
+{
+	int i = 0, end;
+
+	while (i < 16) {
+		if ((m >> i) & 1) {
+			end = i + ctz(~(m >> i));
+			for (; i < end; i++) {
+				if (digit(s, p[i]) != 0)
+					return -1;
+			}
+		}
+		else {
+			if (s->in && emit(s) != 0)
+				return -1;
+			i = (m >> i) ? i + ctz(m >> i) : 16;
+		}
+	}
+	return 0;
+}
+
+static int scan(scan_t *s, const unsigned char *p, size_t size)
+{
+	const unsigned char *end = p + size;
+	const __m128i zero = _mm_set1_epi8('0' - 1), nine = _mm_set1_epi8('9' + 1);
+	const __m128i tab = _mm_set1_epi8('\t' - 1), cr = _mm_set1_epi8('\r' + 1);
+	const __m128i blank = _mm_set1_epi8(' ');
+	__m128i c, d, w;
+	unsigned int m, valid;
+
+	for (; end - p >= 16; p += 16) {
+		c = _mm_loadu_si128((const __m128i *)p);
+		d = _mm_and_si128(_mm_cmpgt_epi8(c, zero), _mm_cmplt_epi8(c, nine));
+		w = _mm_or_si128(_mm_cmpeq_epi8(c, blank),
+			_mm_and_si128(_mm_cmpgt_epi8(c, tab), _mm_cmplt_epi8(c, cr)));
+		m = (unsigned int)_mm_movemask_epi8(d);
+		valid = m | (unsigned int)_mm_movemask_epi8(w);
+		if (valid != 0xffff) {
+			s->error = EINVAL;
+			return -1;
+		}
+		if (m == 0) {
+			/* all white space */
+			if (s->in && emit(s) != 0)
+				return -1;
+			continue;
+		}
+		if (scan_chunk(s, p, m) != 0)
+			return -1;
+	}
+
+	return scan_scalar(s, p, end);
+}
+
+#else
+
+#define scan(s, p, size) scan_scalar((s), (p), (p) + (size))
+
+#endif
+
+#ifdef _WIN32
+
+static int scan_file(scan_t *s, const char *path, size_t *bytes)
+{
+	FILE *pf;
+	unsigned char *buf;
+	long size;
+	int r;
+
+	pf = fopen(path, "rb");
+	if (pf == NULL)
+		return -1;
+	if (fseek(pf, 0, SEEK_END) != 0 || (size = ftell(pf)) < 0 || fseek(pf, 0, SEEK_SET) != 0) {
+		fclose(pf);
+		return -1;
+	}
+	buf = malloc(size > 0 ? size : 1);
+	if (buf == NULL) {
+		fclose(pf);
+		return -1;
+	}
+	if (fread(buf, 1, size, pf) != (size_t)size) {
+		free(buf);
+		fclose(pf);
+		errno = EIO;
+		return -1;
+	}
+	fclose(pf);
+
+	*bytes = (size_t)size;
+	r = scan(s, buf, (size_t)size);
+	free(buf);
+	return r;
+}
+
+#else
+
+static int scan_file(scan_t *s, const char *path, size_t *bytes)
+{
+	struct stat st;
+	void *map;
+	int fd, r;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	*bytes = (size_t)st.st_size;
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	r = scan(s, map, (size_t)st.st_size);
+	munmap(map, (size_t)st.st_size);
+	return r;
+}
+
+#endif
+
+int fastload_parse(const char *path, int **values, size_t *count, size_t *bytes)
+{
+	scan_t s;
+	size_t size = 0;
+
+	memset(&s, 0, sizeof(scan_t));
+
+	if (scan_file(&s, path, &size) != 0) {
+		if (s.error != 0)
+			errno = s.error;
+		free(s.values);
+		return -1;
+	}
+	if (s.in && emit(&s) != 0) {
+		free(s.values);
+		errno = s.error;
+		return -1;
+	}
+
+	*values = s.values;
+	*count = s.count;
+	if (bytes != NULL)
+		*bytes = size;
+	return 0;
+}
+
+size_t fastload_sort_unique(int *values, size_t count)
+{
+	size_t hist[RADIX_SIZE], i, j, sum, t;
+	unsigned int shift, max = 0, d;
+	int *tmp, *src = values, *dst;
+
+	if (count < 2)
+		return count;
+
+	tmp = malloc(count * sizeof(int));
+	if (tmp == NULL)
+		return (size_t)-1;
+	dst = tmp;
+
+	for (i = 0; i < count; i++) {
+		if ((unsigned int)values[i] > max)
+			max = (unsigned int)values[i];
+	}
+
+	/* skip the passes of digits which are zero everywhere */
+	for (shift = 0; shift < 32 && (max >> shift) != 0; shift += RADIX_BITS) {
+		memset(hist, 0, sizeof(hist));
+		for (i = 0; i < count; i++)
+			hist[((unsigned int)src[i] >> shift) & (RADIX_SIZE - 1)]++;
+		for (d = 0, sum = 0; d < RADIX_SIZE; d++) {
+			t = hist[d];
+			hist[d] = sum;
+			sum += t;
+		}
+		for (i = 0; i < count; i++)
+			dst[hist[((unsigned int)src[i] >> shift) & (RADIX_SIZE - 1)]++] = src[i];
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	/* 'src' holds the sorted values, 'dst' is the other buffer */
+	for (i = 1, j = 1; i < count; i++) {
+		if (src[i] != src[j - 1])
+			src[j++] = src[i];
+	}
+	if (src != values)
+		memcpy(values, src, j * sizeof(int));
+	free(src == values ? dst : src);
+
+	return j;
+}
@@ -0,0 +1,57 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifndef FASTLOAD_H_
+#define FASTLOAD_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bulk loader of text data files, the format of "load":
+non-negative decimal integers separated by white space.
+
+The file is mapped (read in one go on Windows) and scanned 16 bytes
+at a time with SSE2 where available, which classifies digits and white
+space of a whole chunk at once and jumps over runs of them. */
+
+/* Parse all integers of 'path' into a malloc'ed array, in file order.
+'bytes' (if not NULL) gets the size of the file.
+Returns 0 on success, otherwise -1 and errno is set
+(EINVAL for other characters, ERANGE for values above INT_MAX). */
+int fastload_parse(const char *path, int **values, size_t *count, size_t *bytes);
+
+/* Sort non-negative values in place (LSD radix sort), then drop
+repeated ones. Returns the number of distinct values,
+or (size_t)-1 when out of memory. */
+size_t fastload_sort_unique(int *values, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,469 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "snapshot.h"
+#include "../rbtree_wal.h"
+#include "bitmap.h"
+
+#define MAGIC			"RBSNAP01"
+#define MAGIC_SIZE		8
+#define HEADER_SIZE		32		/* magic, u32 block size, u32 checksum, u64 keys, u64 blocks */
+#define BLOCK_HEAD		16		/* u32 keys, u32 first key, u32 payload size, u32 checksum */
+#define VARINT_MAX		5
+
+/* Fewest keys in a full block, with every delta taking VARINT_MAX bytes. */
+#define BLOCK_KEYS_MIN	(1 + (SNAPSHOT_BLOCK_SIZE - BLOCK_HEAD) / VARINT_MAX)
+
+/* Don't start a thread for fewer keys. */
+#define PART_KEYS_MIN	(64 * 1024)
+
+/* Blocks of a range of keys. */
+typedef struct part_t {
+	const uint32_t *keys;
+	size_t count;
+	unsigned char *blocks;
+	size_t nblocks;
+	size_t size;		/* bytes to write, the last block of the file is cut */
+	uint64_t offset;
+	int fd;
+	int error;
+} part_t;
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)v);
+	put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+/* FNV-1a, continues from 'h'. */
+static uint32_t checksum(uint32_t h, const unsigned char *p, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+#define CHECKSUM_INIT	2166136261u
+
+static uint32_t block_checksum(const unsigned char *block, size_t payload)
+{
+	uint32_t h = checksum(CHECKSUM_INIT, block, 12);
+	return checksum(h, block + BLOCK_HEAD, payload);
+}
+
+static uint32_t header_checksum(const unsigned char *header)
+{
+	uint32_t h = checksum(CHECKSUM_INIT, header, 12);
+	return checksum(h, header + 16, HEADER_SIZE - 16);
+}
+
+static int encode_part(part_t *part)
+{
+	const uint32_t *keys = part->keys;
+	unsigned char *block, *p, *end;
+	uint32_t prev, delta;
+	size_t i = 0, n, cap;
+
+	cap = part->count / BLOCK_KEYS_MIN + 1;
+	part->blocks = calloc(cap, SNAPSHOT_BLOCK_SIZE);
+	if (part->blocks == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	part->nblocks = 0;
+	part->size = 0;
+	while (i < part->count) {
+		block = part->blocks + part->nblocks * SNAPSHOT_BLOCK_SIZE;
+		p = block + BLOCK_HEAD;
+		end = block + SNAPSHOT_BLOCK_SIZE;
+
+		prev = keys[i++];
+		put_u32(block + 4, prev);
+		for (n = 1; i < part->count && end - p >= VARINT_MAX; i++, n++) {
+			delta = keys[i] - prev;
+			prev = keys[i];
+			while (delta >= 0x80) {
+				*p++ = (unsigned char)(delta | 0x80);
+				delta >>= 7;
+			}
+			*p++ = (unsigned char)delta;
+		}
+
+		put_u32(block, (uint32_t)n);
+		put_u32(block + 8, (uint32_t)(p - block - BLOCK_HEAD));
+		put_u32(block + 12, block_checksum(block, p - block - BLOCK_HEAD));
+
+		part->size = part->nblocks * SNAPSHOT_BLOCK_SIZE + (p - block);
+		part->nblocks++;
+	}
+
+	return 0;
+}
+
+/* In-order keys of the tree. */
+static uint32_t *collect_keys(rbtree_t *tree, size_t *count)
+{
+	uint32_t *keys;
+	rbnode_t *n;
+	size_t i = 0;
+
+	keys = malloc((rbtree_size(tree) + 1) * sizeof(uint32_t));
+	if (keys == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (n = rbtree_first(tree); n != NULL; n = rbtree_next(tree, n))
+		keys[i++] = (uint32_t)ptoi(n->key);
+
+	*count = i;
+	return keys;
+}
+
+#ifdef _WIN32
+
+static int encode_parts(part_t *parts, int nparts)
+{
+	int i;
+	for (i = 0; i < nparts; i++) {
+		if (encode_part(&parts[i]) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int write_parts(part_t *parts, int nparts, const char *path,
+	const unsigned char *header)
+{
+	FILE *pf;
+	int i;
+
+	pf = fopen(path, "wb");
+	if (pf == NULL)
+		return -1;
+
+	if (fwrite(header, 1, HEADER_SIZE, pf) != HEADER_SIZE)
+		goto error;
+	for (i = 0; i < nparts; i++) {
+		if (fwrite(parts[i].blocks, 1, parts[i].size, pf) != parts[i].size)
+			goto error;
+	}
+	return fclose(pf);
+
+error:
+	fclose(pf);
+	return -1;
+}
+
+#else
+
+static void *encode_worker(void *arg)
+{
+	part_t *part = arg;
+	part->error = encode_part(part) == 0 ? 0 : errno;
+	return NULL;
+}
+
+static void *write_worker(void *arg)
+{
+	part_t *part = arg;
+	const unsigned char *p = part->blocks;
+	size_t left = part->size;
+	off_t offset = (off_t)part->offset;
+	ssize_t r;
+
+	part->error = 0;
+	while (left > 0) {
+		r = pwrite(part->fd, p, left, offset);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			part->error = errno;
+			break;
+		}
+		p += r;
+		left -= r;
+		offset += r;
+	}
+	return NULL;
+}
+
+/* Run 'fn' for each part, all but the first one on their own threads. */
+static int run_parts(part_t *parts, int nparts, void *(*fn)(void *))
+{
+	pthread_t threads[SNAPSHOT_THREADS_MAX];
+	int i, started;
+
+	for (started = 1; started < nparts; started++) {
+		if (pthread_create(&threads[started], NULL, fn, &parts[started]) != 0)
+			break;
+	}
+	/* out of threads, do the rest here */
+	for (i = started; i < nparts; i++)
+		fn(&parts[i]);
+	fn(&parts[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nparts; i++) {
+		if (parts[i].error != 0) {
+			errno = parts[i].error;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int encode_parts(part_t *parts, int nparts)
+{
+	return run_parts(parts, nparts, encode_worker);
+}
+
+static int write_parts(part_t *parts, int nparts, const char *path,
+	const unsigned char *header)
+{
+	int fd, i, err;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	for (i = 0; i < nparts; i++)
+		parts[i].fd = fd;
+
+	if (pwrite(fd, header, HEADER_SIZE, 0) != HEADER_SIZE ||
+		run_parts(parts, nparts, write_worker) != 0 ||
+		fsync(fd) != 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return close(fd);
+}
+
+#endif
+
+int snapshot_save(rbtree_t *tree, const char *path, int threads)
+{
+	part_t parts[SNAPSHOT_THREADS_MAX];
+	unsigned char header[HEADER_SIZE];
+	uint32_t *keys;
+	uint64_t offset = HEADER_SIZE, blocks = 0;
+	size_t count, per, i;
+	char *tmp = NULL;
+	int nparts, r = -1, err;
+
+	if ((keys = collect_keys(tree, &count)) == NULL)
+		return -1;
+
+#ifdef _WIN32
+	threads = 1;
+#else
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (threads > SNAPSHOT_THREADS_MAX)
+		threads = SNAPSHOT_THREADS_MAX;
+	nparts = (int)(count / PART_KEYS_MIN);
+	if (nparts > threads)
+		nparts = threads;
+	if (nparts < 1)
+		nparts = 1;
+
+	/* every part but the last ends with a padded block */
+	per = (count + nparts - 1) / nparts;
+	memset(parts, 0, sizeof(parts));
+	for (i = 0; i < (size_t)nparts; i++) {
+		parts[i].keys = keys + i * per;
+		parts[i].count = i + 1 < (size_t)nparts ? per : count - i * per;
+	}
+
+	if (encode_parts(parts, nparts) != 0)
+		goto done;
+
+	for (i = 0; i < (size_t)nparts; i++) {
+		parts[i].offset = offset;
+		offset += parts[i].nblocks * (uint64_t)SNAPSHOT_BLOCK_SIZE;
+		blocks += parts[i].nblocks;
+	}
+
+	memcpy(header, MAGIC, MAGIC_SIZE);
+	put_u32(header + 8, SNAPSHOT_BLOCK_SIZE);
+	put_u64(header + 16, count);
+	put_u64(header + 24, blocks);
+	put_u32(header + 12, header_checksum(header));
+
+	tmp = malloc(strlen(path) + 5);
+	if (tmp == NULL) {
+		errno = ENOMEM;
+		goto done;
+	}
+	strcpy(tmp, path);
+	strcat(tmp, ".tmp");
+
+	if (write_parts(parts, nparts, tmp, header) != 0) {
+		err = errno;
+		remove(tmp);
+		errno = err;
+		goto done;
+	}
+
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(tmp, path) != 0) {
+		err = errno;
+		remove(tmp);
+		errno = err;
+		goto done;
+	}
+	if (rbwal_sync_dir(path) != 0)
+		goto done;
+
+	r = 0;
+
+done:
+	err = errno;
+	for (i = 0; i < (size_t)nparts; i++)
+		free(parts[i].blocks);
+	free(keys);
+	free(tmp);
+	errno = err;
+	return r;
+}
+
+int snapshot_load(const char *path, int (*fn)(int key, void *state), void *state)
+{
+	unsigned char header[HEADER_SIZE], *block = NULL, *p, *end;
+	uint64_t count, blocks, b, loaded = 0;
+	uint32_t key, delta, n, k, size;
+	size_t len;
+	FILE *pf;
+	int r = -1, shift, err;
+
+	pf = fopen(path, "rb");
+	if (pf == NULL)
+		return -1;
+
+	if (fread(header, 1, HEADER_SIZE, pf) != HEADER_SIZE ||
+		memcmp(header, MAGIC, MAGIC_SIZE) != 0 ||
+		get_u32(header + 8) != SNAPSHOT_BLOCK_SIZE ||
+		get_u32(header + 12) != header_checksum(header)) {
+		errno = EINVAL;
+		goto done;
+	}
+	count = get_u64(header + 16);
+	blocks = get_u64(header + 24);
+
+	block = malloc(SNAPSHOT_BLOCK_SIZE);
+	if (block == NULL) {
+		errno = ENOMEM;
+		goto done;
+	}
+
+	for (b = 0; b < blocks; b++) {
+		len = fread(block, 1, SNAPSHOT_BLOCK_SIZE, pf);
+		if (len < BLOCK_HEAD) {
+			errno = EINVAL;
+			goto done;
+		}
+		n = get_u32(block);
+		size = get_u32(block + 8);
+		if (n == 0 || size > len - BLOCK_HEAD ||
+			get_u32(block + 12) != block_checksum(block, size)) {
+			errno = EINVAL;
+			goto done;
+		}
+
+		p = block + BLOCK_HEAD;
+		end = p + size;
+		key = get_u32(block + 4);
+		for (k = 0; ; ) {
+			if ((r = fn((int)key, state)) != 0)
+				goto done;
+			r = -1;
+			if (++k == n)
+				break;
+			delta = 0;
+			shift = 0;
+			do {
+				if (p == end || shift > 28) {
+					errno = EINVAL;
+					goto done;
+				}
+				delta |= (uint32_t)(*p & 0x7f) << shift;
+				shift += 7;
+			} while (*p++ & 0x80);
+			key += delta;
+		}
+		loaded += n;
+	}
+
+	if (loaded != count) {
+		errno = EINVAL;
+		goto done;
+	}
+	r = 0;
+
+done:
+	err = errno;
+	free(block);
+	fclose(pf);
+	errno = err;
+	return r;
+}
@@ -0,0 +1,65 @@
+/*
+* MIT License
+*
+* Copyright (c) 2017 Gang Zhuo <gang.zhuo@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h>
+#include "../rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Binary snapshot of integer keys.
+
+File: header, then blocks of SNAPSHOT_BLOCK_SIZE bytes (the last one
+is cut after its data). A block holds the number of keys, the first key,
+the size of the payload and a checksum, then the deltas of the following
+keys to their predecessor as unsigned LEB128 varints. Keys are in order,
+so most deltas take one or two bytes.
+
+Blocks are encoded and written by several threads, each for a range of
+the keys, into '<path>.tmp', which is renamed to 'path' when complete,
+then the directory is synced so the rename survives a crash. */
+
+#define SNAPSHOT_BLOCK_SIZE		4096
+#define SNAPSHOT_THREADS_MAX	8
+
+/* Save the keys of 'tree' to 'path' with up to 'threads' threads,
+0 uses one per CPU.
+Returns 0 on success, otherwise -1 and errno is set. */
+int snapshot_save(rbtree_t *tree, const char *path, int threads);
+
+/* Call 'fn' for every key of the snapshot, in order.
+Stops when 'fn' returns non-zero, and returns that.
+Returns 0 on success, otherwise -1 and errno is set
+(EINVAL when the file is broken). */
+int snapshot_load(const char *path, int (*fn)(int key, void *state), void *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -29,17 +29,26 @@
 #include <ctype.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 #include "../rbtree.h"
+#include "../rbtree_wal.h"
 #include "asc16.h"
 #include "bitmap.h"
+#include "snapshot.h"
+#include "fastload.h"
+#include "bench.h"
 
 #ifdef _WIN32
 #define strcasecmp stricmp
 #endif
 
-#define COMMAND_MAX		8
+#define COMMAND_MAX		12
 #define OPTION_MAX		8
+#define POOL_CHUNK		4096
+#define BATCH_BUFSIZE	(64 * 1024)
+#define BENCH_KEYS		1000000
 
 typedef struct mesh_t {
 	int w, h;
@@ -55,11 +64,33 @@ typedef struct array_t {
 	int *array;
 } array_t;
 
+/* Points are carved from big chunks, freed ones are kept on a list
+(linked by 'rbentry.right') for reuse, chunks go back to the system
+only when the tree is cleared. */
+typedef struct pool_chunk_t {
+	struct pool_chunk_t *next;
+	rbpoint_t points[];
+} pool_chunk_t;
+
+typedef struct pool_t {
+	pool_chunk_t *chunks;
+	rbpoint_t *next;		/* unused points of the newest chunk */
+	size_t avail;
+	rbnode_t *freelist;
+} pool_t;
+
 static int keycmp(const void *a, const void *b);
 
 static int entries = 0;
 static rbtree_t tree = RBTREE_INIT(keycmp);
 static asc16_t asc16 = { 0 };
+static rbwal_t wal;
+static int wal_on = 0;
+static pool_t pool = { 0 };
+static unsigned long tree_version = 0;	/* bumped on every change of the tree */
+static rbpyramid_t pyramid = { 0 };
+static int pyramid_nil = -1;
+static unsigned long pyramid_version = 0;
 
 #define free_rbtree(rb) rbtree_foreach_postorder((rb), (free_node), NULL)
 
@@ -79,8 +110,25 @@ static void help()
 		"                               in   - inorder.\n"
 		"                               post - postorder.\n"
 		"    load   <path>          load from file.\n"
+		"    loadfast <path>        load from file in bulk, prints a summary only.\n"
 		"    save   <path>          save to file.\n"
+		"    loadbin <path>         load from binary snapshot.\n"
+		"    savebin <path>         save as binary snapshot.\n"
 		"    bmp    [nonil] <path>  save as bitmap.\n"
+		"    svg    [nonil] <path>  save as SVG, with the same layout as bmp.\n"
+		"    dot    [nonil] <path>  save as Graphviz DOT graph.\n"
+		"    tile   [nonil] [<level> <col> <row> <path>]\n"
+		"                           save a 256x256 tile of the zoom pyramid as\n"
+		"                           bitmap, level 0 is a pixel. Without a tile,\n"
+		"                           print the levels.\n"
+		"    profile                print tree shape and memory locality.\n"
+		"    bench  <insert|find|delete> [random|seq] [<count>]\n"
+		"                           time every call on a private tree of <count>\n"
+		"                           keys (default 1000000), print ops/s and\n"
+		"                           latency percentiles.\n"
+		"    wal    <path>|off      clear the tree, recover it from the write-ahead\n"
+		"                           log <path> and log every insert/delete to it.\n"
+		"    ckpt                   checkpoint the tree and truncate the log.\n"
 		"    help                   print help.\n"
 		"    quit                   quit.\n"
 	);
@@ -209,9 +257,57 @@ static int print_node(rbtree_t *tree, rbnode_t *n, void *state)
 	return 0;
 }
 
+/* Returns 'n' zeroed points in a row, or NULL when out of memory. */
+static rbpoint_t *alloc_points(size_t n)
+{
+	pool_chunk_t *c;
+	rbpoint_t *points;
+	size_t size;
+
+	if (n == 1 && !rbnode_is_nil(pool.freelist)) {
+		points = container_of(pool.freelist, rbpoint_t, rbentry);
+		pool.freelist = pool.freelist->right;
+		memset(points, 0, sizeof(rbpoint_t));
+		return points;
+	}
+
+	if (pool.avail < n) {
+		size = n > POOL_CHUNK ? n : POOL_CHUNK;
+		c = calloc(1, sizeof(pool_chunk_t) + size * sizeof(rbpoint_t));
+		if (c == NULL)
+			return NULL;
+		c->next = pool.chunks;
+		pool.chunks = c;
+		pool.next = c->points;
+		pool.avail = size;
+	}
+
+	points = pool.next;
+	pool.next += n;
+	pool.avail -= n;
+	return points;
+}
+
+static rbpoint_t *alloc_point()
+{
+	return alloc_points(1);
+}
+
 static void free_point(rbpoint_t *point)
 {
-	free(point);
+	point->rbentry.right = pool.freelist;
+	pool.freelist = &point->rbentry;
+}
+
+/* Release all points, only when none of them is in use. */
+static void pool_reset()
+{
+	pool_chunk_t *c, *next;
+	for (c = pool.chunks; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	memset(&pool, 0, sizeof(pool_t));
 }
 
 static int free_node(rbtree_t *tree, rbnode_t *n, void *state)
@@ -221,46 +317,133 @@ static int free_node(rbtree_t *tree, rbnode_t *n, void *state)
 	return 0;
 }
 
-static void insert(int v)
+static int wal_encode(const void *key, void *buf, size_t size, void *state)
 {
+	unsigned char *p = buf;
+	unsigned int v = (unsigned int)ptoi(key);
+	if (size >= 4) {
+		p[0] = (unsigned char)v;
+		p[1] = (unsigned char)(v >> 8);
+		p[2] = (unsigned char)(v >> 16);
+		p[3] = (unsigned char)(v >> 24);
+	}
+	return 4;
+}
+
+static rbnode_t *wal_decode(const void *buf, size_t size, void *state)
+{
+	const unsigned char *p = buf;
 	rbpoint_t *point;
 
+	if (size != 4) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	point = alloc_point();
+	if (point == NULL)
+		return NULL;
+	point->rbentry.key = itop((int)((unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+		((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24)));
+	return &point->rbentry;
+}
+
+static void wal_free(rbnode_t *n, void *state)
+{
+	free_point(container_of(n, rbpoint_t, rbentry));
+}
+
+/* Group commit, one fsync for all updates of a command. */
+static void wal_commit()
+{
+	if (wal_on && rbwal_sync(&wal) != 0)
+		printf("Failed to sync write-ahead log: %s.\n", strerror(errno));
+}
+
+/* Quiet insert, fails with EINVAL for negative values,
+ENOMEM or EEXIST. Returns RBWAL_NOT_DURABLE if 'v' is inserted
+but the log failed. */
+static int insert_key(int v)
+{
+	rbpoint_t *point;
+	int r;
+
 	if (v < 0) {
-		printf("insert %d error: require positive integer.\n", v);
-		return;
+		errno = EINVAL;
+		return -1;
 	}
 
-	point = malloc(sizeof(rbpoint_t));
+	point = alloc_point();
 	if (point == NULL) {
-		printf("insert %d error: alloc.\n", v);
-		return;
+		errno = ENOMEM;
+		return -1;
 	}
-	memset(point, 0, sizeof(rbpoint_t));
 	point->rbentry.key = itop(v);
-	if (rbtree_insert(&tree, &point->rbentry) == 0) {
-		printf("insert %d.\n", v);
-		entries++;
-	}
-	else {
-		printf("insert %d error: exist.\n", v);
+	r = wal_on ? rbwal_insert(&wal, &point->rbentry) : rbtree_insert(&tree, &point->rbentry);
+	if (r < 0) {
+		free_point(point);
+		return -1;
 	}
+	entries++;
+	tree_version++;
+	return r;
 }
 
-static void delete(int v)
+/* Quiet delete, fails with ENOENT if 'v' is not in the tree.
+Returns RBWAL_NOT_DURABLE if 'v' is deleted but the log failed. */
+static int delete_key(int v)
 {
 	rbnode_t *n;
-	rbpoint_t *point;
+	int r = 0;
+
 	n = rbtree_lookup(&tree, itop(v));
 	if (n == NULL) {
-		printf("%d not exist.\n", v);
+		errno = ENOENT;
+		return -1;
+	}
+	if (wal_on) {
+		if ((r = rbwal_remove(&wal, n)) < 0)
+			return -1;
 	}
 	else {
-		point = container_of(n, rbpoint_t, rbentry);
 		rbtree_remove(&tree, n);
-		printf("delete %d\n", ptoi(n->key));
-		free_point(point);
-		entries--;
 	}
+	free_point(container_of(n, rbpoint_t, rbentry));
+	entries--;
+	tree_version++;
+	return r;
+}
+
+static void insert(int v)
+{
+	int r = insert_key(v);
+
+	if (r == 0)
+		printf("insert %d.\n", v);
+	else if (r == RBWAL_NOT_DURABLE)
+		printf("insert %d, not durable: %s.\n", v, strerror(errno));
+	else if (v < 0)
+		printf("insert %d error: require positive integer.\n", v);
+	else if (errno == ENOMEM)
+		printf("insert %d error: alloc.\n", v);
+	else if (errno == EEXIST)
+		printf("insert %d error: exist.\n", v);
+	else
+		printf("insert %d error: %s.\n", v, strerror(errno));
+}
+
+static void delete(int v)
+{
+	int r = delete_key(v);
+
+	if (r == 0)
+		printf("delete %d\n", v);
+	else if (r == RBWAL_NOT_DURABLE)
+		printf("delete %d, not durable: %s.\n", v, strerror(errno));
+	else if (errno == ENOENT)
+		printf("%d not exist.\n", v);
+	else
+		printf("delete %d error: %s.\n", v, strerror(errno));
 }
 
 static void lookup(int v)
@@ -281,6 +464,7 @@ static void do_insert(array_t *values)
 	for (i = 0; i < values->entries; i++) {
 		insert(values->array[i]);
 	}
+	wal_commit();
 	printf("%d entries.\n", entries);
 }
 
@@ -290,6 +474,7 @@ static void do_delete(array_t *values)
 	for (i = 0; i < values->entries; i++) {
 		delete(values->array[i]);
 	}
+	wal_commit();
 	printf("%d entries.\n", entries);
 }
 
@@ -371,6 +556,64 @@ static void do_load(const char *path)
 
 	fclose(pf);
 
+	wal_commit();
+
+	printf("%d entries.\n", entries);
+}
+
+static void free_dup(rbnode_t *n, void *state)
+{
+	free_point(container_of(n, rbpoint_t, rbentry));
+}
+
+/* Parse the whole file, sort the values and build the tree from them
+in one pass, instead of inserting one by one. */
+static void do_loadfast(const char *path)
+{
+	int *values;
+	size_t count, unique, bytes, added, i;
+	rbpoint_t *points;
+	rbnode_t **nodes;
+	clock_t start;
+	double secs;
+
+	printf("Loading from %s ...\n", path);
+	start = clock();
+
+	if (fastload_parse(path, &values, &count, &bytes) != 0) {
+		printf("Failed to load %s: %s.\n", path, strerror(errno));
+		return;
+	}
+
+	unique = fastload_sort_unique(values, count);
+	nodes = unique != (size_t)-1 ? malloc((unique + 1) * sizeof(rbnode_t *)) : NULL;
+	points = nodes != NULL && unique > 0 ? alloc_points(unique) : NULL;
+	if (nodes == NULL || (unique > 0 && points == NULL)) {
+		printf("Failed to load %s: alloc.\n", path);
+		free(nodes);
+		free(values);
+		return;
+	}
+
+	for (i = 0; i < unique; i++) {
+		points[i].rbentry.key = itop(values[i]);
+		nodes[i] = &points[i].rbentry;
+	}
+	added = rbtree_build(&tree, nodes, unique, free_dup, NULL);
+	entries += (int)added;
+	tree_version++;
+
+	free(nodes);
+	free(values);
+
+	/* the log has no records of them */
+	if (wal_on && rbwal_checkpoint(&wal) != 0)
+		printf("Failed to checkpoint write-ahead log: %s.\n", strerror(errno));
+
+	secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%lu values, %lu added, %lu duplicates in %.3f s (%.1f MB/s).\n",
+		(unsigned long)count, (unsigned long)added, (unsigned long)(count - added),
+		secs, secs > 0 ? bytes / secs / (1024 * 1024) : 0.0);
 	printf("%d entries.\n", entries);
 }
 
@@ -434,53 +677,322 @@ static void do_save(const char *path)
 	printf("%d entries.\n", entries);
 }
 
-static void do_bmp(const char *path, int nil)
+static int load_key(int key, void *state)
 {
-	bitmap_t *bitmap;
-	printf("Creating bitmap...\n");
+	insert(key);
+	return 0;
+}
+
+static void do_loadbin(const char *path)
+{
+	printf("Loading from %s ...\n", path);
 
-	bitmap = rbtree_save_as_bitmap(&tree, &asc16, nil);
+	if (snapshot_load(path, load_key, NULL) != 0)
+		printf("Failed to load snapshot %s: %s.\n", path, strerror(errno));
 
-	if (bitmap == NULL) {
-		printf("Failed to create bitmap.\n");
-		return;
+	wal_commit();
+
+	printf("%d entries.\n", entries);
+}
+
+static void do_savebin(const char *path)
+{
+	printf("Saving to %s ...\n", path);
+
+	if (snapshot_save(&tree, path, 0) != 0)
+		printf("Failed to save snapshot %s: %s.\n", path, strerror(errno));
+
+	printf("%d entries.\n", entries);
+}
+
+/* The font is set up by the first command that draws text. */
+static asc16_t *font(void)
+{
+	if (asc16.data == NULL)
+		asc16_builtin(&asc16);
+	return &asc16;
+}
+
+static int write_bmp(FILE *pf, int nil)
+{
+	return rbtree_write_bitmap(&tree, font(), nil, 0, pf);
+}
+
+static int write_svg(FILE *pf, int nil)
+{
+	return rbtree_write_svg(&tree, nil, pf);
+}
+
+static int write_dot(FILE *pf, int nil)
+{
+	return rbtree_write_dot(&tree, nil, pf);
+}
+
+typedef struct image_format_t {
+	const char *cmd;
+	const char *ext;
+	const char *name;
+	int (*write)(FILE *pf, int nil);
+} image_format_t;
+
+static const image_format_t image_formats[] = {
+	{ "bmp", ".bmp", "bitmap", write_bmp },
+	{ "svg", ".svg", "SVG", write_svg },
+	{ "dot", ".dot", "DOT graph", write_dot },
+};
+
+static const image_format_t *find_image_format(const char *cmd)
+{
+	size_t i;
+	for (i = 0; i < sizeof(image_formats) / sizeof(image_formats[0]); i++) {
+		if (strcmp(image_formats[i].cmd, cmd) == 0)
+			return &image_formats[i];
 	}
+	return NULL;
+}
+
+static void do_image(const image_format_t *fmt, const char *path, int nil)
+{
+	FILE *pf;
+	int r;
+
+	printf("Creating %s...\n", fmt->name);
 
 	if (path && strlen(path) > 0) {
-		if (bitmap_save(bitmap, path) != 0) {
-			bitmap_free(bitmap);
-			printf("Failed to save bitmap to file %s.\n", path);
+		pf = fopen(path, "wb");
+		if (pf == NULL) {
+			printf("Failed to save %s to file %s.\n", fmt->name, path);
+			return;
+		}
+		r = fmt->write(pf, nil);
+		if (fclose(pf) != 0)
+			r = -1;
+		if (r != 0) {
+			printf("Failed to save %s to file %s: %s.\n", fmt->name, path, strerror(errno));
 			return;
 		}
 	}
 	else {
-		if (bitmap_print(bitmap, stdout) != 0) {
-			bitmap_free(bitmap);
-			printf("Failed to print bitmap to \"stdout\".\n");
+		fflush(stdout);
+		if (fmt->write(stdout, nil) != 0) {
+			printf("Failed to print %s to \"stdout\": %s.\n", fmt->name, strerror(errno));
 			return;
 		}
 		printf("\n");
 	}
 
-	bitmap_free(bitmap);
-
 	printf("Done. %d entries.\n", entries);
 }
 
+/* The pyramid is laid out once and kept until the tree changes. */
+static int load_pyramid(int nil)
+{
+	if (pyramid_nil == nil && pyramid_version == tree_version)
+		return 0;
+	rbpyramid_free(&pyramid);
+	pyramid_nil = -1;
+	if (rbpyramid_init(&pyramid, &tree, font(), nil, RBPYRAMID_TILE_SIZE) != 0)
+		return -1;
+	pyramid_nil = nil;
+	pyramid_version = tree_version;
+	return 0;
+}
+
+static void do_tile(int nil, int level, int col, int row, const char *path)
+{
+	bitmap_t tile;
+	int i, w, h, r;
+
+	if (load_pyramid(nil) != 0) {
+		printf("Failed to lay out the tree: %s.\n", strerror(errno));
+		return;
+	}
+
+	if (level < 0) {
+		printf("%d levels of %dx%d tiles:\n", pyramid.levels, pyramid.tile, pyramid.tile);
+		for (i = 0; i < pyramid.levels; i++) {
+			rbpyramid_level_size(&pyramid, i, &w, &h);
+			printf("  level %2d: %dx%d, %dx%d tiles\n", i, w, h,
+				(w + pyramid.tile - 1) / pyramid.tile,
+				(h + pyramid.tile - 1) / pyramid.tile);
+		}
+		return;
+	}
+
+	if (rbpyramid_render_tile(&pyramid, level, col, row, &tile) != 0) {
+		printf("Failed to render tile %d/%d_%d: %s.\n", level, col, row, strerror(errno));
+		return;
+	}
+
+	if (path && strlen(path) > 0) {
+		r = bitmap_save(&tile, path);
+	}
+	else {
+		fflush(stdout);
+		r = bitmap_print(&tile, stdout);
+		printf("\n");
+	}
+	if (r != 0)
+		printf("Failed to save tile %d/%d_%d: %s.\n", level, col, row, strerror(errno));
+	else
+		printf("Tile %d/%d_%d, %dx%d.\n", level, col, row, tile.cw, tile.ch);
+
+	bitmap_free(&tile);
+}
+
+static void do_profile()
+{
+	rbtree_profile_t report;
+	int i;
+
+	rbtree_profile(&tree, &report);
+
+	printf("nodes:           %lu\n", (unsigned long)report.count);
+	printf("height:          %d\n", report.height);
+	printf("black height:    %d\n", report.black_height);
+	printf("avg path length: %.2f\n", report.avg_path_length);
+	printf("depth histogram:\n");
+	for (i = 0; i < report.height && i < RBTREE_PROFILE_DEPTH_MAX; i++) {
+		printf("  %4d %10lu\n", i, (unsigned long)report.depth_histogram[i]);
+	}
+	printf("parent/child in same line/page:  %lu/%lu of %lu\n",
+		(unsigned long)report.links_same_line,
+		(unsigned long)report.links_same_page,
+		(unsigned long)report.links);
+	printf("neighbors in same line/page:     %lu/%lu of %lu\n",
+		(unsigned long)report.neighbors_same_line,
+		(unsigned long)report.neighbors_same_page,
+		(unsigned long)report.neighbors);
+	printf("locality line/page:              %.3f/%.3f\n",
+		report.line_locality, report.page_locality);
+}
+
+static const char *bench_ops[] = { "insert", "find", "delete" };
+
+static int find_bench_op(const char *name, bench_op_t *op)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(bench_ops) / sizeof(bench_ops[0])); i++) {
+		if (strcmp(bench_ops[i], name) == 0) {
+			*op = (bench_op_t)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Parse the whole of 's' as a positive count.
+If successful, returns 0, otherwise returns -1. */
+static int parse_count(const char *s, int *pv)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || errno == ERANGE || v <= 0 || v > INT_MAX)
+		return -1;
+	*pv = (int)v;
+	return 0;
+}
+
+static void do_bench(bench_op_t op, int random, int n)
+{
+	bench_report_t *report;
+	double ns;
+
+	report = malloc(sizeof(bench_report_t));
+	if (report == NULL) {
+		printf("Failed to run bench: alloc.\n");
+		return;
+	}
+
+	printf("Benchmarking %s of %d keys in %s order ...\n",
+		bench_ops[op], n, random ? "random" : "ascending");
+	if (bench_run(op, random, n, report) != 0) {
+		printf("Failed to run bench: %s.\n", strerror(errno));
+		free(report);
+		return;
+	}
+
+	ns = report->ns_per_tick;
+	printf("%lu ops in %.3f s, %.0f ops/s.\n", (unsigned long)report->ops,
+		report->secs, report->secs > 0 ? report->ops / report->secs : 0.0);
+	printf("latency ns: p50 %.0f, p99 %.0f, p99.9 %.0f, max %.0f\n",
+		bench_hist_percentile(&report->hist, 50) * ns,
+		bench_hist_percentile(&report->hist, 99) * ns,
+		bench_hist_percentile(&report->hist, 99.9) * ns,
+		report->hist.max * ns);
+
+	free(report);
+}
+
 static void do_clean()
 {
 	printf("Cleaning...\n");
 	free_rbtree(&tree);
 	rbtree_init(&tree, keycmp);
+	pool_reset();
 	entries = 0;
+	tree_version++;
+	if (wal_on && rbwal_checkpoint(&wal) != 0)
+		printf("Failed to checkpoint write-ahead log: %s.\n", strerror(errno));
 	printf("%d entries.\n", entries);
 }
 
+static void wal_close()
+{
+	if (wal_on) {
+		if (rbwal_close(&wal) != 0)
+			printf("Failed to close write-ahead log: %s.\n", strerror(errno));
+		wal_on = 0;
+	}
+}
+
+static void do_wal(const char *path)
+{
+	wal_close();
+
+	if (strcmp("off", path) == 0) {
+		printf("Write-ahead log closed.\n");
+		return;
+	}
+
+	do_clean();
+
+	printf("Recovering from %s ...\n", path);
+	if (rbwal_open(&wal, &tree, path, wal_encode, wal_decode, wal_free, NULL) != 0) {
+		printf("Failed to open write-ahead log %s: %s.\n", path, strerror(errno));
+		do_clean();
+		return;
+	}
+	wal_on = 1;
+	entries = (int)rbtree_size(&tree);
+	tree_version++;
+
+	printf("%lu records replayed. %d entries.\n",
+		(unsigned long)wal.log_records, entries);
+}
+
+static void do_checkpoint()
+{
+	if (!wal_on) {
+		printf("No write-ahead log, use \"wal <path>\" to open one.\n");
+		return;
+	}
+	if (rbwal_checkpoint(&wal) != 0) {
+		printf("Failed to checkpoint write-ahead log: %s.\n", strerror(errno));
+		return;
+	}
+	printf("Checkpoint done. %d entries.\n", entries);
+}
+
 static void run()
 {
 	char cmd[COMMAND_MAX];
 	int r, suc;
 	array_t values = { 0 };
+	const image_format_t *fmt;
 
 	while (1) {
 		printf("> ");
@@ -545,13 +1057,16 @@ static void run()
 				do_print(opt);
 			}
 		}
-		else if (strcmp("load", cmd) == 0) {
+		else if (strcmp("load", cmd) == 0 || strcmp("loadfast", cmd) == 0) {
 			char path[FILENAME_MAX];
 			suc = 0;
 			while ((r = next_arg(path, FILENAME_MAX)) != 0) {
 				if (r == FILENAME_MAX)
 					path[FILENAME_MAX - 1] = '\0';
-				do_load(path);
+				if (cmd[4] == '\0')
+					do_load(path);
+				else
+					do_loadfast(path);
 				suc++;
 			}
 			if (suc == 0)
@@ -569,7 +1084,22 @@ static void run()
 			if (suc == 0)
 				printf("Invalid argument: require path.\n");
 		}
-		else if (strcmp("bmp", cmd) == 0) {
+		else if (strcmp("loadbin", cmd) == 0 || strcmp("savebin", cmd) == 0) {
+			char path[FILENAME_MAX];
+			suc = 0;
+			while ((r = next_arg(path, FILENAME_MAX)) != 0) {
+				if (r == FILENAME_MAX)
+					path[FILENAME_MAX - 1] = '\0';
+				if (cmd[0] == 'l')
+					do_loadbin(path);
+				else
+					do_savebin(path);
+				suc++;
+			}
+			if (suc == 0)
+				printf("Invalid argument: require path.\n");
+		}
+		else if ((fmt = find_image_format(cmd)) != NULL) {
 			char path[FILENAME_MAX], *p;
 			int nil = 0;
 			suc = 0;
@@ -589,25 +1119,92 @@ static void run()
 				p = path;
 				while (*p && (*p) != '.')
 					p++;
-				if (*p == '.' && strcasecmp(".bmp", p)) {
-					printf("Invalid path \"%s\": require \".bmp\" file.\n", path);
+				if (*p == '.' && strcasecmp(fmt->ext, p)) {
+					printf("Invalid path \"%s\": require \"%s\" file.\n", path, fmt->ext);
 					clean_input_buffer();
 					break;
 				}
 				if (*p == '\0') {
-					if (r >= FILENAME_MAX - 4) {
+					if (r >= FILENAME_MAX - (int)strlen(fmt->ext)) {
 						printf("Invalid path \"%s\": too long.\n", path);
 						clean_input_buffer();
 						break;
 					}
-					strcat(path, ".bmp");
+					strcat(path, fmt->ext);
 				}
 
-				do_bmp(path, nil == 1 ? 0 : 1);
+				do_image(fmt, path, nil == 1 ? 0 : 1);
 				suc++;
 			}
 			if (suc == 0)
-				do_bmp(NULL, nil == 1 ? 0 : 1);
+				do_image(fmt, NULL, nil == 1 ? 0 : 1);
+		}
+		else if (strcmp("tile", cmd) == 0) {
+			char args[5][FILENAME_MAX];
+			int n = 0, nil = 1, a = 0;
+			while (n < 5 && (r = next_arg(args[n], FILENAME_MAX)) != 0) {
+				if (r == FILENAME_MAX)
+					args[n][FILENAME_MAX - 1] = '\0';
+				n++;
+			}
+			if (n == 5)
+				clean_input_buffer();
+			if (n > 0 && strcmp("nonil", args[0]) == 0) {
+				nil = 0;
+				a++;
+			}
+			if (n == a)
+				do_tile(nil, -1, 0, 0, NULL);
+			else if (n - a >= 3)
+				do_tile(nil, atoi(args[a]), atoi(args[a + 1]), atoi(args[a + 2]),
+					n - a > 3 ? args[a + 3] : NULL);
+			else
+				printf("Invalid arguments, usage: tile [nonil] [<level> <col> <row> [path]]\n");
+		}
+		else if (strcmp("profile", cmd) == 0) {
+			clean_input_buffer();
+			do_profile();
+		}
+		else if (strcmp("bench", cmd) == 0) {
+			char args[3][FILENAME_MAX];
+			int n = 0, random = 1, count = BENCH_KEYS, bad = 0;
+			bench_op_t op;
+			while (n < 3 && (r = next_arg(args[n], FILENAME_MAX)) != 0) {
+				if (r == FILENAME_MAX) {
+					args[n][FILENAME_MAX - 1] = '\0';
+					bad = 1;
+				}
+				n++;
+			}
+			if (n == 3)
+				clean_input_buffer();
+			for (r = 1; r < n; r++) {
+				if (strcmp("random", args[r]) == 0)
+					random = 1;
+				else if (strcmp("seq", args[r]) == 0)
+					random = 0;
+				else if (parse_count(args[r], &count) != 0)
+					bad = 1;
+			}
+			if (n == 0 || find_bench_op(args[0], &op) != 0 || bad)
+				printf("Invalid arguments, usage: bench <insert|find|delete> [random|seq] [<count>]\n");
+			else
+				do_bench(op, random, count);
+		}
+		else if (strcmp("wal", cmd) == 0) {
+			char path[FILENAME_MAX];
+			r = next_arg(path, FILENAME_MAX);
+			if (r == FILENAME_MAX)
+				path[FILENAME_MAX - 1] = '\0';
+			clean_input_buffer();
+			if (r == 0)
+				printf("Invalid argument: require path.\n");
+			else
+				do_wal(path);
+		}
+		else if (strcmp("ckpt", cmd) == 0) {
+			clean_input_buffer();
+			do_checkpoint();
 		}
 		else if (strcmp("help", cmd) == 0 || strcmp("?", cmd) == 0 || strcmp("h", cmd) == 0) {
 			help();
@@ -625,20 +1222,243 @@ static void run()
 
 	free(values.array);
 
+	wal_close();
+
 	free_rbtree(&tree);
+	pool_reset();
 
 }
 
-int main(int argc, char **argv)
+/* Command file read in blocks, split into lines in place. */
+typedef struct batch_t {
+	FILE *pf;
+	const char *name;
+	char *buf;
+	size_t pos, len;
+	int eof;
+	unsigned long line;
+	unsigned long ops, inserted, deleted, found, missed;
+} batch_t;
+
+/* Returns 1 and the next line, 0 at the end, -1 on errors. */
+static int batch_line(batch_t *b, char **line)
+{
+	char *p, *nl;
+	size_t n;
+
+	for (;;) {
+		p = b->buf + b->pos;
+		nl = memchr(p, '\n', b->len - b->pos);
+		if (nl != NULL || (b->eof && b->pos < b->len)) {
+			if (nl == NULL)
+				nl = b->buf + b->len;
+			*nl = '\0';
+			b->pos = nl - b->buf + (nl < b->buf + b->len);
+			b->line++;
+			*line = p;
+			return 1;
+		}
+		if (b->eof)
+			return 0;
+		/* keep the partial line, read after it */
+		n = b->len - b->pos;
+		if (n == BATCH_BUFSIZE) {
+			errno = E2BIG;
+			return -1;
+		}
+		memmove(b->buf, p, n);
+		b->pos = 0;
+		b->len = n + fread(b->buf + n, 1, BATCH_BUFSIZE - n, b->pf);
+		if (b->len == n) {
+			if (ferror(b->pf)) {
+				errno = EIO;
+				return -1;
+			}
+			b->eof = 1;
+		}
+	}
+}
+
+static inline char *skip_space(char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r')
+		p++;
+	return p;
+}
+
+/* Returns 1 and the next integer of 'p', 0 at the end of the line,
+-1 if it is not an integer or out of range. */
+static int batch_value(char **pp, int *pv)
+{
+	char *p = skip_space(*pp);
+	int negative = 0, d;
+	unsigned int v = 0, max = INT_MAX;
+
+	if (*p == '\0') {
+		*pp = p;
+		return 0;
+	}
+	if (*p == '-' || *p == '+') {
+		negative = *p == '-';
+		p++;
+	}
+	if (!isdigit((unsigned char)*p)) {
+		errno = EINVAL;
+		return -1;
+	}
+	do {
+		d = *p++ - '0';
+		if (v > (max - d) / 10) {
+			errno = ERANGE;
+			return -1;
+		}
+		v = v * 10 + d;
+	} while (isdigit((unsigned char)*p));
+	if (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*pv = negative ? -(int)v : (int)v;
+	*pp = p;
+	return 1;
+}
+
+/* Run the commands of one file, without output per command. */
+static int batch_run(batch_t *b)
 {
-	if (asc16_load(&asc16, "ASC16")) {
-		printf("Failed to read \"ASC16\"\n");
+	char *p, *cmd;
+	int r, v, op;
+
+	while ((r = batch_line(b, &p)) == 1) {
+		p = skip_space(p);
+		if (*p == '\0' || *p == '#')
+			continue;
+		cmd = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+			p++;
+		if (*p != '\0')
+			*p++ = '\0';
+
+		if (strcmp("insert", cmd) == 0 || strcmp("i", cmd) == 0)
+			op = 'i';
+		else if (strcmp("delete", cmd) == 0 || strcmp("d", cmd) == 0)
+			op = 'd';
+		else if (strcmp("find", cmd) == 0 || strcmp("f", cmd) == 0)
+			op = 'f';
+		else if (strcmp("clear", cmd) == 0 || strcmp("c", cmd) == 0) {
+			free_rbtree(&tree);
+			rbtree_init(&tree, keycmp);
+			pool_reset();
+			entries = 0;
+			tree_version++;
+			b->ops++;
+			continue;
+		}
+		else if (strcmp("quit", cmd) == 0 || strcmp("exit", cmd) == 0 || strcmp("q", cmd) == 0)
+			return 0;
+		else {
+			printf("%s:%lu: unknown command \"%s\", batch mode takes insert, delete, find, clear and quit.\n",
+				b->name, b->line, cmd);
+			return -1;
+		}
+
+		while ((r = batch_value(&p, &v)) == 1) {
+			b->ops++;
+			if (op == 'i') {
+				if (insert_key(v) >= 0)
+					b->inserted++;
+				else if (errno == EEXIST || v < 0)
+					b->missed++;
+				else
+					break;
+			}
+			else if (op == 'd') {
+				if (delete_key(v) >= 0)
+					b->deleted++;
+				else if (errno == ENOENT)
+					b->missed++;
+				else
+					break;
+			}
+			else if (rbtree_lookup(&tree, itop(v)) != NULL)
+				b->found++;
+			else
+				b->missed++;
+		}
+		if (r == 1) {
+			printf("%s:%lu: %s %d error: %s.\n", b->name, b->line, cmd, v, strerror(errno));
+			return -1;
+		}
+		if (r != 0) {
+			printf("%s:%lu: invalid value \"%s\".\n", b->name, b->line, skip_space(p));
+			return -1;
+		}
+	}
+
+	if (r != 0)
+		printf("Failed to read %s after line %lu: %s.\n", b->name, b->line, strerror(errno));
+	return r;
+}
+
+/* rbtree --batch [path]...: run command files, or stdin,
+and print only a summary. */
+static int batch_main(int argc, char **argv)
+{
+	batch_t b = { 0 };
+	double start, secs;
+	int i, r = 0;
+
+	b.buf = malloc(BATCH_BUFSIZE + 1);
+	if (b.buf == NULL) {
+		printf("Failed to start batch: alloc.\n");
 		return EXIT_FAILURE;
 	}
 
+	start = bench_seconds();
+	for (i = 0; r == 0 && (i < argc || (i == 0 && argc == 0)); i++) {
+		if (i == argc || strcmp("-", argv[i]) == 0) {
+			b.pf = stdin;
+			b.name = "stdin";
+		}
+		else if ((b.pf = fopen(argv[i], "rb")) == NULL) {
+			printf("Can't open the file %s.\n", argv[i]);
+			r = -1;
+			break;
+		}
+		else {
+			b.name = argv[i];
+		}
+		b.pos = b.len = 0;
+		b.eof = 0;
+		b.line = 0;
+		r = batch_run(&b);
+		if (b.pf != stdin)
+			fclose(b.pf);
+	}
+	secs = bench_seconds() - start;
+
+	printf("%lu ops in %.3f s (%.0f ops/s): %lu inserted, %lu deleted, %lu found, %lu missed.\n",
+		b.ops, secs, secs > 0 ? b.ops / secs : 0.0,
+		b.inserted, b.deleted, b.found, b.missed);
+	printf("%d entries.\n", entries);
+
+	free(b.buf);
+	free_rbtree(&tree);
+	pool_reset();
+
+	return r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && strcmp("--batch", argv[1]) == 0)
+		return batch_main(argc - 2, argv + 2);
+
 	if (argc > 1) {
 		int i;
 		char *cmd;
+		const image_format_t *fmt;
 		for (i = 1; i < argc; i++) {
 			cmd = argv[i];
 			if (strcmp("insert", cmd) == 0 || strcmp("i", cmd) == 0) {
@@ -651,6 +1471,7 @@ int main(int argc, char **argv)
 					}
 					else {
 						insert(v);
+						wal_commit();
 					}
 				}
 				else {
@@ -668,6 +1489,7 @@ int main(int argc, char **argv)
 					}
 					else {
 						delete(v);
+						wal_commit();
 					}
 				}
 				else {
@@ -706,13 +1528,16 @@ int main(int argc, char **argv)
 				}
 				do_print(opt);
 			}
-			else if (strcmp("load", cmd) == 0) {
+			else if (strcmp("load", cmd) == 0 || strcmp("loadfast", cmd) == 0) {
 				i++;
 				if (i < argc) {
-					do_load(argv[i]);
+					if (cmd[4] == '\0')
+						do_load(argv[i]);
+					else
+						do_loadfast(argv[i]);
 				}
 				else {
-					printf("Invalid arguments, usage: rbtree [load <path>] [load <path>]...\n");
+					printf("Invalid arguments, usage: rbtree [%s <path>]...\n", cmd);
 					return EXIT_FAILURE;
 				}
 			}
@@ -726,34 +1551,92 @@ int main(int argc, char **argv)
 					return EXIT_FAILURE;
 				}
 			}
-			else if (strcmp("bmp", cmd) == 0) {
+			else if (strcmp("loadbin", cmd) == 0 || strcmp("savebin", cmd) == 0) {
+				i++;
+				if (i < argc) {
+					if (cmd[0] == 'l')
+						do_loadbin(argv[i]);
+					else
+						do_savebin(argv[i]);
+				}
+				else {
+					printf("Invalid arguments, usage: rbtree [%s <path>]...\n", cmd);
+					return EXIT_FAILURE;
+				}
+			}
+			else if ((fmt = find_image_format(cmd)) != NULL) {
 				const char *path = NULL, *p;
 				int nil = 1;
 
+				if ((i + 1) < argc && strcmp("nonil", argv[i + 1]) == 0) {
+					nil = 0;
+					i++;
+				}
 				if ((i + 1) < argc) {
-					if (nil == 0) {
-						if (strcmp("nonil", argv[i + 1]) == 0) {
-							nil = 0;
-							i++;
-						}
-					}
-					if ((i + 1) < argc) {
-						path = argv[i + 1];
-						p = path;
-						while (*p && (*p) != '.')
-							p++;
-						if (*p == '.' && strcasecmp(".bmp", p) == 0)
-							i++;
-						else
-							path = NULL;
-					}
-					do_bmp(path, nil);
+					path = argv[i + 1];
+					p = path;
+					while (*p && (*p) != '.')
+						p++;
+					if (*p == '.' && strcasecmp(fmt->ext, p) == 0)
+						i++;
+					else
+						path = NULL;
 				}
+				do_image(fmt, path, nil);
+			}
+			else if (strcmp("tile", cmd) == 0) {
+				int nil = 1;
+
+				if ((i + 1) < argc && strcmp("nonil", argv[i + 1]) == 0) {
+					nil = 0;
+					i++;
+				}
+				if ((i + 4) < argc && isdigit((unsigned char)argv[i + 1][0])) {
+					do_tile(nil, atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]), argv[i + 4]);
+					i += 4;
+				}
+				else {
+					do_tile(nil, -1, 0, 0, NULL);
+				}
+			}
+			else if (strcmp("profile", cmd) == 0) {
+				do_profile();
+			}
+			else if (strcmp("bench", cmd) == 0) {
+				int random = 1, count = BENCH_KEYS;
+				bench_op_t op;
+				i++;
+				if (i >= argc || find_bench_op(argv[i], &op) != 0) {
+					printf("Invalid arguments, usage: rbtree [bench <insert|find|delete> [random|seq] [<count>]]...\n");
+					return EXIT_FAILURE;
+				}
+				if ((i + 1) < argc && (strcmp("random", argv[i + 1]) == 0 || strcmp("seq", argv[i + 1]) == 0))
+					random = strcmp("seq", argv[++i]) != 0;
+				if ((i + 1) < argc && isdigit((unsigned char)argv[i + 1][0]) &&
+					parse_count(argv[++i], &count) != 0) {
+					printf("Invalid count, the count should be a positive integer.\n");
+					return EXIT_FAILURE;
+				}
+				do_bench(op, random, count);
+			}
+			else if (strcmp("wal", cmd) == 0) {
+				i++;
+				if (i < argc) {
+					do_wal(argv[i]);
+				}
+				else {
+					printf("Invalid arguments, usage: rbtree [wal <path>|off]...\n");
+					return EXIT_FAILURE;
+				}
+			}
+			else if (strcmp("ckpt", cmd) == 0) {
+				do_checkpoint();
 			}
 			else if (strcmp("help", cmd) == 0 || strcmp("?", cmd) == 0 || strcmp("h", cmd) == 0) {
 				help();
 			}
 			else if (strcmp("quit", cmd) == 0 || strcmp("exit", cmd) == 0 || strcmp("q", cmd) == 0) {
+				wal_close();
 				return EXIT_SUCCESS;
 			}
 			else {
@@ -769,6 +1652,7 @@ int main(int argc, char **argv)
 
 	run();
 
+	rbpyramid_free(&pyramid);
 	asc16_free(&asc16);
 
 	return EXIT_SUCCESS;